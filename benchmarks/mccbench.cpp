@@ -0,0 +1,642 @@
+//
+//  mccbench.cpp
+//  Benchmarks for the acquisition and conversion hot paths.
+//  Everything runs against MCCSimTransport, so no hardware is needed and numbers are
+//  comparable between builds. Usage: mccbench [seconds per end-to-end test]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mccdevice.h"
+#include "mccsimdevice.h"
+#include "mccacquisition.h"
+#include "mcccodec.h"
+#include "mccfilter.h"
+#include "mccshm.h"
+#include "mccclock.h"
+#include "mcctrigger.h"
+#include "mcchistory.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+//Keep results alive so the optimizer cannot drop the loops being timed.
+static volatile float sink;
+
+static void printLatencies(const char* name, std::vector<double>& usec)
+{
+    if (usec.empty())
+    {
+        printf("%-34s no samples\n", name);
+        return;
+    }
+    std::sort(usec.begin(), usec.end());
+    size_t n = usec.size();
+    printf("%-34s p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f us  (n=%zu)\n", name,
+           usec[n/2], usec[n*9/10], usec[std::min(n - 1, n*99/100)], usec[n - 1], n);
+}
+
+static MCCDevice* openSimDevice(int channels, float rate, int samplesPerBlock, bool paced)
+{
+    MCCSimTransport* sim = new MCCSimTransport(channels, 64);
+    sim->setPaced(paced);
+    MCCDevice* dev = new MCCDevice(USB_1608_FS_PLUS, sim);
+    char msg[64];
+    snprintf(msg, sizeof(msg), "AISCAN:RATE=%.0f", rate);
+    dev->sendMessage(msg);
+    dev->mSamplesPerBlock = samplesPerBlock;
+    dev->reconfigure();
+    return dev;
+}
+
+static void benchConversion(int channels)
+{
+    const int frames = 4096;
+    const int reps = 200;
+    const int length = frames * channels;
+    MCCDevice* dev = openSimDevice(channels, 1000, frames, false);
+    std::vector<unsigned short> raw(length);
+    std::vector<float> out(length);
+    std::vector<int32_t> outInt(length);
+    for (int i = 0; i < length; i++)
+        raw[i] = (unsigned short)(i * 7919);
+
+    printf("\nConversion, %d channels (ns/sample, %s kernel)\n", channels, MCCConverter::kernelName());
+
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        for (int i = 0; i < length; i++)
+            out[i] = dev->scaleAndCalibrateData(raw[i], i % channels);
+    sink = out[length - 1];
+    printf("  %-32s %8.3f\n", "scaleAndCalibrateData", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        dev->scaleAndCalibrateBlock(raw.data(), out.data(), length);
+    sink = out[length - 1];
+    printf("  %-32s %8.3f\n", "scaleAndCalibrateBlock", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        dev->getConverter().convert(raw.data(), out.data(), length, MCC_LAYOUT_CHANNEL_MAJOR);
+    sink = out[length - 1];
+    printf("  %-32s %8.3f\n", "convert channel-major", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        dev->getConverter().convertMicrovolts(raw.data(), outInt.data(), length);
+    sink = (float)outInt[length - 1];
+    printf("  %-32s %8.3f\n", "convertMicrovolts", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    //Per-channel monitoring statistics: a separate pass over the block as a caller would write it,
+    //against MCCChannelStats accumulating in the conversion pass.
+    std::vector<double> sum(channels), squares(channels);
+    std::vector<unsigned short> lo(channels), hi(channels);
+    std::vector<unsigned> clipped(channels);
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        dev->scaleAndCalibrateBlock(raw.data(), out.data(), length);
+        for (int c = 0; c < channels; c++)
+        {
+            sum[c] = squares[c] = 0;
+            lo[c] = 0xFFFF;
+            hi[c] = 0;
+            clipped[c] = 0;
+        }
+        for (int i = 0; i < length; i++)
+        {
+            int c = i % channels;
+            sum[c] += out[i];
+            squares[c] += out[i] * out[i];
+            lo[c] = std::min(lo[c], raw[i]);
+            hi[c] = std::max(hi[c], raw[i]);
+            clipped[c] += raw[i] == 0 || raw[i] == dev->getMaxCounts();
+        }
+    }
+    sink = (float)(sum[0] + squares[0] + lo[0] + hi[0] + clipped[0]);
+    printf("  %-32s %8.3f\n", "convert, then stats pass", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    dev->setChannelStatsWindow(frames);
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        dev->scaleAndCalibrateBlock(raw.data(), out.data(), length);
+    sink = out[length - 1];
+    printf("  %-32s %8.3f\n", "convert with MCCChannelStats", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    delete dev;
+}
+
+//Threshold detection on two of the channels: a scalar scan of converted volts, as a caller would
+//write it after getBlock(), against MCCTriggerEngine comparing raw counts.
+static void benchTrigger(int channels)
+{
+    const int scans = 4096;
+    const int reps = 200;
+    const int length = scans * channels;
+    MCCDevice* dev = openSimDevice(channels, 1000, scans, false);
+    std::vector<unsigned short> raw(length);
+    std::vector<float> volts(length);
+    for (int i = 0; i < length; i++)
+        raw[i] = (unsigned short)(32768 + 20000 * sin(i * 0.0005));
+
+    printf("  %2d channels (ns/sample)\n", channels);
+
+    bool high = false;
+    unsigned long long found = 0;
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        dev->scaleAndCalibrateBlock(raw.data(), volts.data(), length);
+        for (int s = 0; s < scans; s++)
+        {
+            float v = volts[s * channels + channels / 2];
+            if (!high && v >= 5.0f)
+            {
+                high = true;
+                found++;
+            }
+            else if (high && v <= 4.9f)
+                high = false;
+        }
+    }
+    sink = (float)found;
+    printf("    %-30s %8.3f\n", "convert, then scalar scan", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    MCCTriggerEngine trig(dev->getConverter(), 1 << 16);
+    trig.setTrigger(channels / 2, 5.0, 0.1, MCC_EDGE_RISING);
+    trig.setCallback([&found](const MCCTriggerEvent&) { found++; });
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        trig.process(raw.data(), length, (unsigned long long)r * length);
+    sink = (float)found;
+    printf("    %-30s %8.3f\n", "MCCTriggerEngine::process", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    delete dev;
+}
+
+//Appending to the pre-trigger history, and extracting windows from it: in place from MCCHistoryRing
+//against copying the two pieces out of an ordinary wrap-around ring.
+static void benchHistory(int channels)
+{
+#ifndef _WIN32
+    const int block = 256 * channels;
+    const int capacityScans = 100000;
+    const int windowScans = 20000;
+    const int reps = 2000;
+    MCCDevice* dev = openSimDevice(channels, 1000, 256, false);
+    MCCHistoryRing history(dev->getConverter(), capacityScans);
+    std::vector<unsigned short> raw(block);
+    for (int i = 0; i < block; i++)
+        raw[i] = (unsigned short)(i * 7919);
+
+    printf("  %2d channels, %d-scan windows\n", channels, windowScans);
+
+    unsigned long long sample = 0;
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; r++, sample += block)
+        history.append(raw.data(), block, sample);
+    printf("    %-30s %8.3f ns/sample\n", "append", secondsSince(start) * 1e9 / ((double)reps * block));
+
+    //A wrap-around ring of the same size with its write position in the middle, so windows straddle the end.
+    std::vector<unsigned short> plain((size_t)history.capacityScans() * channels);
+    std::vector<unsigned short> copy((size_t)windowScans * channels);
+    size_t split = plain.size() / 2;
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        size_t first = (split + plain.size() - copy.size() / 2) % plain.size();
+        size_t head = std::min(copy.size(), plain.size() - first);
+        memcpy(copy.data(), &plain[first], head * sizeof(unsigned short));
+        memcpy(&copy[head], plain.data(), (copy.size() - head) * sizeof(unsigned short));
+    }
+    sink = copy[copy.size() / 2];
+    printf("    %-30s %8.3f us/window\n", "copy out of a plain ring", secondsSince(start) * 1e6 / reps);
+
+    MCCHistoryView view;
+    unsigned long long middle = history.scansWritten() - windowScans;
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        if (history.window(middle, windowScans / 2, windowScans / 2, &view))
+            sink = view.data[view.scans / 2];
+    printf("    %-30s %8.3f us/window\n", "MCCHistoryRing::window", secondsSince(start) * 1e6 / reps);
+
+    delete dev;
+#else
+    (void)channels;
+#endif
+}
+
+//FIR decimation of a block to volts, per input sample. The first case filters every scan and drops the rest afterwards.
+static void benchDecimation(int channels, int factor)
+{
+    const int scans = 4096;
+    const int reps = 50;
+    const int length = scans * channels;
+    MCCDevice* dev = openSimDevice(channels, 1000, scans, false);
+    const MCCConverter& converter = dev->getConverter();
+    std::vector<float> taps = MCCDecimator::lowpass(factor);
+    std::vector<unsigned short> raw(length);
+    std::vector<float> volts(length), out(length);
+    for (int i = 0; i < length; i++)
+        raw[i] = (unsigned short)(i * 7919);
+
+    printf("  %2d channels, factor %2d, %3zu taps (ns/input sample)\n", channels, factor, taps.size());
+
+    //History kept inside the block, as a hand-written filter over getBlock() output would.
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        converter.convert(raw.data(), volts.data(), length);
+        for (int s = (int)taps.size() - 1; s < scans; s++)
+            for (int c = 0; c < channels; c++)
+            {
+                float sum = 0;
+                for (size_t k = 0; k < taps.size(); k++)
+                    sum += taps[k] * volts[(s - k) * channels + c];
+                out[s * channels + c] = sum;
+            }
+    }
+    sink = out[length - 1];
+    printf("    %-30s %8.3f\n", "filter every scan, then drop", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    MCCDecimator fromVolts(channels, taps, factor);
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        converter.convert(raw.data(), volts.data(), length);
+        fromVolts.process(volts.data(), scans, out.data());
+    }
+    sink = out[0];
+    printf("    %-30s %8.3f\n", "convert, then MCCDecimator", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    MCCDecimator fromCounts(channels, taps, factor);
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        fromCounts.process(raw.data(), scans, out.data(), converter);
+    sink = out[0];
+    printf("    %-30s %8.3f\n", "MCCDecimator on counts", secondsSince(start) * 1e9 / ((double)reps * length));
+
+    delete dev;
+}
+
+//Recording codec on a slow sine plus a few counts of noise, roughly what a quiet channel looks like.
+static void benchCodec(int channels)
+{
+    const int scans = 4096;
+    const int reps = 200;
+    std::vector<unsigned short> raw((size_t)scans * channels), decoded(raw.size());
+    std::vector<uint8_t> encoded(MCCDeltaCodec::maxEncodedSize(channels, scans));
+    for (int s = 0; s < scans; s++)
+        for (int c = 0; c < channels; c++)
+            raw[(size_t)s * channels + c] = (unsigned short)(32768 + 3000 * sin(s * 0.002 * (c + 1)) + rand() % 20);
+
+    MCCDeltaCodec codec(channels);
+    size_t bytes = 0;
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        bytes = codec.encode(raw.data(), scans, encoded.data());
+    double encodeNs = secondsSince(start) * 1e9 / ((double)reps * raw.size());
+
+    bool ok = true;
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+        ok = codec.decode(encoded.data(), bytes, scans, decoded.data()) && ok;
+    double decodeNs = secondsSince(start) * 1e9 / ((double)reps * raw.size());
+
+    printf("  %2d channels: ratio %5.2f  encode %6.2f ns/sample  decode %6.2f ns/sample%s\n", channels,
+           raw.size() * 2.0 / bytes, encodeNs, decodeNs, ok && decoded == raw ? "" : "  MISMATCH");
+}
+
+static void benchParsing()
+{
+    const int reps = 200000;
+    std::string responses[] = { "AISCAN:RATE=100000.000", "AI{3}:SLOPE=1.002345", "AI{3}:OFFSET=-12.5000" };
+    size_t offsets[] = { 12, 12, 13 };
+    float total = 0;
+
+    printf("\nDAQFlex response handling\n");
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        std::string resp = responses[r % 3];
+        total += fromString<float>(resp.erase(0, offsets[r % 3]));
+    }
+    sink = total;
+    printf("  %-32s %8.1f ns/response\n", "erase + fromString<float>", secondsSince(start) * 1e9 / reps);
+
+    MCCCommand queries[] = { MCCCommand::query("AISCAN:RATE"), MCCCommand::query("AI", 3, "SLOPE"), MCCCommand::query("AI", 3, "OFFSET") };
+    MCCResponse response;
+    double value;
+    total = 0;
+    start = Clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+        strcpy(response.text, responses[r % 3].c_str());
+        if (response.toDouble(queries[r % 3], &value))
+            total += (float)value;
+    }
+    sink = total;
+    printf("  %-32s %8.1f ns/response\n", "MCCResponse::toDouble", secondsSince(start) * 1e9 / reps);
+
+    MCCDevice* dev = openSimDevice(8, 1000, 1, false);
+    const int reconfigures = 2000;
+    start = Clock::now();
+    for (int r = 0; r < reconfigures; r++)
+        dev->reconfigure();
+    printf("  %-32s %8.1f us/call (8 channels, in-process transport)\n", "reconfigure()", secondsSince(start) * 1e6 / reconfigures);
+    delete dev;
+
+    //An uncached reconfigure sends its queries one at a time; submit below batches them through the control queue.
+    dev = openSimDevice(16, 1000, 1, false);
+    dev->sendMessage("AISCAN:LOWCHAN=0");
+    dev->sendMessage("AISCAN:HIGHCHAN=15");
+    start = Clock::now();
+    for (int r = 0; r < reconfigures / 10; r++)
+        dev->reconfigure(true);
+    printf("  %-32s %8.1f us/call (16 channels, in-process transport)\n", "reconfigure(true)", secondsSince(start) * 1e6 / (reconfigures / 10));
+    start = Clock::now();
+    for (int r = 0; r < reconfigures; r++)
+        dev->queryDouble(MCCCommand::query("AI", 3, "SLOPE"));
+    printf("  %-32s %8.1f us/call\n", "queryDouble, one at a time", secondsSince(start) * 1e6 / reconfigures);
+    std::vector<std::future<MCCResponse> > replies;
+    start = Clock::now();
+    for (int r = 0; r < reconfigures; r++)
+        replies.push_back(dev->submit(MCCCommand::query("AI", 3, "SLOPE")));
+    for (int r = 0; r < reconfigures; r++)
+        replies[r].get();
+    printf("  %-32s %8.1f us/call\n", "submit, batched", secondsSince(start) * 1e6 / reconfigures);
+    delete dev;
+}
+
+//Unpaced: how fast the host side can move data. Paced: how late each block is relative to when the device finished it.
+static void benchEndToEnd(const char* name, int channels, float rate, int samplesPerBlock, bool paced, int mode, double seconds)
+{
+    MCCDevice* dev = openSimDevice(channels, rate, samplesPerBlock, paced);
+    std::vector<double> latency;
+    double blockSeconds = samplesPerBlock / (double)rate;
+    unsigned long long blocks = 0, overruns = 0;
+
+    if (mode == 1)
+        dev->startStream(16);
+    else if (mode == 3)
+        dev->startStream(16, 0, true);
+    dev->sendMessage("AISCAN:START");
+    Clock::time_point start = Clock::now();
+
+    if (mode == 2)
+    {
+        MCCAcquisition acq(*dev, 64);
+        std::vector<unsigned short> block(acq.blockLength());
+        acq.start();
+        Clock::time_point t0 = Clock::now();
+        while (secondsSince(start) < seconds && acq.read(block.data(), 1000))
+        {
+            blocks++;
+            if (paced)
+                latency.push_back((secondsSince(start) - blocks * blockSeconds) * 1e6);
+            else
+                latency.push_back(secondsSince(t0) * 1e6);
+            t0 = Clock::now();
+        }
+        acq.stop();
+        overruns = acq.overruns();
+    }
+    else if (mode == 3)
+    {
+        MCCStreamBuffer buffer;
+        Clock::time_point t0 = Clock::now();
+        double scans = 0;
+        while (secondsSince(start) < seconds && dev->acquireBuffer(&buffer, 1000))
+        {
+            scans += buffer.length / 2.0 / channels;
+            sink = ((unsigned short*)buffer.data)[0];
+            dev->releaseBuffer(buffer);
+            if (paced)
+                latency.push_back((secondsSince(start) - scans / rate) * 1e6);
+            else
+                latency.push_back(secondsSince(t0) * 1e6);
+            t0 = Clock::now();
+        }
+        blocks = (unsigned long long)(scans / samplesPerBlock);
+    }
+    else
+    {
+        while (secondsSince(start) < seconds)
+        {
+            Clock::time_point t0 = Clock::now();
+            dev->getBlock();
+            blocks++;
+            if (paced)
+                latency.push_back((secondsSince(start) - blocks * blockSeconds) * 1e6);
+            else
+                latency.push_back(secondsSince(t0) * 1e6);
+        }
+    }
+    double elapsed = secondsSince(start);
+    dev->sendMessage("AISCAN:STOP");
+
+    double samples = (double)blocks * samplesPerBlock * channels;
+    printf("  %-32s %10.0f samples/s  %8.2f MB/s\n", name, samples / elapsed, samples * 2 / elapsed / 1e6);
+    printLatencies(paced ? "    delivery delay" : (mode == 2 ? "    read call" : (mode == 3 ? "    acquireBuffer call" : "    getBlock call")), latency);
+    if (overruns > 0)
+        printf("    %llu blocks dropped as overruns\n", overruns);
+    delete dev;
+}
+
+//Paced synchronous reads with blocks and transfers sized by MCCTransferPolicy: what each latency target costs.
+static void benchTransferSizing(double targetLatency, double seconds)
+{
+    MCCDevice* dev = openSimDevice(8, 100000, 1, true);
+    dev->setTransferPolicy(MCCTransferPolicy(targetLatency));
+    const MCCTransferPlan& plan = dev->getTransferPlan();
+    std::vector<double> latency;
+    unsigned long long blocks = 0;
+
+    dev->sendMessage("AISCAN:START");
+    Clock::time_point start = Clock::now();
+    clock_t cpuStart = clock();
+    while (secondsSince(start) < seconds)
+    {
+        dev->getBlock();
+        blocks++;
+        latency.push_back((secondsSince(start) - blocks * plan.latency) * 1e6);
+    }
+    double cpu = (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+    double elapsed = secondsSince(start);
+    dev->sendMessage("AISCAN:STOP");
+
+    printf("  target %5.1f ms: %6d-byte transfers  %8.0f transfers/s  CPU %5.1f%%\n", targetLatency * 1e3,
+           plan.transferSize, dev->getStats().snapshot().transfers / elapsed, cpu / elapsed * 100);
+    printLatencies("    delivery delay", latency);
+    delete dev;
+}
+
+//Paced background acquisition while other threads keep every CPU busy, with and without real-time options.
+static void benchRealtime(bool realtime, double seconds)
+{
+    MCCDevice* dev = openSimDevice(8, 12800, 128, true);
+    MCCAcquisition acq(*dev, 64);
+    std::vector<unsigned short> block(acq.blockLength());
+    std::vector<double> latency;
+    double blockSeconds = 128 / 12800.0;
+    unsigned long long blocks = 0;
+    std::atomic<bool> loaded(true);
+    std::vector<std::thread> load;
+    for (unsigned int i = 0; i < std::max(2u, 2 * std::thread::hardware_concurrency()); i++)
+        load.push_back(std::thread([&loaded]() { volatile unsigned long spins = 0; while (loaded.load(std::memory_order_relaxed)) spins++; }));
+
+    if (realtime)
+    {
+        MCCRealtimeOptions options;
+        options.priority = 50;
+        options.lockMemory = true;
+        acq.setRealtime(options);
+    }
+    acq.start();
+    Clock::time_point start = Clock::now();
+    dev->sendMessage("AISCAN:START");
+    while (secondsSince(start) < seconds && acq.read(block.data(), 1000))
+    {
+        blocks++;
+        latency.push_back((secondsSince(start) - blocks * blockSeconds) * 1e6);
+    }
+    acq.stop();
+    dev->sendMessage("AISCAN:STOP");
+    loaded = false;
+    for (size_t i = 0; i < load.size(); i++)
+        load[i].join();
+
+    printf("  %s, %zu busy threads\n", realtime ? "SCHED_FIFO 50 + locked memory" : "default scheduling", load.size());
+    if (!acq.realtimeStatus().applied)
+        printf("    not applied: %s", acq.realtimeStatus().message.c_str());
+    printLatencies("    delivery delay", latency);
+    if (acq.overruns() > 0)
+        printf("    %llu blocks dropped as overruns\n", acq.overruns());
+    delete dev;
+}
+
+//Publisher to readers through shared memory. Readers run as threads here but attach by name, exactly as another process would.
+static void benchSharedMemory(int readers, double seconds)
+{
+#ifndef _WIN32
+    MCCDevice* dev = openSimDevice(8, 100000, 256, false);
+    MCCShmPublisher* pub = new MCCShmPublisher(*dev, "/mccbench", 64);
+    std::vector<unsigned short> block(256 * 8);
+    std::vector<std::vector<double> > latency(readers);
+    std::vector<unsigned long long> lost(readers);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++)
+    {
+        threads.push_back(std::thread([r, &latency, &lost]()
+        {
+            MCCShmReader reader("/mccbench");
+            MCCShmBlock info;
+            while (const unsigned short* data = reader.acquire(&info, 1000))
+            {
+                sink = data[info.samples - 1];
+                latency[r].push_back((mccHostTime() - info.timestamp) * 1e6);
+                reader.release();
+            }
+            lost[r] = reader.lostBlocks();
+        }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    //One block per ms, timestamped as it is published.
+    Clock::time_point start = Clock::now();
+    unsigned long long blocks = 0;
+    while (secondsSince(start) < seconds)
+    {
+        pub->publish(block.data(), (int)block.size(), blocks * 256, mccHostTime());
+        blocks++;
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(blocks));
+    }
+    double elapsed = secondsSince(start);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    delete pub;     //Readers see the stream close.
+    for (size_t r = 0; r < threads.size(); r++)
+        threads[r].join();
+
+    printf("  %d reader(s), %.0f blocks/s of 4 KiB\n", readers, blocks / elapsed);
+    for (int r = 0; r < readers; r++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "    reader %d publish to acquire", r);
+        printLatencies(name, latency[r]);
+        if (lost[r] > 0)
+            printf("    %llu blocks lost\n", lost[r]);
+    }
+    delete dev;
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+    try
+    {
+        benchConversion(1);
+        benchConversion(8);
+        benchConversion(16);
+        printf("\nRecording codec (MCCDeltaCodec, 4096-scan chunks)\n");
+        benchCodec(1);
+        benchCodec(8);
+        benchParsing();
+        printf("\nThreshold triggers (MCCTriggerEngine, %s kernel)\n", MCCTriggerEngine::kernelName());
+        benchTrigger(1);
+        benchTrigger(8);
+        printf("\nPre-trigger history (MCCHistoryRing)\n");
+        benchHistory(8);
+        printf("\nDecimation (MCCDecimator, lowpass, %s kernel)\n", MCCDecimator::kernelName());
+        benchDecimation(1, 10);
+        benchDecimation(8, 10);
+        benchDecimation(8, 50);
+
+        printf("\nEnd to end, unpaced (host-side throughput), 8 channels, 256 scans/block\n");
+        benchEndToEnd("readScanData (synchronous)", 8, 100000, 256, false, 0, seconds);
+        benchEndToEnd("getBlock (stream, 16 transfers)", 8, 100000, 256, false, 1, seconds);
+        benchEndToEnd("MCCAcquisition::read", 8, 100000, 256, false, 2, seconds);
+        benchEndToEnd("acquireBuffer (zero-copy)", 8, 100000, 256, false, 3, seconds);
+
+        printf("\nEnd to end, paced at 12800 scans/s, 8 channels, 128 scans/block\n");
+        benchEndToEnd("readScanData (synchronous)", 8, 12800, 128, true, 0, seconds);
+        benchEndToEnd("getBlock (stream, 16 transfers)", 8, 12800, 128, true, 1, seconds);
+        benchEndToEnd("MCCAcquisition::read", 8, 12800, 128, true, 2, seconds);
+        benchEndToEnd("acquireBuffer (zero-copy)", 8, 12800, 128, true, 3, seconds);
+
+        printf("\nUnder CPU load, MCCAcquisition paced at 12800 scans/s, 8 channels, 128 scans/block\n");
+        benchRealtime(false, seconds);
+        benchRealtime(true, seconds);
+
+        printf("\nShared-memory fan-out (MCCShmPublisher to MCCShmReader)\n");
+        benchSharedMemory(1, seconds);
+        benchSharedMemory(4, seconds);
+
+        printf("\nTransfer sizing (MCCTransferPolicy), paced at 100000 scans/s, 8 channels, synchronous reads\n");
+        benchTransferSizing(0, seconds);
+        benchTransferSizing(0.001, seconds);
+        benchTransferSizing(0.005, seconds);
+        benchTransferSizing(0.02, seconds);
+    }
+    catch(mcc_err err)
+    {
+        printf("%s", errorString(err).c_str());
+        return 1;
+    }
+    return 0;
+}
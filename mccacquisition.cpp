@@ -0,0 +1,150 @@
+//
+//  mccacquisition.cpp
+//
+
+#include <string.h>
+#include <chrono>
+#include "mccacquisition.h"
+
+#define READ_SLICE_MS 100 //Longest the thread reads without checking for stop().
+
+MCCAcquisition::MCCAcquisition(MCCDevice& device, int numBlocks)
+:   device(device),
+    mRing(numBlocks, device.mSamplesPerBlock * device.getChannelCount()),
+    mScratch((size_t)device.mSamplesPerBlock * device.getChannelCount()),
+    mRunning(false), mStopRequested(false), mOverruns(0), mError(-1)
+{
+}
+
+MCCAcquisition::~MCCAcquisition()
+{
+    stop();
+}
+
+void MCCAcquisition::start()
+{
+    if (mThread.joinable())
+        return;
+    mStopRequested = false;
+    mError = -1;
+    if (mRealtime.lockMemory)
+    {
+        //Fault in everything the thread writes, so its first pass does not stall on page faults.
+        mccPrefault(mRing.storage(), mRing.storageBytes());
+        mccPrefault(mScratch.data(), mScratch.size() * sizeof(unsigned short));
+    }
+    mRunning = true;
+    mRealtimeApplied = std::promise<MCCRealtimeStatus>();
+    std::future<MCCRealtimeStatus> applied = mRealtimeApplied.get_future();
+    mThread = std::thread(&MCCAcquisition::run, this);
+    mRealtimeStatus = applied.get();
+    if (mRealtime.required && !mRealtimeStatus.applied)
+    {
+        mThread.join();
+        throw MCC_ERR_ACCESS;
+    }
+}
+
+void MCCAcquisition::stop()
+{
+    mStopRequested = true;
+    if (mThread.joinable())
+        mThread.join();
+}
+
+void MCCAcquisition::run()
+{
+    unsigned short* slot;
+    MCCRealtimeStatus realtime = mccApplyRealtime(mRealtime);
+    bool refused = mRealtime.required && !realtime.applied;
+
+    mRealtimeApplied.set_value(realtime);
+    try
+    {
+        while (!refused && !mStopRequested.load(std::memory_order_relaxed))
+        {
+            slot = mRing.writeSlot();
+            if (slot)
+            {
+                if (!fill(slot))
+                    break;
+                mRing.commitWrite();
+            }
+            else
+            {
+                //Consumer is behind. Keep draining the device so its FIFO does not overflow.
+                if (!fill(mScratch.data()))
+                    break;
+                mOverruns.fetch_add(1, std::memory_order_relaxed);
+                device.getStats().addOverruns(1);
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mWaitMutex);
+            }
+            mWaitCond.notify_one();
+        }
+    }
+    catch(mcc_err err)
+    {
+        mError = err;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mWaitMutex);
+        mRunning = false;
+    }
+    mWaitCond.notify_all();
+}
+
+//Read a whole block in slices, so a scan that has not started or has stalled does not hold up stop().
+//Returns false, with the block partly read, once stop() has been called.
+bool MCCAcquisition::fill(unsigned short* data)
+{
+    int length = mRing.blockLength(), filled = 0;
+    while (filled < length)
+    {
+        if (mStopRequested.load(std::memory_order_relaxed))
+            return false;
+        filled += device.readScanData(&data[filled], length - filled, READ_SLICE_MS);
+    }
+    return true;
+}
+
+bool MCCAcquisition::copyOut(unsigned short* data)
+{
+    const unsigned short* slot = mRing.readSlot();
+    if (!slot)
+    {
+        int err = mError.load();
+        if (err >= 0 && !isRunning())
+            throw (mcc_err)err;
+        return false;
+    }
+    memcpy(data, slot, sizeof(unsigned short) * mRing.blockLength());
+    mRing.commitRead();
+    return true;
+}
+
+bool MCCAcquisition::tryRead(unsigned short* data)
+{
+    return copyOut(data);
+}
+
+bool MCCAcquisition::read(unsigned short* data)
+{
+    std::unique_lock<std::mutex> lock(mWaitMutex);
+    mWaitCond.wait(lock, [this]{ return mRing.available() > 0 || !isRunning(); });
+    lock.unlock();
+    return copyOut(data);
+}
+
+bool MCCAcquisition::read(unsigned short* data, unsigned int timeout)
+{
+    std::unique_lock<std::mutex> lock(mWaitMutex);
+    mWaitCond.wait_for(lock, std::chrono::milliseconds(timeout),
+                       [this]{ return mRing.available() > 0 || !isRunning(); });
+    lock.unlock();
+    return copyOut(data);
+}
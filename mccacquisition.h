@@ -0,0 +1,71 @@
+//
+//  mccacquisition.h
+//  Background acquisition for MCCDevice.
+//  A std::thread reads blocks of mSamplesPerBlock scans from the device into a lock-free
+//  ring. The consumer never back-pressures the USB pipe: if the ring is full when a block
+//  arrives, the block is read anyway, dropped, and counted as an overrun.
+//
+
+#ifndef ____mccacquisition__
+#define ____mccacquisition__
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mccdevice.h"
+#include "mccring.h"
+#include "mccrealtime.h"
+
+class MCCAcquisition
+{
+public:
+    //The device must already be configured (reconfigure) and the ring is sized from it.
+    //The device must not be used from any other thread while acquisition is running.
+    MCCAcquisition(MCCDevice& device, int numBlocks = 64);
+    ~MCCAcquisition();
+
+    //Scheduling, CPU set and memory locking for the acquisition thread (see mccrealtime.h), applied
+    //by start(). With options.required, start() throws MCC_ERR_ACCESS if any of them is refused.
+    void setRealtime(const MCCRealtimeOptions& options) { mRealtime = options; }
+    const MCCRealtimeStatus& realtimeStatus() const { return mRealtimeStatus; }  //As of the last start().
+
+    void start();
+    void stop();    //Returns within about 100 ms. A block that is only partly read is dropped.
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+
+    //Copy the oldest block (blockLength() samples) into data.
+    //read blocks until a block is available, read with a timeout (ms) gives up after timeout,
+    //tryRead never blocks. All return false if no block was copied. Once the acquisition thread
+    //has stopped on a device error and the ring is drained, they throw that error.
+    bool read(unsigned short* data);
+    bool read(unsigned short* data, unsigned int timeout);
+    bool tryRead(unsigned short* data);
+
+    unsigned long long overruns() const { return mOverruns.load(std::memory_order_relaxed); }
+    int blockLength() const { return mRing.blockLength(); }
+    int available() const { return mRing.available(); }
+
+private:
+    MCCDevice& device;
+    MCCBlockRing mRing;
+    std::vector<unsigned short> mScratch;   //Destination for blocks dropped on overrun.
+    std::thread mThread;
+    std::atomic<bool> mRunning;
+    std::atomic<bool> mStopRequested;
+    std::atomic<unsigned long long> mOverruns;
+    std::atomic<int> mError;                //mcc_err that stopped the thread, or -1.
+    std::mutex mWaitMutex;                  //Only used to sleep readers; never held while copying samples.
+    std::condition_variable mWaitCond;
+    MCCRealtimeOptions mRealtime;
+    MCCRealtimeStatus mRealtimeStatus;
+    std::promise<MCCRealtimeStatus> mRealtimeApplied;  //Set by the thread before its first read.
+
+    void run();
+    bool fill(unsigned short* data);
+    bool copyOut(unsigned short* data);
+};
+
+#endif /* defined(____mccacquisition__) */
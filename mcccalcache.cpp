@@ -0,0 +1,112 @@
+//
+//  mcccalcache.cpp
+//
+
+#include <stdio.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "mcccalcache.h"
+
+//File format: a header line, then one line per device:
+//  serial lowChan highChan slope offset minVoltage maxVoltage [slope offset minVoltage maxVoltage ...]
+#define CACHE_FILE_HEADER "# mccdaq calibration cache v1"
+
+MCCCalibrationCache& MCCCalibrationCache::instance()
+{
+    static MCCCalibrationCache cache;
+    return cache;
+}
+
+void MCCCalibrationCache::setFile(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPath = path;
+    load();
+}
+
+bool MCCCalibrationCache::lookup(const std::string& serial, int lowChan, int highChan, MCCCalibrationEntry* entry)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::map<std::string, MCCCalibrationEntry>::const_iterator it = mEntries.find(serial);
+    if (it == mEntries.end() || it->second.lowChan != lowChan || it->second.highChan != highChan)
+        return false;
+    *entry = it->second;
+    return true;
+}
+
+void MCCCalibrationCache::store(const std::string& serial, const MCCCalibrationEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEntries[serial] = entry;
+    save();
+}
+
+void MCCCalibrationCache::invalidate(const std::string& serial)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mEntries.erase(serial) > 0)
+        save();
+}
+
+void MCCCalibrationCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEntries.clear();
+    save();
+}
+
+void MCCCalibrationCache::load()
+{
+    if (mPath.empty())
+        return;
+    std::ifstream file(mPath.c_str());
+    std::string line;
+    if (!std::getline(file, line) || line != CACHE_FILE_HEADER)
+        return; //Missing or foreign file; it is rewritten on the next store.
+
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string serial;
+        MCCCalibrationEntry entry;
+        if (!(stream >> serial >> entry.lowChan >> entry.highChan) || entry.highChan < entry.lowChan)
+            continue;
+        entry.channels.resize(entry.highChan - entry.lowChan + 1);
+        bool ok = true;
+        for (size_t i = 0; i < entry.channels.size() && ok; i++)
+        {
+            MCCChannelCalibration& chan = entry.channels[i];
+            ok = (bool)(stream >> chan.slope >> chan.offset >> chan.minVoltage >> chan.maxVoltage);
+        }
+        if (ok && !mEntries.count(serial))
+            mEntries[serial] = entry;
+    }
+}
+
+void MCCCalibrationCache::save()
+{
+    if (mPath.empty())
+        return;
+    //Write a sibling file and rename it over the old one so a crash never leaves a half-written cache.
+    std::string tmpPath = mPath + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::trunc);
+        if (!file)
+            return;
+        file << CACHE_FILE_HEADER << "\n" << std::setprecision(9);
+        for (std::map<std::string, MCCCalibrationEntry>::const_iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+        {
+            file << it->first << " " << it->second.lowChan << " " << it->second.highChan;
+            for (size_t i = 0; i < it->second.channels.size(); i++)
+            {
+                const MCCChannelCalibration& chan = it->second.channels[i];
+                file << " " << chan.slope << " " << chan.offset << " " << chan.minVoltage << " " << chan.maxVoltage;
+            }
+            file << "\n";
+        }
+        if (!file)
+            return;
+    }
+    rename(tmpPath.c_str(), mPath.c_str());
+}
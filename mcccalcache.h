@@ -0,0 +1,61 @@
+//
+//  mcccalcache.h
+//  Per-device calibration cache keyed by the DEV:MFGSER serial number.
+//  reconfigure() normally asks the device for the slope, offset and range of every channel,
+//  three control round-trips per channel. With the cache it only asks for the scan's channel
+//  range and rate, and the first channel's range to check that the device has not been reset or
+//  reconfigured behind its back; if those match the cached entry the per-channel queries are skipped.
+//  Entries live in memory for the life of the process and, if setFile() was called, in a
+//  small text file so they survive restarts.
+//
+
+#ifndef ____mcccalcache__
+#define ____mcccalcache__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct MCCChannelCalibration
+{
+    float slope;
+    float offset;
+    int minVoltage;
+    int maxVoltage;
+};
+
+struct MCCCalibrationEntry
+{
+    int lowChan;
+    int highChan;
+    std::vector<MCCChannelCalibration> channels;    //highChan - lowChan + 1 entries.
+};
+
+class MCCCalibrationCache
+{
+public:
+    //The process-wide cache used by MCCDevice.
+    static MCCCalibrationCache& instance();
+
+    //Persist entries to path. Existing entries in the file are loaded immediately.
+    //An empty path turns persistence off.
+    void setFile(const std::string& path);
+
+    //True if serial has an entry for exactly this channel range.
+    bool lookup(const std::string& serial, int lowChan, int highChan, MCCCalibrationEntry* entry);
+    void store(const std::string& serial, const MCCCalibrationEntry& entry);
+    void invalidate(const std::string& serial);
+    void clear();
+
+private:
+    MCCCalibrationCache() {}
+    std::mutex mMutex;
+    std::map<std::string, MCCCalibrationEntry> mEntries;
+    std::string mPath;
+
+    void load();    //Called with mMutex held.
+    void save();    //Called with mMutex held.
+};
+
+#endif /* defined(____mcccalcache__) */
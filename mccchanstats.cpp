@@ -0,0 +1,156 @@
+//
+//  mccchanstats.cpp
+//
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "mccerror.h"
+#include "mccconvert.h"
+#include "mccchanstats.h"
+
+#define PATTERN_SCANS 8 //Scans in MCCConverter's coefficient pattern.
+
+MCCChannelStats::MCCChannelStats()
+:   mChannelCount(0), mWindowScans(0), mMaxCounts(0), mScans(0), mFirstScan(0),
+    mSeq(0), mPublished(0)
+{
+    memset(&mWindow, 0, sizeof(mWindow));
+}
+
+void MCCChannelStats::configure(const MCCConverter& converter, unsigned short maxCounts, int windowScans)
+{
+    int channels = converter.channelCount();
+    if (windowScans < 0 || (windowScans > 0 && channels > MCC_STATS_MAX_CHANNELS))
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    mChannelCount = channels;
+    mWindowScans = channels > 0 ? windowScans : 0;
+    mMaxCounts = maxCounts;
+    mGain.resize(channels);
+    mOffset.resize(channels);
+    for (int chanIdx = 0; chanIdx < channels; chanIdx++)
+    {
+        mGain[chanIdx] = converter.gain(chanIdx);
+        mOffset[chanIdx] = converter.offset(chanIdx);
+    }
+    mTotals.resize(channels);
+    mLaneMin.resize(PATTERN_SCANS * channels);
+    mLaneMax.resize(PATTERN_SCANS * channels);
+    mLaneSum.resize(PATTERN_SCANS * channels);
+    mLaneSquares.resize(PATTERN_SCANS * channels);
+    mLaneLow.resize(PATTERN_SCANS * channels);
+    mLaneHigh.resize(PATTERN_SCANS * channels);
+    mPublished.store(0, std::memory_order_release);
+    reset();
+}
+
+void MCCChannelStats::reset()
+{
+    clearTotals();
+    resetLanes();
+    mScans = 0;
+    mFirstScan = 0;
+}
+
+void MCCChannelStats::clearTotals()
+{
+    for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+    {
+        Totals& t = mTotals[chanIdx];
+        t.min = 0xFFFF;
+        t.max = 0;
+        t.sum = t.squares = t.clippedLow = t.clippedHigh = 0;
+    }
+}
+
+void MCCChannelStats::resetLanes()
+{
+    std::fill(mLaneMin.begin(), mLaneMin.end(), 65536.0f);
+    std::fill(mLaneMax.begin(), mLaneMax.end(), -1.0f);
+    std::fill(mLaneSum.begin(), mLaneSum.end(), 0.0);
+    std::fill(mLaneSquares.begin(), mLaneSquares.end(), 0.0);
+    std::fill(mLaneLow.begin(), mLaneLow.end(), 0.0f);
+    std::fill(mLaneHigh.begin(), mLaneHigh.end(), 0.0f);
+}
+
+void MCCChannelStats::foldLanes()
+{
+    for (size_t k = 0; k < mLaneSum.size(); k++)
+    {
+        Totals& t = mTotals[k % mChannelCount];
+        //An untouched lane still holds its initial min above max, so it changes nothing.
+        if (mLaneMin[k] <= mLaneMax[k])
+        {
+            t.min = std::min(t.min, (unsigned short)mLaneMin[k]);
+            t.max = std::max(t.max, (unsigned short)mLaneMax[k]);
+        }
+        //The lane sums hold integers well below 2^53, so they convert exactly.
+        t.sum += (uint64_t)mLaneSum[k];
+        t.squares += (uint64_t)mLaneSquares[k];
+        t.clippedLow += (uint64_t)mLaneLow[k];
+        t.clippedHigh += (uint64_t)mLaneHigh[k];
+    }
+    resetLanes();
+}
+
+void MCCChannelStats::endScans(int scans)
+{
+    mScans += scans;
+    if (mScans < mWindowScans)
+        return;
+    publish();
+    mFirstScan += mScans;
+    mScans = 0;
+    clearTotals();
+}
+
+void MCCChannelStats::publish()
+{
+    unsigned long long seq = mSeq.load(std::memory_order_relaxed);
+    unsigned long long index = mPublished.load(std::memory_order_relaxed);
+    double n = mScans;
+
+    mSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mWindow.index = index;
+    mWindow.firstScan = mFirstScan;
+    mWindow.scans = mScans;
+    mWindow.channelCount = mChannelCount;
+    for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+    {
+        const Totals& t = mTotals[chanIdx];
+        MCCChannelSummary& s = mWindow.channels[chanIdx];
+        double gain = mGain[chanIdx], offset = mOffset[chanIdx];
+        double mean = t.sum / n;
+        //volts = gain*counts + offset, so mean(volts^2) = gain^2*mean(counts^2) + 2*gain*offset*mean(counts) + offset^2.
+        double meanSquare = gain*gain*(t.squares / n) + 2*gain*offset*mean + offset*offset;
+        double lo = gain*t.min + offset, hi = gain*t.max + offset;
+        s.min = (float)std::min(lo, hi);
+        s.max = (float)std::max(lo, hi);
+        s.mean = (float)(gain*mean + offset);
+        s.rms = (float)sqrt(std::max(meanSquare, 0.0));
+        s.minCounts = t.min;
+        s.maxCounts = t.max;
+        s.clippedLow = (uint32_t)t.clippedLow;
+        s.clippedHigh = (uint32_t)t.clippedHigh;
+    }
+    mSeq.store(seq + 2, std::memory_order_release);
+    mPublished.store(index + 1, std::memory_order_release);
+}
+
+bool MCCChannelStats::latest(MCCStatsWindow* window) const
+{
+    for (;;)
+    {
+        if (mPublished.load(std::memory_order_acquire) == 0)
+            return false;
+        unsigned long long seq = mSeq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;   //A window is being written; it takes a few hundred ns.
+        memcpy(window, &mWindow, sizeof(MCCStatsWindow));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mSeq.load(std::memory_order_relaxed) == seq)
+            return true;
+    }
+}
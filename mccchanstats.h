@@ -0,0 +1,127 @@
+//
+//  mccchanstats.h
+//  Per-channel signal statistics for rig monitoring, computed while blocks are converted.
+//  Passing an MCCChannelStats to MCCConverter (or enabling it on MCCDevice) makes the conversion
+//  kernels also track each channel's minimum, maximum, sum, sum of squares and clipped samples
+//  (raw counts at 0 or maxCounts) in the same pass, so there is no second pass over the block.
+//  Totals are kept in raw counts and turned into volts once per window of windowScans scans.
+//
+//  The converting thread is the only writer. Each completed window is published under a sequence
+//  number (a seqlock, as in mccshm.h), so any other thread can call latest() at any time without
+//  locking or slowing down the acquisition.
+//
+//      MCCChannelStats stats;
+//      stats.configure(dev.getConverter(), dev.getMaxCounts(), 1000);   //1000-scan windows
+//      dev.getConverter().convert(dev.mData, volts, length, MCC_LAYOUT_INTERLEAVED, &stats);
+//      MCCStatsWindow window;                                           //Any thread
+//      if (stats.latest(&window))
+//          printf("%.3f V rms, %u clipped\n", window.channels[0].rms, window.channels[0].clippedHigh);
+//
+
+#ifndef ____mccchanstats__
+#define ____mccchanstats__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define MCC_STATS_MAX_CHANNELS 64
+
+class MCCConverter;
+
+struct MCCChannelSummary
+{
+    float min;                  //Volts.
+    float max;
+    float mean;
+    float rms;                  //Square root of the mean of the squared volts (includes the mean).
+    unsigned short minCounts;   //Raw counts.
+    unsigned short maxCounts;
+    uint32_t clippedLow;        //Samples at 0 counts.
+    uint32_t clippedHigh;       //Samples at the device's maxCounts.
+};
+
+struct MCCStatsWindow
+{
+    unsigned long long index;       //Windows completed before this one.
+    unsigned long long firstScan;   //Counted from configure() or reset().
+    int scans;
+    int channelCount;
+    MCCChannelSummary channels[MCC_STATS_MAX_CHANNELS];
+};
+
+class MCCChannelStats
+{
+public:
+    MCCChannelStats();
+
+    //Take the channel count and per-channel gain and offset from converter and start over.
+    //windowScans 0 disables the statistics. Call from the converting thread; readers may keep
+    //calling latest(), and see no window until the first new one completes.
+    void configure(const MCCConverter& converter, unsigned short maxCounts, int windowScans);
+    void reset();   //Drop the running window and start counting scans from 0.
+
+    bool enabled() const { return mWindowScans > 0; }
+    int channelCount() const { return mChannelCount; }
+    int windowScans() const { return mWindowScans; }
+
+    //Copy the most recently completed window. Any thread, never blocks the writer.
+    //Returns false if no window has completed since configure().
+    bool latest(MCCStatsWindow* window) const;
+    unsigned long long windowsCompleted() const { return mPublished.load(std::memory_order_acquire); }
+
+private:
+    friend class MCCConverter;
+
+    //Running totals of the current window, in counts.
+    struct Totals
+    {
+        unsigned short min;
+        unsigned short max;
+        uint64_t sum;
+        uint64_t squares;
+        uint64_t clippedLow;
+        uint64_t clippedHigh;
+    };
+
+    int mChannelCount;
+    int mWindowScans;
+    unsigned short mMaxCounts;
+    std::vector<double> mGain;
+    std::vector<double> mOffset;
+    std::vector<Totals> mTotals;
+    int mScans;                         //Scans in the current window so far.
+    unsigned long long mFirstScan;
+
+    //Accumulators for the vector kernels, one per position of MCCConverter's 8-scan coefficient
+    //pattern (lane k belongs to channel k % mChannelCount). Folded into mTotals after every call.
+    std::vector<float> mLaneMin;
+    std::vector<float> mLaneMax;
+    std::vector<double> mLaneSum;
+    std::vector<double> mLaneSquares;
+    std::vector<float> mLaneLow;
+    std::vector<float> mLaneHigh;
+
+    std::atomic<unsigned long long> mSeq;   //Odd while mWindow is being written.
+    std::atomic<unsigned long long> mPublished;
+    MCCStatsWindow mWindow;
+
+    int scansLeft() const { return mWindowScans - mScans; }
+    void add(int chanIdx, unsigned short counts)
+    {
+        Totals& t = mTotals[chanIdx];
+        if (counts < t.min) t.min = counts;
+        if (counts > t.max) t.max = counts;
+        t.sum += counts;
+        t.squares += (uint64_t)counts * counts;
+        t.clippedLow += counts == 0;
+        t.clippedHigh += counts == mMaxCounts;
+    }
+    void clearTotals();
+    void resetLanes();
+    void foldLanes();               //Add the lane accumulators to mTotals and clear them.
+    void endScans(int scans);       //scans more scans are in mTotals; publishes a completed window.
+    void publish();
+};
+
+#endif /* defined(____mccchanstats__) */
@@ -0,0 +1,98 @@
+//
+//  mccclock.cpp
+//
+
+#include <math.h>
+#include <chrono>
+#include "mccclock.h"
+
+double mccHostTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MCCClockEstimator::MCCClockEstimator(double nominalRate, int memory)
+:   mNominalRate(nominalRate)
+{
+    setMemory(memory);
+    reset();
+}
+
+void MCCClockEstimator::reset()
+{
+    mPoints = 0;
+    mOriginScan = mOriginTime = 0;
+    mWeight = mMeanScan = mMeanTime = mSxx = mSxy = mSyy = 0;
+}
+
+void MCCClockEstimator::setNominalRate(double rate)
+{
+    mNominalRate = rate;
+}
+
+void MCCClockEstimator::setMemory(int memory)
+{
+    mLambda = memory > 1 ? 1.0 - 1.0 / memory : 1.0;
+}
+
+//Weighted Welford update of the means and co-moments; a plain running sum of x*x loses
+//all its precision once scan indices reach the millions.
+void MCCClockEstimator::addPoint(double scan, double hostTime)
+{
+    if (mPoints == 0)
+    {
+        mOriginScan = scan;
+        mOriginTime = hostTime;
+    }
+    mPoints++;
+
+    double x = scan - mOriginScan, y = hostTime - mOriginTime;
+    mWeight = mLambda * mWeight + 1.0;
+    double dx = x - mMeanScan, dy = y - mMeanTime;
+    mMeanScan += dx / mWeight;
+    mMeanTime += dy / mWeight;
+    mSxx = mLambda * mSxx + dx * (x - mMeanScan);
+    mSxy = mLambda * mSxy + dx * (y - mMeanTime);
+    mSyy = mLambda * mSyy + dy * (y - mMeanTime);
+}
+
+double MCCClockEstimator::slope() const
+{
+    if (mPoints >= 2 && mSxx > 0)
+        return mSxy / mSxx;
+    return mNominalRate > 0 ? 1.0 / mNominalRate : 0;
+}
+
+double MCCClockEstimator::timeOf(double scan) const
+{
+    return mOriginTime + mMeanTime + (scan - mOriginScan - mMeanScan) * slope();
+}
+
+double MCCClockEstimator::scanAt(double hostTime) const
+{
+    double s = slope();
+    if (s <= 0)
+        return mOriginScan + mMeanScan;
+    return mOriginScan + mMeanScan + (hostTime - mOriginTime - mMeanTime) / s;
+}
+
+double MCCClockEstimator::rate() const
+{
+    double s = slope();
+    return s > 0 ? 1.0 / s : 0;
+}
+
+double MCCClockEstimator::drift() const
+{
+    if (mNominalRate <= 0)
+        return 0;
+    return (rate() - mNominalRate) / mNominalRate * 1e6;
+}
+
+double MCCClockEstimator::jitter() const
+{
+    if (mPoints < 3 || mSxx <= 0 || mWeight <= 0)
+        return 0;
+    double residual = (mSyy - mSxy * mSxy / mSxx) / mWeight;
+    return residual > 0 ? sqrt(residual) : 0;
+}
@@ -0,0 +1,50 @@
+//
+//  mccclock.h
+//  Mapping between the device's scan clock and the host's monotonic clock.
+//  Every completed transfer gives one (scan index, host time) point: the index of the last scan
+//  it holds and the time it arrived. USB latency makes each point jitter by up to a frame or two,
+//  but a least-squares line through all of them recovers the time of any scan to well below that
+//  and measures the real scan rate, which drifts from the nominal AISCAN:RATE with the crystal.
+//
+
+#ifndef ____mccclock__
+#define ____mccclock__
+
+//Seconds on the host's monotonic clock (std::chrono::steady_clock).
+double mccHostTime();
+
+//Online least-squares fit of host time against scan index. Not thread-safe: feed and query it
+//from the thread that reads the data.
+class MCCClockEstimator
+{
+public:
+    //memory is the number of most recent points that dominate the fit (exponential forgetting), so
+    //the estimate follows slow drift such as a crystal warming up. 0 weights every point equally.
+    MCCClockEstimator(double nominalRate = 0, int memory = 0);
+
+    void reset();                       //Forget every point, e.g. when a new scan starts.
+    void setNominalRate(double rate);   //Scans per second the device was asked for.
+    void setMemory(int memory);
+
+    void addPoint(double scan, double hostTime);
+
+    double timeOf(double scan) const;   //Estimated host time of a scan.
+    double scanAt(double hostTime) const;   //Inverse of timeOf.
+    double rate() const;                //Measured scans per host second. The nominal rate until there are two points.
+    double nominalRate() const { return mNominalRate; }
+    double drift() const;               //(rate() - nominalRate()) / nominalRate(), in parts per million.
+    double jitter() const;              //RMS distance of the points from the fitted line, in seconds.
+    unsigned long long points() const { return mPoints; }
+
+private:
+    double mNominalRate;
+    double mLambda;     //Forgetting factor, 1 for none.
+    unsigned long long mPoints;
+    //Fit in coordinates relative to the first point so the sums keep their precision over long runs.
+    double mOriginScan, mOriginTime;
+    double mWeight, mMeanScan, mMeanTime, mSxx, mSxy, mSyy;
+
+    double slope() const;   //Seconds per scan.
+};
+
+#endif /* defined(____mccclock__) */
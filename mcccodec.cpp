@@ -0,0 +1,139 @@
+//
+//  mcccodec.cpp
+//
+
+#include "mcccodec.h"
+
+static inline uint16_t zigzag(uint16_t delta)
+{
+    int16_t d = (int16_t)delta;
+    return (uint16_t)((d << 1) ^ (d >> 15));
+}
+
+static inline uint16_t unzigzag(uint16_t z)
+{
+    return (uint16_t)((z >> 1) ^ (uint16_t)-(int16_t)(z & 1));
+}
+
+static inline int bitWidth(uint16_t value)
+{
+    int width = 0;
+    while (value)
+    {
+        value >>= 1;
+        width++;
+    }
+    return width;
+}
+
+size_t MCCDeltaCodec::maxEncodedSize(int channelCount, int scans)
+{
+    size_t deltas = scans > 1 ? scans - 1 : 0;
+    size_t groups = (deltas + MCC_CODEC_GROUP - 1) / MCC_CODEC_GROUP;
+    return (size_t)channelCount * (2 + groups + deltas * 2);
+}
+
+size_t MCCDeltaCodec::encode(const unsigned short* data, int scans, uint8_t* out) const
+{
+    uint8_t* start = out;
+    uint16_t z[MCC_CODEC_GROUP];
+
+    if (scans <= 0)
+        return 0;
+
+    for (int c = 0; c < mChannelCount; c++)
+    {
+        const unsigned short* in = data + c;
+        uint16_t prev = in[0];
+        *out++ = (uint8_t)prev;
+        *out++ = (uint8_t)(prev >> 8);
+
+        for (int s = 1; s < scans; s += MCC_CODEC_GROUP)
+        {
+            int n = scans - s < MCC_CODEC_GROUP ? scans - s : MCC_CODEC_GROUP;
+            uint16_t all = 0;
+            for (int i = 0; i < n; i++)
+            {
+                uint16_t value = in[(size_t)(s + i) * mChannelCount];
+                z[i] = zigzag((uint16_t)(value - prev));
+                all |= z[i];
+                prev = value;
+            }
+
+            int width = bitWidth(all);
+            *out++ = (uint8_t)width;
+            if (width == 0)
+                continue;
+
+            //LSB first through a 64-bit accumulator, flushed 32 bits at a time.
+            uint64_t acc = 0;
+            int bits = 0;
+            for (int i = 0; i < n; i++)
+            {
+                acc |= (uint64_t)z[i] << bits;
+                bits += width;
+                if (bits >= 32)
+                {
+                    out[0] = (uint8_t)acc;
+                    out[1] = (uint8_t)(acc >> 8);
+                    out[2] = (uint8_t)(acc >> 16);
+                    out[3] = (uint8_t)(acc >> 24);
+                    out += 4;
+                    acc >>= 32;
+                    bits -= 32;
+                }
+            }
+            for (; bits > 0; bits -= 8)
+            {
+                *out++ = (uint8_t)acc;
+                acc >>= 8;
+            }
+        }
+    }
+    return out - start;
+}
+
+bool MCCDeltaCodec::decode(const uint8_t* in, size_t size, int scans, unsigned short* out) const
+{
+    const uint8_t* end = in + size;
+
+    if (scans <= 0)
+        return true;
+
+    for (int c = 0; c < mChannelCount; c++)
+    {
+        unsigned short* dst = out + c;
+        if (end - in < 2)
+            return false;
+        uint16_t prev = (uint16_t)(in[0] | (in[1] << 8));
+        in += 2;
+        dst[0] = prev;
+
+        for (int s = 1; s < scans; s += MCC_CODEC_GROUP)
+        {
+            int n = scans - s < MCC_CODEC_GROUP ? scans - s : MCC_CODEC_GROUP;
+            if (end - in < 1)
+                return false;
+            int width = *in++;
+            if (width > 16 || (size_t)(end - in) < ((size_t)n * width + 7) / 8)
+                return false;
+
+            uint64_t acc = 0;
+            int bits = 0;
+            uint16_t mask = (uint16_t)((1u << width) - 1);
+            for (int i = 0; i < n; i++)
+            {
+                while (bits < width)
+                {
+                    acc |= (uint64_t)(*in++) << bits;
+                    bits += 8;
+                }
+                prev = (uint16_t)(prev + unzigzag((uint16_t)acc & mask));
+                acc >>= width;
+                bits -= width;
+                dst[(size_t)(s + i) * mChannelCount] = prev;
+            }
+        }
+    }
+    return in == end;
+}
@@ -0,0 +1,42 @@
+//
+//  mcccodec.h
+//  Lossless compression for blocks of interleaved 16-bit counts.
+//  Each channel is coded on its own: its first count verbatim, then the differences between
+//  neighbouring scans, zigzag-mapped so small negative steps become small numbers, in groups of
+//  MCC_CODEC_GROUP packed at the fewest bits that hold the largest value in the group. A quiet
+//  16-bit channel typically needs 3 to 6 bits per sample instead of 16. Differences wrap modulo
+//  2^16, so every input, however noisy, comes back bit for bit (worst case 16.06 bits per sample).
+//
+//  Encoded layout, little-endian:
+//      for each channel: uint16 first count,
+//                        then per group of up to MCC_CODEC_GROUP differences: uint8 width, ceil(n*width/8) bytes.
+//
+
+#ifndef ____mcccodec__
+#define ____mcccodec__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MCC_CODEC_GROUP 128
+
+class MCCDeltaCodec
+{
+public:
+    explicit MCCDeltaCodec(int channelCount) : mChannelCount(channelCount) {}
+
+    //Largest possible encoding of scans scans, for sizing the output buffer.
+    static size_t maxEncodedSize(int channelCount, int scans);
+
+    //Encode scans scans of interleaved data into out. Returns the number of bytes written.
+    size_t encode(const unsigned short* data, int scans, uint8_t* out) const;
+    //Decode size bytes holding scans scans into out (interleaved). False if the input is truncated or corrupt.
+    bool decode(const uint8_t* in, size_t size, int scans, unsigned short* out) const;
+
+    int channelCount() const { return mChannelCount; }
+
+private:
+    int mChannelCount;
+};
+
+#endif /* defined(____mcccodec__) */
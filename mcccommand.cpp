@@ -0,0 +1,190 @@
+//
+//  mcccommand.cpp
+//
+
+#include <errno.h>
+#include <locale.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+#include "mccerror.h"
+#include "mcccommand.h"
+
+//DAQFlex numbers always use '.', whatever LC_NUMERIC says. std::from_chars/to_chars ignore the
+//locale; without them (before C++17, or a library without floating-point support), the locale's
+//decimal point is swapped for '.' around strtod and snprintf.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define MCC_HAVE_TO_CHARS 1
+#else
+static char localeDecimalPoint()
+{
+    const char* point = localeconv()->decimal_point;
+    return point && point[0] ? point[0] : '.';
+}
+#endif
+
+//Case-insensitive ASCII compare, like strncasecmp (which MSVC does not have) without the locale.
+static bool namesMatch(const char* a, const char* b, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        char x = a[i], y = b[i];
+        if (x >= 'a' && x <= 'z')
+            x -= 'a' - 'A';
+        if (y >= 'a' && y <= 'z')
+            y -= 'a' - 'A';
+        if (x != y)
+            return false;
+        if (x == '\0')
+            break;
+    }
+    return true;
+}
+
+void MCCCommand::format(const char* fmt, ...)
+{
+    va_list args;
+    memset(mText, 0, sizeof(mText));
+    va_start(args, fmt);
+    int n = vsnprintf(mText, sizeof(mText), fmt, args);
+    va_end(args);
+    if (n < 0 || n >= (int)sizeof(mText))
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    mLength = n;
+    const char* name = this->name();
+    const char* equals = strchr(name, '=');
+    mNameLength = equals ? (int)(equals - name) : (int)strlen(name);
+}
+
+MCCCommand MCCCommand::query(const char* property)
+{
+    MCCCommand command;
+    command.format("?%s", property);
+    return command;
+}
+
+MCCCommand MCCCommand::query(const char* component, int channel, const char* property)
+{
+    MCCCommand command;
+    command.format("?%s{%d}:%s", component, channel, property);
+    return command;
+}
+
+MCCCommand MCCCommand::set(const char* property, const char* value)
+{
+    MCCCommand command;
+    command.format("%s=%s", property, value);
+    return command;
+}
+
+MCCCommand MCCCommand::set(const char* property, int value)
+{
+    MCCCommand command;
+    command.format("%s=%d", property, value);
+    return command;
+}
+
+MCCCommand MCCCommand::set(const char* property, double value)
+{
+    MCCCommand command;
+    char number[MAX_MESSAGE_LENGTH];
+#if MCC_HAVE_TO_CHARS
+    std::to_chars_result result = std::to_chars(number, number + sizeof(number) - 1, value, std::chars_format::fixed, 3);
+    if (result.ec != std::errc())
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+    *result.ptr = '\0';
+#else
+    snprintf(number, sizeof(number), "%.3f", value);
+    char* point = strchr(number, localeDecimalPoint());
+    if (point)
+        *point = '.';
+#endif
+    command.format("%s=%s", property, number);
+    return command;
+}
+
+MCCCommand MCCCommand::set(const char* component, int channel, const char* property, const char* value)
+{
+    MCCCommand command;
+    command.format("%s{%d}:%s=%s", component, channel, property, value);
+    return command;
+}
+
+MCCCommand MCCCommand::raw(const char* text)
+{
+    MCCCommand command;
+    command.format("%s", text);
+    return command;
+}
+
+bool MCCResponse::answers(const MCCCommand& command) const
+{
+    if (!namesMatch(text, command.name(), command.nameLength()))
+        return false;
+    return !command.isQuery() || text[command.nameLength()] == '=';
+}
+
+const char* MCCResponse::value(const MCCCommand& command) const
+{
+    if (!answers(command) || text[command.nameLength()] != '=')
+        return NULL;
+    return text + command.nameLength() + 1;
+}
+
+bool MCCResponse::toInt(const MCCCommand& command, int* out) const
+{
+    const char* start = value(command);
+    if (!start || *start == '\0')
+        return false;
+#if MCC_HAVE_TO_CHARS
+    const char* last = start + strlen(start);
+    int result;
+    std::from_chars_result parsed = std::from_chars(start, last, result);
+    if (parsed.ec != std::errc() || parsed.ptr != last)
+        return false;
+#else
+    char* end;
+    errno = 0;
+    long result = strtol(start, &end, 10);
+    if (*end != '\0' || errno != 0)
+        return false;
+#endif
+    *out = (int)result;
+    return true;
+}
+
+bool MCCResponse::toDouble(const MCCCommand& command, double* out) const
+{
+    const char* start = value(command);
+    if (!start || *start == '\0')
+        return false;
+#if MCC_HAVE_TO_CHARS
+    const char* last = start + strlen(start);
+    double result;
+    std::from_chars_result parsed = std::from_chars(start, last, result);
+    if (parsed.ec != std::errc() || parsed.ptr != last)
+        return false;
+#else
+    //A copy with the device's '.' turned into the locale's decimal point, which is what strtod expects.
+    char number[MAX_MESSAGE_LENGTH + 1];
+    char* end;
+    strncpy(number, start, sizeof(number) - 1);
+    number[sizeof(number) - 1] = '\0';
+    char* point = strchr(number, '.');
+    if (point)
+        *point = localeDecimalPoint();
+    errno = 0;
+    double result = strtod(number, &end);
+    if (*end != '\0' || errno != 0)
+        return false;
+#endif
+    *out = result;
+    return true;
+}
@@ -0,0 +1,62 @@
+//
+//  mcccommand.h
+//  Typed DAQFlex messages in fixed 64-byte buffers.
+//  A command is formatted straight into the buffer that goes to the device, and a reply is checked
+//  against the command that caused it before its value is parsed in place: "?AI{10}:SLOPE" must be
+//  answered by "AI{10}:SLOPE=<value>", whatever the channel number's width. Nothing is allocated.
+//  Numbers are parsed and formatted with std::from_chars/to_chars where available, otherwise with
+//  strtol/strtod and snprintf, corrected for the locale's decimal point either way: DAQFlex always uses '.'.
+//
+
+#ifndef ____mcccommand__
+#define ____mcccommand__
+
+#include "mccprotocol.h"
+
+class MCCCommand
+{
+public:
+    //"?AISCAN:RATE" and "?AI{3}:SLOPE"
+    static MCCCommand query(const char* property);
+    static MCCCommand query(const char* component, int channel, const char* property);
+    //"AISCAN:RATE=1000" and "AI{3}:RANGE=BIP5V"
+    static MCCCommand set(const char* property, const char* value);
+    static MCCCommand set(const char* property, int value);
+    static MCCCommand set(const char* property, double value);
+    static MCCCommand set(const char* component, int channel, const char* property, const char* value);
+    //Any other message, e.g. "AISCAN:START". Its reply must start with the message itself.
+    static MCCCommand raw(const char* text);
+
+    const char* text() const { return mText; }
+    int length() const { return mLength; }
+    bool isQuery() const { return mText[0] == '?'; }
+    //The part of the command every reply echoes: the property name, without '?' or "=value".
+    const char* name() const { return isQuery() ? mText + 1 : mText; }
+    int nameLength() const { return mNameLength; }
+
+private:
+    char mText[MAX_MESSAGE_LENGTH];     //NUL-padded, as sent.
+    int mLength;
+    int mNameLength;
+
+    MCCCommand() {}
+    void format(const char* fmt, ...);  //Throws MCC_ERR_INVALID_BUFFER_SIZE if the message does not fit.
+};
+
+class MCCResponse
+{
+public:
+    MCCResponse() { text[0] = '\0'; }
+
+    //True if this reply echoes command's property name (and, for a query, carries a value).
+    bool answers(const MCCCommand& command) const;
+    //The text after '=' of a reply to command, or NULL if it does not answer it.
+    const char* value(const MCCCommand& command) const;
+    //Parse the whole value. False if the reply does not answer command or the value is not a number.
+    bool toInt(const MCCCommand& command, int* out) const;
+    bool toDouble(const MCCCommand& command, double* out) const;
+
+    char text[MAX_MESSAGE_LENGTH + 1];  //As received, always NUL-terminated.
+};
+
+#endif /* defined(____mcccommand__) */
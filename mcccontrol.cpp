@@ -0,0 +1,349 @@
+//
+//  mcccontrol.cpp
+//
+
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include "mccdevice.h"
+#include "mcccontrol.h"
+#include "mcctransport.h"
+
+MCCControlQueue::Request MCCControlQueue::emptyRequest()
+{
+    Request request = { CONTROL_MESSAGE, MCCCommand::raw(""), 0, 0, MCCControlCallback() };
+    return request;
+}
+
+void MCCControlQueue::submit(const MCCCommand& command, MCCControlCallback callback)
+{
+    Request request = { CONTROL_MESSAGE, command, 0, 0, callback };
+    enqueue(request);
+}
+
+void MCCControlQueue::submitRead(uint8_t request, MCCControlCallback callback)
+{
+    Request r = { CONTROL_READ, MCCCommand::raw(""), request, 0, callback };
+    enqueue(r);
+}
+
+void MCCControlQueue::submitWrite(uint8_t request, uint16_t value, MCCControlCallback callback)
+{
+    Request r = { CONTROL_WRITE, MCCCommand::raw(""), request, value, callback };
+    enqueue(r);
+}
+
+std::future<MCCResponse> MCCControlQueue::submit(const MCCCommand& command)
+{
+    std::shared_ptr<std::promise<MCCResponse> > promise = std::make_shared<std::promise<MCCResponse> >();
+    std::future<MCCResponse> future = promise->get_future();
+    submit(command, [promise](const MCCControlResult& result)
+    {
+        if (result.error >= 0)
+            promise->set_exception(std::make_exception_ptr((mcc_err)result.error));
+        else
+            promise->set_value(result.response);
+    });
+    return future;
+}
+
+std::future<uint8_t> MCCControlQueue::submitRead(uint8_t request)
+{
+    std::shared_ptr<std::promise<uint8_t> > promise = std::make_shared<std::promise<uint8_t> >();
+    std::future<uint8_t> future = promise->get_future();
+    submitRead(request, [promise](const MCCControlResult& result)
+    {
+        if (result.error >= 0)
+            promise->set_exception(std::make_exception_ptr((mcc_err)result.error));
+        else
+            promise->set_value(result.value);
+    });
+    return future;
+}
+
+std::future<void> MCCControlQueue::submitWrite(uint8_t request, uint16_t value)
+{
+    std::shared_ptr<std::promise<void> > promise = std::make_shared<std::promise<void> >();
+    std::future<void> future = promise->get_future();
+    submitWrite(request, value, [promise](const MCCControlResult& result)
+    {
+        if (result.error >= 0)
+            promise->set_exception(std::make_exception_ptr((mcc_err)result.error));
+        else
+            promise->set_value();
+    });
+    return future;
+}
+
+void MCCControlQueue::wait()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdleCond.wait(lock, [this]{ return !mBusy; });
+}
+
+bool MCCControlQueue::isIdle()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return !mBusy;
+}
+
+void MCCControlQueue::enqueue(const Request& request)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mBusy)
+        {
+            mQueue.push_back(request);
+            return;
+        }
+        mBusy = true;
+        mCurrent = request;
+    }
+    int err = begin(mCurrent);
+    if (err >= 0)
+    {
+        MCCControlResult result;
+        result.error = err;
+        result.value = 0;
+        finish(result);
+    }
+}
+
+void MCCControlQueue::finish(MCCControlResult& result)
+{
+    while (true)
+    {
+        //The callback runs before the next exchange starts, so callbacks never overlap or reorder.
+        MCCControlCallback callback;
+        callback.swap(mCurrent.callback);
+        if (callback)
+            callback(result);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mQueue.empty())
+            {
+                mBusy = false;
+                mIdleCond.notify_all();
+                return;     //The queue may be destroyed as soon as the mutex is released.
+            }
+            mCurrent = mQueue.front();
+            mQueue.pop_front();
+        }
+        int err = begin(mCurrent);
+        if (err < 0)
+            return;
+        result.error = err;
+        result.response = MCCResponse();
+        result.value = 0;
+    }
+}
+
+MCCThreadControlQueue::MCCThreadControlQueue(MCCTransport* transport)
+:   mTransport(transport), mPending(NULL), mStopRequested(false)
+{
+    mThread = std::thread(&MCCThreadControlQueue::run, this);
+}
+
+MCCThreadControlQueue::~MCCThreadControlQueue()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mStopRequested = true;
+    }
+    mWakeCond.notify_one();
+    mThread.join();
+}
+
+int MCCThreadControlQueue::begin(Request& request)
+{
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        if (mStopRequested)
+            return MCC_ERR_TRANSFER_FAILED;
+        mPending = &request;
+    }
+    mWakeCond.notify_one();
+    return -1;
+}
+
+void MCCThreadControlQueue::run()
+{
+    //Same request types as MCCDevice's immediate messages and DIO calls.
+    const uint8_t hostWrites = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+    const uint8_t hostReads = LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+
+    while (true)
+    {
+        Request* request;
+        {
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            mWakeCond.wait(lock, [this]{ return mPending != NULL || mStopRequested; });
+            if (mPending == NULL)
+                break;
+            request = mPending;
+            mPending = NULL;
+        }
+
+        MCCControlResult result;
+        int res = 0;
+        result.value = 0;
+        switch (request->kind)
+        {
+            case CONTROL_MESSAGE:
+                res = mTransport->controlTransfer(hostWrites, STRING_MESSAGE, 0, 0,
+                                                  (unsigned char*)request->command.text(), MAX_MESSAGE_LENGTH, HS_DELAY);
+                if (res >= 0)
+                    res = mTransport->controlTransfer(hostReads, STRING_MESSAGE, 0, 0,
+                                                      (unsigned char*)result.response.text, MAX_MESSAGE_LENGTH, HS_DELAY);
+                if (res >= 0)
+                    result.response.text[res] = '\0';
+                break;
+            case CONTROL_READ:
+                res = mTransport->controlTransfer(hostReads, request->request, 0, 0, &result.value, 1, HS_DELAY);
+                break;
+            case CONTROL_WRITE:
+                res = mTransport->controlTransfer(hostWrites, request->request, request->value, 0, NULL, 0, HS_DELAY);
+                break;
+        }
+        result.error = res < 0 ? libUSBError(res) : -1;
+        finish(result);
+    }
+}
+
+MCCLibusbControlQueue::MCCLibusbControlQueue(libusb_context* ctx, libusb_device_handle* dev_handle)
+:   ctx(ctx), dev_handle(dev_handle), mRequest(NULL), mPhase(PHASE_IDLE), mClosing(false),
+    mInFlight(false), mStopRequested(false)
+{
+    mTransfer = libusb_alloc_transfer(0);
+    if (mTransfer == NULL)
+        throw MCC_ERR_USB_INIT;
+    mThread = std::thread(&MCCLibusbControlQueue::run, this);
+}
+
+MCCLibusbControlQueue::~MCCLibusbControlQueue()
+{
+    //Fail whatever is still queued and cut the exchange in progress short, then wait for its callback.
+    mClosing = true;
+    libusb_cancel_transfer(mTransfer);
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mStopRequested = true;
+    }
+    mWakeCond.notify_one();
+    mThread.join();
+    libusb_free_transfer(mTransfer);
+}
+
+int MCCLibusbControlQueue::begin(Request& request)
+{
+    if (mClosing)
+        return MCC_ERR_TRANSFER_FAILED;
+    mRequest = &request;
+    return submitPhase(request.kind == CONTROL_MESSAGE ? PHASE_SEND : PHASE_REGISTER);
+}
+
+int MCCLibusbControlQueue::submitPhase(Phase phase)
+{
+    //Same request types as MCCDevice's immediate messages and DIO calls.
+    const uint8_t hostWrites = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+    const uint8_t hostReads = LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+    unsigned char* data = mBuffer + LIBUSB_CONTROL_SETUP_SIZE;
+    const Request& request = *mRequest;
+
+    switch (phase)
+    {
+        case PHASE_SEND:
+            libusb_fill_control_setup(mBuffer, hostWrites, STRING_MESSAGE, 0, 0, MAX_MESSAGE_LENGTH);
+            memcpy(data, request.command.text(), MAX_MESSAGE_LENGTH);
+            break;
+        case PHASE_REPLY:
+            libusb_fill_control_setup(mBuffer, hostReads, STRING_MESSAGE, 0, 0, MAX_MESSAGE_LENGTH);
+            memset(data, 0, MAX_MESSAGE_LENGTH);
+            break;
+        default:
+            if (request.kind == CONTROL_READ)
+                libusb_fill_control_setup(mBuffer, hostReads, request.request, 0, 0, 1);
+            else
+                libusb_fill_control_setup(mBuffer, hostWrites, request.request, request.value, 0, 0);
+            break;
+    }
+    libusb_fill_control_transfer(mTransfer, dev_handle, mBuffer, transferCallback, this, HS_DELAY);
+
+    mPhase = phase;
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mInFlight = true;
+    }
+    mWakeCond.notify_one();
+    int err = libusb_submit_transfer(mTransfer);
+    if (err < 0)
+    {
+        mPhase = PHASE_IDLE;
+        return libUSBError(err);
+    }
+    return -1;
+}
+
+void MCCLibusbControlQueue::complete(int error)
+{
+    MCCControlResult result;
+    result.error = error;
+    result.value = 0;
+    if (error < 0)
+    {
+        unsigned char* data = libusb_control_transfer_get_data(mTransfer);
+        if (mPhase == PHASE_REPLY)
+        {
+            int length = std::min(mTransfer->actual_length, MAX_MESSAGE_LENGTH);
+            memcpy(result.response.text, data, length);
+            result.response.text[length] = '\0';
+        }
+        else if (mRequest->kind == CONTROL_READ && mTransfer->actual_length > 0)
+        {
+            result.value = data[0];
+        }
+    }
+    mPhase = PHASE_IDLE;
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mInFlight = false;
+    }
+    finish(result);     //Nothing of this object may be touched after this.
+}
+
+void LIBUSB_CALL MCCLibusbControlQueue::transferCallback(libusb_transfer* transfer)
+{
+    MCCLibusbControlQueue* queue = (MCCLibusbControlQueue*)transfer->user_data;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        queue->complete(libUSBTransferError(transfer->status));
+        return;
+    }
+    if (queue->mPhase == PHASE_SEND)
+    {
+        //The reply is requested from here, not from a thread that first has to wake up.
+        int err = queue->mClosing ? (int)MCC_ERR_TRANSFER_FAILED : queue->submitPhase(PHASE_REPLY);
+        if (err >= 0)
+            queue->complete(err);
+        return;
+    }
+    queue->complete(-1);
+}
+
+void MCCLibusbControlQueue::run()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            mWakeCond.wait(lock, [this]{ return mInFlight || mStopRequested; });
+            if (!mInFlight)
+                break;
+        }
+        //Other threads may be handling events too (a stream's waitBuffer, MCCDeviceGroup); libusb lets them take turns.
+        struct timeval tv = {0, 100000};
+        libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+    }
+}
@@ -0,0 +1,146 @@
+//
+//  mcccontrol.h
+//  Queued control transfers.
+//  A DAQFlex message is two control transfers (send, then read the reply), and the device holds
+//  one reply at a time, so exchanges cannot overlap on the wire. What MCCControlQueue removes is
+//  the gap between them: a whole batch is submitted at once, and each exchange is started from
+//  the completion of the one before instead of from a caller thread that has to wake up first.
+//  Results come back as futures or callbacks.
+//
+//      std::vector<std::future<MCCResponse> > replies;
+//      for (int c = 0; c < 16; c++)
+//          replies.push_back(queue.submit(MCCCommand::query("AI", c, "SLOPE")));
+//      double slope;
+//      replies[10].get().toDouble(MCCCommand::query("AI", 10, "SLOPE"), &slope);
+//
+//  Only the default control endpoint is used, so a bulk scan can keep running meanwhile.
+//
+
+#ifndef ____mcccontrol__
+#define ____mcccontrol__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <libusb.h>
+#include "mcccommand.h"
+
+class MCCTransport;
+
+struct MCCControlResult
+{
+    int error;              //-1, or the mcc_err the exchange failed with.
+    MCCResponse response;   //Reply to a DAQFlex message, not yet checked against it.
+    uint8_t value;          //Register read by submitRead.
+};
+
+typedef std::function<void(const MCCControlResult&)> MCCControlCallback;
+
+class MCCControlQueue
+{
+public:
+    virtual ~MCCControlQueue() {}
+
+    //Exchanges run one at a time in submission order, and callbacks are called in that order on
+    //whichever thread completed the exchange. A callback must not wait on this queue.
+    void submit(const MCCCommand& command, MCCControlCallback callback);
+    void submitRead(uint8_t request, MCCControlCallback callback);                  //e.g. DPORT
+    void submitWrite(uint8_t request, uint16_t value, MCCControlCallback callback); //e.g. DLATCH
+    //The same, as futures. get() throws the mcc_err the exchange failed with.
+    std::future<MCCResponse> submit(const MCCCommand& command);
+    std::future<uint8_t> submitRead(uint8_t request);
+    std::future<void> submitWrite(uint8_t request, uint16_t value);
+
+    //Block until everything submitted so far has completed and its callback has returned.
+    void wait();
+    bool isIdle();
+
+protected:
+    enum Kind { CONTROL_MESSAGE, CONTROL_READ, CONTROL_WRITE };
+    struct Request
+    {
+        Kind kind;
+        MCCCommand command;     //CONTROL_MESSAGE
+        uint8_t request;        //CONTROL_READ, CONTROL_WRITE
+        uint16_t value;         //CONTROL_WRITE
+        MCCControlCallback callback;
+    };
+
+    MCCControlQueue() : mCurrent(emptyRequest()), mBusy(false) {}
+    //Start mCurrent's exchange without waiting for it. Returns -1 once started, or an mcc_err.
+    virtual int begin(Request& request) = 0;
+    //Called by the implementation when the exchange begin started is over: runs its callback and begins the next.
+    void finish(MCCControlResult& result);
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mIdleCond;
+    std::deque<Request> mQueue;     //Waiting behind mCurrent.
+    Request mCurrent;
+    bool mBusy;                     //mCurrent is in progress.
+
+    static Request emptyRequest();
+    void enqueue(const Request& request);
+};
+
+//For any transport: a worker thread runs the exchanges through MCCTransport::controlTransfer.
+class MCCThreadControlQueue : public MCCControlQueue
+{
+public:
+    explicit MCCThreadControlQueue(MCCTransport* transport);
+    ~MCCThreadControlQueue();
+
+protected:
+    int begin(Request& request);
+
+private:
+    MCCTransport* mTransport;
+    std::thread mThread;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCond;
+    Request* mPending;
+    bool mStopRequested;
+
+    void run();
+};
+
+//On libusb's asynchronous API. Each transfer's completion callback submits the next transfer, so
+//the control pipe is never waiting on a thread. Completions are handled by whichever thread is
+//handling libusb events; the queue runs its own event thread only while exchanges are outstanding.
+class MCCLibusbControlQueue : public MCCControlQueue
+{
+public:
+    MCCLibusbControlQueue(libusb_context* ctx, libusb_device_handle* dev_handle);
+    ~MCCLibusbControlQueue();
+
+protected:
+    int begin(Request& request);
+
+private:
+    enum Phase { PHASE_IDLE, PHASE_SEND, PHASE_REPLY, PHASE_REGISTER };
+
+    libusb_context* ctx;
+    libusb_device_handle* dev_handle;
+    libusb_transfer* mTransfer;
+    unsigned char mBuffer[LIBUSB_CONTROL_SETUP_SIZE + MAX_MESSAGE_LENGTH];
+    Request* mRequest;
+    Phase mPhase;                   //Changed by begin and the callback only, never concurrently.
+    std::atomic<bool> mClosing;
+    std::thread mThread;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCond;
+    bool mInFlight;
+    bool mStopRequested;
+
+    int submitPhase(Phase phase);
+    void complete(int error);
+    void run();
+    static void LIBUSB_CALL transferCallback(libusb_transfer* transfer);
+};
+
+#endif /* defined(____mcccontrol__) */
@@ -0,0 +1,428 @@
+//
+//  mccconvert.cpp
+//
+
+#include <math.h>
+#include <algorithm>
+#include "mccerror.h"
+#include "mccconvert.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MCC_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if MCC_HAVE_SSE2 && defined(__GNUC__)
+#define MCC_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define VECTOR_WIDTH 8 //Samples per kernel iteration.
+#define TILE_LENGTH 1024 //Samples converted on the stack before being transposed to channel-major.
+#define STATS_PIECE (1 << 20) //Most samples per kernel call with stats, so the float lane counters stay exact.
+
+//MCCChannelStats lane accumulators, laid out like the gain pattern.
+struct StatsLanes
+{
+    float* min;
+    float* max;
+    double* sum;
+    double* squares;
+    float* low;
+    float* high;
+};
+
+#if MCC_HAVE_SSE2
+//Eight samples per iteration as two 4-lane halves. No FMA in SSE2, so the result is rounded twice.
+static int convertSSE2(const unsigned short* data, float* out, int length,
+                       const float* gainPattern, const float* offsetPattern, int patternLength)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i, p = 0;
+    for (i = 0; i + VECTOR_WIDTH <= length; i += VECTOR_WIDTH)
+    {
+        __m128i raw = _mm_loadu_si128((const __m128i*)&data[i]);
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+        lo = _mm_add_ps(_mm_mul_ps(lo, _mm_loadu_ps(&gainPattern[p])), _mm_loadu_ps(&offsetPattern[p]));
+        hi = _mm_add_ps(_mm_mul_ps(hi, _mm_loadu_ps(&gainPattern[p + 4])), _mm_loadu_ps(&offsetPattern[p + 4]));
+        _mm_storeu_ps(&out[i], lo);
+        _mm_storeu_ps(&out[i + 4], hi);
+        p += VECTOR_WIDTH;
+        if (p == patternLength)
+            p = 0;
+    }
+    return i;
+}
+
+//As convertSSE2, also updating the statistics lanes.
+static int convertStatsSSE2(const unsigned short* data, float* out, int length,
+                            const float* gainPattern, const float* offsetPattern, int patternLength,
+                            const StatsLanes& lanes, float maxCounts)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 zeroCounts = _mm_setzero_ps();
+    const __m128 fullCounts = _mm_set1_ps(maxCounts);
+    const __m128 one = _mm_set1_ps(1.0f);
+    int i, p = 0;
+    for (i = 0; i + VECTOR_WIDTH <= length; i += VECTOR_WIDTH)
+    {
+        __m128i raw = _mm_loadu_si128((const __m128i*)&data[i]);
+        for (int half = 0; half < 2; half++)
+        {
+            int q = p + 4*half;
+            __m128 counts = _mm_cvtepi32_ps(half ? _mm_unpackhi_epi16(raw, zero) : _mm_unpacklo_epi16(raw, zero));
+            _mm_storeu_ps(&out[i + 4*half], _mm_add_ps(_mm_mul_ps(counts, _mm_loadu_ps(&gainPattern[q])), _mm_loadu_ps(&offsetPattern[q])));
+            _mm_storeu_ps(&lanes.min[q], _mm_min_ps(_mm_loadu_ps(&lanes.min[q]), counts));
+            _mm_storeu_ps(&lanes.max[q], _mm_max_ps(_mm_loadu_ps(&lanes.max[q]), counts));
+            _mm_storeu_ps(&lanes.low[q], _mm_add_ps(_mm_loadu_ps(&lanes.low[q]), _mm_and_ps(_mm_cmpeq_ps(counts, zeroCounts), one)));
+            _mm_storeu_ps(&lanes.high[q], _mm_add_ps(_mm_loadu_ps(&lanes.high[q]), _mm_and_ps(_mm_cmpeq_ps(counts, fullCounts), one)));
+            __m128d lo = _mm_cvtps_pd(counts);
+            __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(counts, counts));
+            _mm_storeu_pd(&lanes.sum[q], _mm_add_pd(_mm_loadu_pd(&lanes.sum[q]), lo));
+            _mm_storeu_pd(&lanes.sum[q + 2], _mm_add_pd(_mm_loadu_pd(&lanes.sum[q + 2]), hi));
+            _mm_storeu_pd(&lanes.squares[q], _mm_add_pd(_mm_loadu_pd(&lanes.squares[q]), _mm_mul_pd(lo, lo)));
+            _mm_storeu_pd(&lanes.squares[q + 2], _mm_add_pd(_mm_loadu_pd(&lanes.squares[q + 2]), _mm_mul_pd(hi, hi)));
+        }
+        p += VECTOR_WIDTH;
+        if (p == patternLength)
+            p = 0;
+    }
+    return i;
+}
+#endif
+
+#if MCC_HAVE_AVX2
+__attribute__((target("avx2,fma")))
+static int convertAVX2(const unsigned short* data, float* out, int length,
+                       const float* gainPattern, const float* offsetPattern, int patternLength)
+{
+    int i, p = 0;
+    for (i = 0; i + VECTOR_WIDTH <= length; i += VECTOR_WIDTH)
+    {
+        __m128i raw = _mm_loadu_si128((const __m128i*)&data[i]);
+        __m256 samples = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw));
+        samples = _mm256_fmadd_ps(samples, _mm256_loadu_ps(&gainPattern[p]), _mm256_loadu_ps(&offsetPattern[p]));
+        _mm256_storeu_ps(&out[i], samples);
+        p += VECTOR_WIDTH;
+        if (p == patternLength)
+            p = 0;
+    }
+    return i;
+}
+
+__attribute__((target("avx2,fma")))
+static int convertStatsAVX2(const unsigned short* data, float* out, int length,
+                            const float* gainPattern, const float* offsetPattern, int patternLength,
+                            const StatsLanes& lanes, float maxCounts)
+{
+    const __m256 zeroCounts = _mm256_setzero_ps();
+    const __m256 fullCounts = _mm256_set1_ps(maxCounts);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i, p = 0;
+    for (i = 0; i + VECTOR_WIDTH <= length; i += VECTOR_WIDTH)
+    {
+        __m128i raw = _mm_loadu_si128((const __m128i*)&data[i]);
+        __m256 counts = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw));
+        _mm256_storeu_ps(&out[i], _mm256_fmadd_ps(counts, _mm256_loadu_ps(&gainPattern[p]), _mm256_loadu_ps(&offsetPattern[p])));
+        _mm256_storeu_ps(&lanes.min[p], _mm256_min_ps(_mm256_loadu_ps(&lanes.min[p]), counts));
+        _mm256_storeu_ps(&lanes.max[p], _mm256_max_ps(_mm256_loadu_ps(&lanes.max[p]), counts));
+        _mm256_storeu_ps(&lanes.low[p], _mm256_add_ps(_mm256_loadu_ps(&lanes.low[p]),
+                                                    _mm256_and_ps(_mm256_cmp_ps(counts, zeroCounts, _CMP_EQ_OQ), one)));
+        _mm256_storeu_ps(&lanes.high[p], _mm256_add_ps(_mm256_loadu_ps(&lanes.high[p]),
+                                                     _mm256_and_ps(_mm256_cmp_ps(counts, fullCounts, _CMP_EQ_OQ), one)));
+        __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(counts));
+        __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(counts, 1));
+        _mm256_storeu_pd(&lanes.sum[p], _mm256_add_pd(_mm256_loadu_pd(&lanes.sum[p]), lo));
+        _mm256_storeu_pd(&lanes.sum[p + 4], _mm256_add_pd(_mm256_loadu_pd(&lanes.sum[p + 4]), hi));
+        _mm256_storeu_pd(&lanes.squares[p], _mm256_fmadd_pd(lo, lo, _mm256_loadu_pd(&lanes.squares[p])));
+        _mm256_storeu_pd(&lanes.squares[p + 4], _mm256_fmadd_pd(hi, hi, _mm256_loadu_pd(&lanes.squares[p + 4])));
+        p += VECTOR_WIDTH;
+        if (p == patternLength)
+            p = 0;
+    }
+    return i;
+}
+
+static bool cpuHasAVX2()
+{
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+}
+#endif
+
+MCCConverter::MCCConverter()
+:   mChannelCount(0)
+{
+}
+
+void MCCConverter::setCalibration(int channelCount, const float* calSlope, const float* calOffset,
+                                  const int* minVoltage, const int* maxVoltage, unsigned short maxCounts)
+{
+    mChannelCount = channelCount;
+    mGain.resize(channelCount);
+    mOffset.resize(channelCount);
+    mGainQ16.resize(channelCount);
+    mOffsetQ16.resize(channelCount);
+    for (int chanIdx = 0; chanIdx < channelCount; chanIdx++)
+    {
+        double fullScale = maxVoltage[chanIdx] - minVoltage[chanIdx];
+        double gain = (double)calSlope[chanIdx] * fullScale / maxCounts;
+        double offset = (double)calOffset[chanIdx] * fullScale / maxCounts + minVoltage[chanIdx];
+        mGain[chanIdx] = (float)gain;
+        mOffset[chanIdx] = (float)offset;
+        mGainQ16[chanIdx] = (int64_t)llround(gain * 1e6 * 65536.0);
+        //Fold the rounding half-count into the offset so the kernel is a multiply, add and shift.
+        mOffsetQ16[chanIdx] = (int64_t)llround(offset * 1e6 * 65536.0) + (1 << 15);
+    }
+
+    mGainPattern.resize(VECTOR_WIDTH * channelCount);
+    mOffsetPattern.resize(VECTOR_WIDTH * channelCount);
+    for (int i = 0; i < VECTOR_WIDTH * channelCount; i++)
+    {
+        mGainPattern[i] = mGain[i % channelCount];
+        mOffsetPattern[i] = mOffset[i % channelCount];
+    }
+}
+
+void MCCConverter::convertScalar(const unsigned short* data, float* out, int start, int length) const
+{
+    int chanIdx = start % mChannelCount;
+    for (int i = start; i < length; i++)
+    {
+        out[i] = (float)data[i]*mGain[chanIdx] + mOffset[chanIdx];
+        if (++chanIdx == mChannelCount)
+            chanIdx = 0;
+    }
+}
+
+void MCCConverter::convertScalar(const unsigned short* data, float* out, int start, int length, MCCChannelStats& stats) const
+{
+    int chanIdx = start % mChannelCount;
+    for (int i = start; i < length; i++)
+    {
+        out[i] = (float)data[i]*mGain[chanIdx] + mOffset[chanIdx];
+        stats.add(chanIdx, data[i]);
+        if (++chanIdx == mChannelCount)
+            chanIdx = 0;
+    }
+}
+
+void MCCConverter::checkStats(const MCCChannelStats& stats, int length) const
+{
+    if (stats.channelCount() != mChannelCount)
+        throw MCC_ERR_CONFIG_MISMATCH;
+    if (length % mChannelCount != 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+}
+
+void MCCConverter::convertWithStats(const unsigned short* data, float* out, int length, MCCChannelStats& stats) const
+{
+    //Cut the block where a window ends, so each piece starts on the first channel and every
+    //sample lands in the right window.
+    int pieceScans = STATS_PIECE / mChannelCount;
+    StatsLanes lanes = { stats.mLaneMin.data(), stats.mLaneMax.data(), stats.mLaneSum.data(),
+                         stats.mLaneSquares.data(), stats.mLaneLow.data(), stats.mLaneHigh.data() };
+    for (int first = 0; first < length; )
+    {
+        int scans = std::min(std::min(stats.scansLeft(), pieceScans), (length - first) / mChannelCount);
+        int n = scans * mChannelCount, done = 0;
+#if MCC_HAVE_AVX2
+        if (cpuHasAVX2())
+            done = convertStatsAVX2(&data[first], &out[first], n, mGainPattern.data(), mOffsetPattern.data(),
+                                    (int)mGainPattern.size(), lanes, (float)stats.mMaxCounts);
+        else
+#endif
+#if MCC_HAVE_SSE2
+        done = convertStatsSSE2(&data[first], &out[first], n, mGainPattern.data(), mOffsetPattern.data(),
+                                (int)mGainPattern.size(), lanes, (float)stats.mMaxCounts);
+#endif
+        convertScalar(&data[first], &out[first], done, n, stats);
+        stats.foldLanes();
+        stats.endScans(scans);
+        first += n;
+    }
+}
+
+void MCCConverter::convert(const unsigned short* data, float* out, int length) const
+{
+    int done = 0;
+    if (mChannelCount <= 0)
+        return;
+#if MCC_HAVE_AVX2
+    if (cpuHasAVX2())
+        done = convertAVX2(data, out, length, mGainPattern.data(), mOffsetPattern.data(), (int)mGainPattern.size());
+    else
+#endif
+#if MCC_HAVE_SSE2
+    done = convertSSE2(data, out, length, mGainPattern.data(), mOffsetPattern.data(), (int)mGainPattern.size());
+#endif
+    convertScalar(data, out, done, length);
+}
+
+void MCCConverter::convert(const unsigned short* data, float* out, int length, MCCLayout layout, MCCChannelStats* stats) const
+{
+    if (stats && !stats->enabled())
+        stats = nullptr;
+    if (layout == MCC_LAYOUT_INTERLEAVED)
+    {
+        if (!stats)
+            convert(data, out, length);
+        else if (mChannelCount > 0)
+        {
+            checkStats(*stats, length);
+            convertWithStats(data, out, length, *stats);
+        }
+        return;
+    }
+    if (mChannelCount <= 0)
+        return;
+    if (length % mChannelCount != 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    convertPlanar(data, NULL, out, length / mChannelCount, stats);
+}
+
+void MCCConverter::convert(const unsigned short* data, float* const* channels, int frames, MCCChannelStats* stats) const
+{
+    convertPlanar(data, channels, NULL, frames, stats);
+}
+
+void MCCConverter::convertPlanar(const unsigned short* data, float* const* channels, float* out, int frames,
+                                 MCCChannelStats* stats) const
+{
+    float tile[TILE_LENGTH];
+    int tileFrames, chanIdx, frame, n;
+
+    if (mChannelCount <= 0)
+        return;
+    if (stats && !stats->enabled())
+        stats = nullptr;
+    if (stats)
+        checkStats(*stats, 0);
+    tileFrames = TILE_LENGTH / mChannelCount;
+    //Start every tile on a vector boundary so each sample takes the same kernel path as in the interleaved layout.
+    if (tileFrames >= VECTOR_WIDTH)
+        tileFrames -= tileFrames % VECTOR_WIDTH;
+    if (tileFrames == 0)
+    {
+        //More than TILE_LENGTH channels, which MCCChannelStats does not take.
+        for (frame = 0; frame < frames; frame++)
+            for (chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+                (channels ? channels[chanIdx] : &out[(size_t)chanIdx*frames])[frame] = (float)data[(size_t)frame*mChannelCount + chanIdx]*mGain[chanIdx] + mOffset[chanIdx];
+        return;
+    }
+
+    //Convert a cache-sized tile with the vector kernel, then scatter it into the channel arrays.
+    for (int first = 0; first < frames; first += tileFrames)
+    {
+        n = std::min(tileFrames, frames - first);
+        if (stats)
+            convertWithStats(&data[(size_t)first * mChannelCount], tile, n * mChannelCount, *stats);
+        else
+            convert(&data[(size_t)first * mChannelCount], tile, n * mChannelCount);
+        for (chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+        {
+            float* dst = (channels ? channels[chanIdx] : &out[(size_t)chanIdx*frames]) + first;
+            for (frame = 0; frame < n; frame++)
+                dst[frame] = tile[frame*mChannelCount + chanIdx];
+        }
+    }
+}
+
+void MCCConverter::convertMicrovolts(const unsigned short* data, int32_t* out, int length, MCCLayout layout,
+                                     MCCChannelStats* stats) const
+{
+    int chanIdx = 0;
+
+    if (mChannelCount <= 0)
+        return;
+    if (stats && !stats->enabled())
+        stats = nullptr;
+    if (layout == MCC_LAYOUT_INTERLEAVED && !stats)
+    {
+        for (int i = 0; i < length; i++)
+        {
+            out[i] = (int32_t)((data[i]*mGainQ16[chanIdx] + mOffsetQ16[chanIdx]) >> 16);
+            if (++chanIdx == mChannelCount)
+                chanIdx = 0;
+        }
+        return;
+    }
+    if (layout == MCC_LAYOUT_INTERLEAVED)
+    {
+        checkStats(*stats, length);
+        for (int first = 0; first < length; )
+        {
+            int end = first + std::min(stats->scansLeft(), (length - first) / mChannelCount) * mChannelCount;
+            for (int i = first; i < end; i++)
+            {
+                out[i] = (int32_t)((data[i]*mGainQ16[chanIdx] + mOffsetQ16[chanIdx]) >> 16);
+                stats->add(chanIdx, data[i]);
+                if (++chanIdx == mChannelCount)
+                    chanIdx = 0;
+            }
+            stats->endScans((end - first) / mChannelCount);
+            first = end;
+        }
+        return;
+    }
+    if (length % mChannelCount != 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    convertMicrovoltsPlanar(data, NULL, out, length / mChannelCount, stats);
+}
+
+void MCCConverter::convertMicrovolts(const unsigned short* data, int32_t* const* channels, int frames,
+                                     MCCChannelStats* stats) const
+{
+    convertMicrovoltsPlanar(data, channels, NULL, frames, stats);
+}
+
+void MCCConverter::convertMicrovoltsPlanar(const unsigned short* data, int32_t* const* channels, int32_t* out, int frames,
+                                           MCCChannelStats* stats) const
+{
+    if (stats && !stats->enabled())
+        stats = nullptr;
+    if (stats)
+        checkStats(*stats, 0);
+    for (int first = 0; first < frames; )
+    {
+        int n = stats ? std::min(stats->scansLeft(), frames - first) : frames;
+        for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+        {
+            const unsigned short* src = &data[(size_t)first*mChannelCount + chanIdx];
+            int32_t* dst = (channels ? channels[chanIdx] : &out[(size_t)chanIdx*frames]) + first;
+            int64_t gain = mGainQ16[chanIdx];
+            int64_t offset = mOffsetQ16[chanIdx];
+            if (!stats)
+            {
+                for (int frame = 0; frame < n; frame++)
+                    dst[frame] = (int32_t)((src[(size_t)frame*mChannelCount]*gain + offset) >> 16);
+                continue;
+            }
+            for (int frame = 0; frame < n; frame++)
+            {
+                unsigned short counts = src[(size_t)frame*mChannelCount];
+                dst[frame] = (int32_t)((counts*gain + offset) >> 16);
+                stats->add(chanIdx, counts);
+            }
+        }
+        if (stats)
+            stats->endScans(n);
+        first += n;
+    }
+}
+
+const char* MCCConverter::kernelName()
+{
+#if MCC_HAVE_AVX2
+    if (cpuHasAVX2())
+        return "avx2";
+#endif
+#if MCC_HAVE_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,86 @@
+//
+//  mccconvert.h
+//  Block conversion of raw interleaved counts to calibrated volts.
+//  MCCDevice::scaleAndCalibrateData computes, per sample,
+//      ((data*calSlope + calOffset)/maxCounts)*(maxVoltage - minVoltage) + minVoltage
+//  MCCConverter folds that into one gain and one offset per channel,
+//      volts = data*gain + offset
+//  and applies it to a whole block with SSE2 or AVX2/FMA when available, scalar otherwise.
+//  Output can be interleaved (same order as mData) or channel-major, and either float volts
+//  or fixed-point int32 microvolts computed with integer arithmetic only. Given an MCCChannelStats
+//  (see mccchanstats.h), every variant also accumulates per-channel statistics in the same pass.
+//
+//  Accuracy: gain and offset are computed in double and rounded once, and every path rounds
+//  the product-sum at most twice, so the result differs from scaleAndCalibrateData by at most
+//  3 float ulps of the channel's full-scale span (e.g. 3*2^-19 V = 5.7 uV on BIP10V),
+//  which is well under one count (305 uV on BIP10V). Values are not bit-identical.
+//
+
+#ifndef ____mccconvert__
+#define ____mccconvert__
+
+#include <stdint.h>
+#include <vector>
+#include "mccchanstats.h"
+
+//Output layout for MCCConverter.
+enum MCCLayout
+{
+    MCC_LAYOUT_INTERLEAVED,     //out[frame*channelCount + chanIdx], same order as the device sends it.
+    MCC_LAYOUT_CHANNEL_MAJOR,   //out[chanIdx*frames + frame], one contiguous run per channel.
+};
+
+class MCCConverter
+{
+public:
+    MCCConverter();
+
+    //Rebuild the per-channel coefficients. Called by MCCDevice::reconfigure.
+    void setCalibration(int channelCount, const float* calSlope, const float* calOffset,
+                        const int* minVoltage, const int* maxVoltage, unsigned short maxCounts);
+
+    //Convert length interleaved samples. data[0] must belong to the first channel.
+    void convert(const unsigned short* data, float* out, int length) const;
+    //As above, writing in the requested layout. For MCC_LAYOUT_CHANNEL_MAJOR length must be a whole number of frames.
+    //With stats (configured for this converter's channel count), length must be a whole number of frames in
+    //either layout, and the samples are also added to stats.
+    void convert(const unsigned short* data, float* out, int length, MCCLayout layout, MCCChannelStats* stats = nullptr) const;
+    //Channel-major into separate caller-owned arrays: channels[chanIdx][frame].
+    void convert(const unsigned short* data, float* const* channels, int frames, MCCChannelStats* stats = nullptr) const;
+
+    //Fixed-point output in microvolts, integer arithmetic only. Within 1 uV of the exact calibrated value.
+    void convertMicrovolts(const unsigned short* data, int32_t* out, int length, MCCLayout layout = MCC_LAYOUT_INTERLEAVED,
+                           MCCChannelStats* stats = nullptr) const;
+    void convertMicrovolts(const unsigned short* data, int32_t* const* channels, int frames, MCCChannelStats* stats = nullptr) const;
+
+    int channelCount() const { return mChannelCount; }
+    float gain(int chanIdx) const { return mGain[chanIdx]; }
+    float offset(int chanIdx) const { return mOffset[chanIdx]; }
+
+    //Which kernel convert() dispatches to: "avx2", "sse2" or "scalar".
+    static const char* kernelName();
+
+private:
+    int mChannelCount;
+    std::vector<float> mGain;
+    std::vector<float> mOffset;
+    //Coefficients repeated over 8*mChannelCount samples, so an 8-wide vector always lines up with the channels.
+    std::vector<float> mGainPattern;
+    std::vector<float> mOffsetPattern;
+    //Same coefficients in microvolts, Q16 fixed point.
+    std::vector<int64_t> mGainQ16;
+    std::vector<int64_t> mOffsetQ16;
+
+    void convertScalar(const unsigned short* data, float* out, int start, int length) const;
+    void convertScalar(const unsigned short* data, float* out, int start, int length, MCCChannelStats& stats) const;
+    //Interleaved conversion feeding stats, split at window boundaries.
+    void convertWithStats(const unsigned short* data, float* out, int length, MCCChannelStats& stats) const;
+    void checkStats(const MCCChannelStats& stats, int length) const;
+    //Channel-major conversion into channels[chanIdx], or into out[chanIdx*frames + frame] if channels is NULL.
+    void convertPlanar(const unsigned short* data, float* const* channels, float* out, int frames,
+                       MCCChannelStats* stats) const;
+    void convertMicrovoltsPlanar(const unsigned short* data, int32_t* const* channels, int32_t* out, int frames,
+                                 MCCChannelStats* stats) const;
+};
+
+#endif /* defined(____mccconvert__) */
@@ -8,47 +8,13 @@
 #include <iostream>
 #include <string>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 #include <libusb.h>
 #include "mccdevice.h"
-
-/* These definitions are used to build the request type in usb_control_msg */
-#define MCC_VID         (0x09db)  // Vendor ID for Measurement Computing
-#define CTRL_IN         (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN)
-#define CTRL_OUT        (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT)
-#define INTR_LENGTH     64
-
-#define  INPUT_REPORT   (1 << 8)
-#define  OUTPUT_REPORT  (2 << 8)
-
-/* Digital I/O Commands */
-#define DTRISTATE     (0x00)   // Read/Write Tristate register
-#define DPORT         (0x01)   // Read digital port pins
-#define DLATCH        (0x02)   // Read/Write Digital port output latch register
-
-/* Description of the requestType byte */
-// Data transfer direction D7;  libusb_endpoint_direction
-//#define HOST_TO_DEVICE (0x0 << 7)  // LIBUSB_ENDPOINT_IN
-//#define DEVICE_TO_HOST (0x1 << 7)  // LIBUSB_ENDPOINT_OUT
-// Type D5-D6; libusb_request_type
-//#define STANDARD_TYPE (0x0 << 5)  // LIBUSB_REQUEST_TYPE_STANDARD
-//#define CLASS_TYPE    (0x1 << 5)  // LIBUSB_REQUEST_TYPE_CLASS
-//#define VENDOR_TYPE   (0x2 << 5)  // LIBUSB_REQUEST_TYPE_VENDOR
-//#define RESERVED_TYPE (0x3 << 5)
-// Recipient D0 - D4; libusb_request_recipient
-//#define DEVICE_RECIPIENT    (0x0)  // LIBUSB_RECIPIENT_DEVICE
-//#define INTERFACE_RECIPIENT (0x1)  // LIBUSB_RECIPIENT_INTERFACE
-//#define ENDPOINT_RECIPIENT  (0x2)  // LIBUSB_RECIPIENT_ENDPOINT
-//#define OTHER_RECIPIENT     (0x3)  // LIBUSB_RECIPIENT_OTHER
-//#define RESERVED_RECIPIENT  (0x4)
-
-/* MDB Control Transfers */
-#define MAX_MESSAGE_LENGTH 64      // max length of MBD Packet in bytes
-                                   // Request types:
-#define STRING_MESSAGE     (0x80)  // Send string messages to the device
-#define RAW_DATA           (0x81)  // Return RAW data from the device
-#define FPGADATAREQUEST    (0x51)
-#define HS_DELAY            1000   // wjasper uses 20
+#include "mccprotocol.h"
+#include "mcctransport.h"
 
 mcc_err libUSBError(int err)
 {
@@ -65,6 +31,23 @@ mcc_err libUSBError(int err)
     }
 }
 
+mcc_err libUSBTransferError(int status)
+{
+    switch(status)
+    {
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return MCC_ERR_LIBUSB_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:
+            return MCC_ERR_LIBUSB_TRANSFER_STALL;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return MCC_ERR_LIBUSB_TRANSFER_OVERFLOW;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return MCC_ERR_NO_DEVICE;
+        default:
+            return MCC_ERR_TRANSFER_FAILED;
+    }
+}
+
 std::string errorString(int err)
 {
     std::stringstream unknownerror;
@@ -91,13 +74,27 @@ std::string errorString(int err)
             return "Cannot open FPGA file\n";
         case MCC_ERR_FPGA_UPLOAD_FAILED:
             return "FPGA firmware could not be uploaded\n";
+        case MCC_ERR_NOT_STREAMING:
+            return "Device is not streaming, call startStream first\n";
+        case MCC_ERR_CONFIG_MISMATCH:
+            return "Devices have incompatible scan settings\n";
+        case MCC_ERR_FILE_IO:
+            return "File could not be opened, extended or mapped\n";
+        case MCC_ERR_BAD_FILE_FORMAT:
+            return "Not a recording file, or an unsupported version\n";
+        case MCC_ERR_BAD_RESPONSE:
+            return "Device reply does not answer the message sent\n";
+        case MCC_ERR_SCAN_OVERRUN:
+            return "Device scan buffer overran; samples were lost\n";
+        case MCC_ERR_BUFFERS_HELD:
+            return "Stream buffers are still held; release them first\n";
         default:
             unknownerror << "Error number " << err << " has no text\n";
             return unknownerror.str();
     }
 }
 
-static std::string toNameString(int idProduct)
+std::string toNameString(int idProduct)
 {
     switch(idProduct)
     {
@@ -118,7 +115,7 @@ static std::string toNameString(int idProduct)
     }
 }
 
-static bool isMCCProduct(int idProduct)
+bool isMCCProduct(int idProduct)
 {
     switch(idProduct)
     {
@@ -134,41 +131,169 @@ static bool isMCCProduct(int idProduct)
 
 //Constructor finds the first available device where product ID == idProduct and optionally serial number == mfgSerialNumber
 MCCDevice::MCCDevice(int idProduct)
+:   mContext(NULL), mOwnsContext(true), mTransport(nullptr)
 {
     std::string mfgSerialNumber = "NULL";
-    initDevice(idProduct, mfgSerialNumber);
+    try
+    {
+        initDevice(idProduct, mfgSerialNumber);
+    }
+    catch(...)
+    {
+        releaseDevice();
+        throw;
+    }
 }
 
 MCCDevice::MCCDevice(int idProduct, std::string mfgSerialNumber)
+:   mContext(NULL), mOwnsContext(true), mTransport(nullptr)
 {
-    initDevice(idProduct, mfgSerialNumber);
+    try
+    {
+        initDevice(idProduct, mfgSerialNumber);
+    }
+    catch(...)
+    {
+        releaseDevice();
+        throw;
+    }
+}
+
+//Open the device on a libusb context owned by the caller (e.g. MCCDeviceGroup), which must outlive this object.
+MCCDevice::MCCDevice(int idProduct, std::string mfgSerialNumber, libusb_context* ctx)
+:   mContext(ctx), mOwnsContext(false), mTransport(nullptr)
+{
+    try
+    {
+        initDevice(idProduct, mfgSerialNumber);
+    }
+    catch(...)
+    {
+        releaseDevice();
+        throw;
+    }
+}
+
+//Use an already opened transport (e.g. MCCSimTransport) instead of searching the USB bus.
+MCCDevice::MCCDevice(int idProduct, MCCTransport* transport)
+:   mContext(NULL), mOwnsContext(false), mTransport(transport)
+{
+    MCCResponse response;
+    try
+    {
+        getScanParams();
+        mSerialNumber = queryValue(MCCCommand::query("DEV:MFGSER"), &response);
+        initBuffers(idProduct);
+    }
+    catch(...)
+    {
+        //The transport is ours from here on, even when construction fails.
+        releaseDevice();
+        throw;
+    }
 }
 
 //Destructor
 MCCDevice::~MCCDevice () {
-    //Free memory and devices
-    libusb_release_interface(dev_handle, 0);
-    libusb_close(dev_handle);
-    libusb_free_device_list(list, true);
-    libusb_exit(NULL);
+    releaseDevice();
+}
+
+//Free memory and devices. Called by the destructor, and by a constructor that throws,
+//so anything not yet allocated must still be NULL.
+void MCCDevice::releaseDevice()
+{
+    mBuffersHeld = 0; //Going away regardless; buffers still held die with the stream.
+    stopStream();
+    delete mControl;
+    mControl = nullptr;
+    delete mTransport;
+    mTransport = nullptr;
+    if (list)
+        libusb_free_device_list(list, true);
+    list = nullptr;
+    if (mOwnsContext)
+        libusb_exit(mContext);
+    mOwnsContext = false;
+    delete [] calSlope;
     calSlope = nullptr;
+    delete [] calOffset;
     calOffset = nullptr;
+    delete [] minVoltage;
     minVoltage = nullptr;
+    delete [] maxVoltage;
     maxVoltage = nullptr;
     delete [] mData;
     mData = nullptr;
 }
 
+//Read the USB serial number string descriptor. dev_handle may be NULL, in which case the device is opened
+//(not claimed) just long enough to read it. Returns an empty string if there is none or it cannot be read.
+std::string MCCDevice::getDescriptorSerial(libusb_device* device, libusb_device_handle* dev_handle)
+{
+    libusb_device_descriptor desc;
+    unsigned char serial[MAX_MESSAGE_LENGTH];
+    libusb_device_handle* handle = dev_handle;
+    int length = 0;
+    
+    if (libusb_get_device_descriptor(device, &desc) != 0 || desc.iSerialNumber == 0)
+        return "";
+    if (!handle && libusb_open(device, &handle) != 0)
+        return "";
+    length = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial));
+    if (!dev_handle)
+        libusb_close(handle);
+    if (length <= 0)
+        return "";
+    return std::string((char*)serial, length);
+}
+
+std::vector<MCCDeviceInfo> MCCDevice::listDevices()
+{
+    std::vector<MCCDeviceInfo> devices;
+    libusb_context* ctx = NULL;
+    libusb_device** devList;
+    libusb_device_descriptor desc;
+    ssize_t sizeOfList;
+    
+    if (libusb_init(&ctx) != 0)
+        throw MCC_ERR_USB_INIT;
+    
+    sizeOfList = libusb_get_device_list(ctx, &devList);
+    for (ssize_t i = 0; i < sizeOfList; i++)
+    {
+        if (libusb_get_device_descriptor(devList[i], &desc) != 0)
+            continue;
+        if (desc.idVendor != MCC_VENDOR_ID || !isMCCProduct(desc.idProduct))
+            continue;
+        
+        MCCDeviceInfo info;
+        info.idProduct = desc.idProduct;
+        info.name = toNameString(desc.idProduct);
+        info.serialNumber = getDescriptorSerial(devList[i], NULL);
+        info.bus = libusb_get_bus_number(devList[i]);
+        info.port = libusb_get_port_number(devList[i]);
+        info.address = libusb_get_device_address(devList[i]);
+        devices.push_back(info);
+    }
+    
+    if (sizeOfList >= 0)
+        libusb_free_device_list(devList, true);
+    libusb_exit(ctx);
+    return devices;
+}
+
 //Find the device, opens it, and claims it. Called by constructors.
-//Sets idProduct, maxCounts, list, dev_handle
+//Sets idProduct, maxCounts, list, mTransport
 void MCCDevice::initDevice(int idProduct, std::string mfgSerialNumber){
     int i;
     bool found = false;
     ssize_t sizeOfList;
     libusb_device_descriptor desc;
     libusb_device* device;
-    std::string mfgsermsg = "?DEV:MFGSER";
+    libusb_device_handle* dev_handle;
+    MCCResponse response;
     std::string retMessage;
+    std::string descriptorSerial;
     
     //Check if the product ID is a valid MCC product ID
     if(!isMCCProduct(idProduct))
@@ -177,13 +302,14 @@ void MCCDevice::initDevice(int idProduct, std::string mfgSerialNumber){
     }
     
     //Initialize USB libraries
-    if(libusb_init(NULL) != 0)
+    if(mOwnsContext && libusb_init(&mContext) != 0)
     {
+        mOwnsContext = false;
         throw MCC_ERR_USB_INIT;
     }
     
     //Get the list of USB devices connected to the PC
-    sizeOfList= libusb_get_device_list(NULL, &list);
+    sizeOfList= libusb_get_device_list(mContext, &list);
     
     //Traverse the list of USB devices to find the requested device
     for (i=0; (i<sizeOfList) && (!found); i++)
@@ -197,35 +323,43 @@ void MCCDevice::initDevice(int idProduct, std::string mfgSerialNumber){
             //libusb_open(device, &dev_handle) returns -12 in Windows;
             if (!libusb_open(device, &dev_handle))
             {
+                //MCC devices report DEV:MFGSER as their USB serial number too. When it is readable,
+                //rule out other devices without claiming them or sending them any DAQFlex traffic.
+                descriptorSerial = getDescriptorSerial(device, dev_handle);
+                if (mfgSerialNumber.compare("NULL")!=0 && !descriptorSerial.empty() && descriptorSerial.compare(mfgSerialNumber)!=0)
+                {
+                    libusb_close(dev_handle);
+                    continue;
+                }
+                
                 //Claim interface with the device
-                if (!libusb_claim_interface(dev_handle, 0))
+                try
+                {
+                    mTransport = new MCCLibusbTransport(mContext, dev_handle);
+                }
+                catch(mcc_err err)
                 {
-                    //Get scan parameters
-                    getScanParams(); //sets endpoint_in, endpoint_out, bulkPacketSize
-                    
-                    try
-                    {
-                        //get the device serial number
-                        retMessage = sendMessage(mfgsermsg); //For 1608-FS-Plus, DEV:MFGSER=018FF921 in response to ?DEV:MFGSER
-                    }
-                    catch(mcc_err err)
-                    {
-                        throw err;
-                    }
-                    
-                    //Erase message while keeping serial number
-                    retMessage.erase(0, 11); //TODO: Use mfgsermsg.length()
-                    //cout << "Found " << toNameString(idProduct) << " with Serial Number " << retMessage << "\n";
-                    
-                    //If the input serial number was not NULL and retMessage does not match (string.compare returns 0 if matched.
-                    if (mfgSerialNumber.compare("NULL")!=0 && retMessage.compare(mfgSerialNumber)!=0)
-                    {//serial numbers are not the same, release device and continue on
-                        libusb_release_interface(dev_handle, 0);
-                    }
-                    else
-                    { //serial numbers are the same, this is the correct device
-                        found = true;
-                    }
+                    mTransport = nullptr;
+                    continue;
+                }
+                
+                //Get scan parameters
+                getScanParams(); //sets endpoint_in, endpoint_out, bulkPacketSize
+                
+                //get the device serial number. For 1608-FS-Plus, DEV:MFGSER=018FF921 in response to ?DEV:MFGSER
+                retMessage = queryValue(MCCCommand::query("DEV:MFGSER"), &response);
+                //cout << "Found " << toNameString(idProduct) << " with Serial Number " << retMessage << "\n";
+                
+                //If the input serial number was not NULL and retMessage does not match (string.compare returns 0 if matched.
+                if (mfgSerialNumber.compare("NULL")!=0 && retMessage.compare(mfgSerialNumber)!=0)
+                {//serial numbers are not the same, release device and continue on
+                    delete mTransport;
+                    mTransport = nullptr;
+                }
+                else
+                { //serial numbers are the same, this is the correct device
+                    found = true;
+                    mSerialNumber = retMessage;
                 }
             }
         }
@@ -237,18 +371,26 @@ void MCCDevice::initDevice(int idProduct, std::string mfgSerialNumber){
     }
     else
     {
-        this->idProduct = idProduct;
-        maxCounts = 0xFFFF;//I deleted the firmware flash, so all devices initialize the same way.
-                           //this->getLimits(); //For some reason, the messages do not get responses.
-        
-        //Always init the internal data buffer. It can be used with getBlock().
-        //The data buffer can be ignored if using external data buffer and readScanData();
-        mSamplesPerBlock = 1; //Change this value then reconfigure().
-        mData = new unsigned short [mSamplesPerBlock * 1]; //This will get overwritten in reconfigure.
-        this->reconfigure();
+        initBuffers(idProduct);
     }
 }
 
+//Set up per-device state once a transport is open. Called by constructors.
+void MCCDevice::initBuffers(int idProduct)
+{
+    this->idProduct = idProduct;
+    maxCounts = 0xFFFF;//I deleted the firmware flash, so all devices initialize the same way.
+                       //this->getLimits(); //For some reason, the messages do not get responses.
+    
+    //Always init the internal data buffer. It can be used with getBlock().
+    //The data buffer can be ignored if using external data buffer and readScanData();
+    mSamplesPerBlock = 1; //Change this value then reconfigure(), or set a transfer policy.
+    mData = new unsigned short [mSamplesPerBlock * 1]; //This will get overwritten in reconfigure.
+    mHasTransferPolicy = false;
+    mConfigGeneration = 0;
+    this->reconfigure();
+}
+
 //Get the device input and output endpoints
 void MCCDevice::getScanParams()
 {
@@ -256,7 +398,7 @@ void MCCDevice::getScanParams()
     unsigned char epDescriptor[MAX_MESSAGE_LENGTH];
     uint8_t requesttype = (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_STANDARD | LIBUSB_RECIPIENT_DEVICE);
     uint16_t wValue = (0x02 << 8) | 0;  // I have no idea where this comes from.
-    numBytesTransferred = libusb_control_transfer(dev_handle, requesttype, LIBUSB_REQUEST_GET_DESCRIPTOR,
+    numBytesTransferred = mTransport->controlTransfer(requesttype, LIBUSB_REQUEST_GET_DESCRIPTOR,
                                                   wValue, 0, epDescriptor, MAX_MESSAGE_LENGTH, HS_DELAY);
     
     if(numBytesTransferred < 0)
@@ -368,34 +510,151 @@ unsigned short MCCDevice::getBulkPacketSize(unsigned char* data, int data_length
 //Returns response if transfer successful, null if not
 std::string MCCDevice::sendMessage(std::string message)
 {
-    try
-    {
-        sendControlTransferString(message);
-        return getControlTransferString();
-    }
-    catch(mcc_err err)
+    MCCResponse response;
+    transact(MCCCommand::raw(message.c_str()), &response);
+    return response.text;
+}
+
+void MCCDevice::transact(const MCCCommand& command, MCCResponse* response)
+{
+    std::unique_lock<std::mutex> lock = lockControl();
+    noteCommand(command);
+    sendControlTransferString(command);
+    getControlTransferString(response);
+}
+
+std::future<MCCResponse> MCCDevice::submit(const MCCCommand& command)
+{
+    std::lock_guard<std::mutex> lock(mControlMutex);
+    noteCommand(command);
+    return controlQueue().submit(command);
+}
+
+void MCCDevice::submit(const MCCCommand& command, MCCControlCallback callback)
+{
+    std::lock_guard<std::mutex> lock(mControlMutex);
+    noteCommand(command);
+    controlQueue().submit(command, callback);
+}
+
+std::future<uint8_t> MCCDevice::getDIOPortAsync()
+{
+    std::lock_guard<std::mutex> lock(mControlMutex);
+    return controlQueue().submitRead(DPORT);
+}
+
+void MCCDevice::getDIOPortAsync(MCCControlCallback callback)
+{
+    std::lock_guard<std::mutex> lock(mControlMutex);
+    controlQueue().submitRead(DPORT, callback);
+}
+
+//Immediate transfers hold this while they run. Nothing can be queued meanwhile, and whatever was
+//queued before has finished, so the two never interleave on the wire.
+std::unique_lock<std::mutex> MCCDevice::lockControl()
+{
+    std::unique_lock<std::mutex> lock(mControlMutex);
+    if (mControl)
+        mControl->wait();
+    return lock;
+}
+
+MCCControlQueue& MCCDevice::getControlQueue()
+{
+    std::lock_guard<std::mutex> lock(mControlMutex);
+    return controlQueue();
+}
+
+MCCControlQueue& MCCDevice::controlQueue()
+{
+    if (!mControl)
+        mControl = mTransport->createControlQueue();
+    return *mControl;
+}
+
+//Side effects of a message on this object, applied when it is sent or queued.
+void MCCDevice::noteCommand(const MCCCommand& command)
+{
+    //Changing a channel's range or calibration makes the cached calibration stale.
+    if (!mSerialNumber.empty() && isCalibrationSetting(command.text()))
+        MCCCalibrationCache::instance().invalidate(mSerialNumber);
+    //Scan and sample counts, and the clock fit, start again with every scan.
+    if (strncmp(command.text(), "AISCAN:START", 12) == 0)
     {
-        throw err;
+        mSamplesReceived = mSamplesRead = mBlockScan = 0;
+        mPacketOffset = mPacketLength = 0;
+        mClock.reset();
+        if (mTrigger)
+            mTrigger->rearm();
     }
 }
 
-//Send a message to the device
-void MCCDevice::sendControlTransferString(std::string message)
+void MCCDevice::execute(const MCCCommand& command)
+{
+    MCCResponse response;
+    transact(command, &response);
+    if (!response.answers(command))
+        throw MCC_ERR_BAD_RESPONSE;
+}
+
+int MCCDevice::queryInt(const MCCCommand& query)
+{
+    MCCResponse response;
+    transact(query, &response);
+    return replyInt(query, response);
+}
+
+double MCCDevice::queryDouble(const MCCCommand& query)
+{
+    MCCResponse response;
+    transact(query, &response);
+    return replyDouble(query, response);
+}
+
+int MCCDevice::replyInt(const MCCCommand& query, const MCCResponse& response)
+{
+    int value;
+    if (!response.toInt(query, &value))
+        throw MCC_ERR_BAD_RESPONSE;
+    return value;
+}
+
+double MCCDevice::replyDouble(const MCCCommand& query, const MCCResponse& response)
+{
+    double value;
+    if (!response.toDouble(query, &value))
+        throw MCC_ERR_BAD_RESPONSE;
+    return value;
+}
+
+const char* MCCDevice::queryValue(const MCCCommand& query, MCCResponse* response)
+{
+    transact(query, response);
+    const char* value = response->value(query);
+    if (!value)
+        throw MCC_ERR_BAD_RESPONSE;
+    return value;
+}
+
+//True for messages that set an analog input property, e.g. AI{0}:RANGE=BIP5V or AI:RANGE=BIP1V
+bool MCCDevice::isCalibrationSetting(const char* message)
+{
+    if (strlen(message) < 3 || !strchr(message, '='))
+        return false;
+    return toupper(message[0]) == 'A' && toupper(message[1]) == 'I' && (message[2] == '{' || message[2] == ':');
+}
+
+//Send a message to the device. The command's buffer is already NUL-padded to 64 bytes.
+void MCCDevice::sendControlTransferString(const MCCCommand& command)
 {
     int numBytesTransferred;
     
     //StringUtil::toUpper(message);
     //TODO: Convert message toUpper
     
-    //std::cout << "Sending: " << message << std::endl;
-    unsigned char data[MAX_MESSAGE_LENGTH]; //64
-    copy( message.begin(), message.end(), data );
-    data[MAX_MESSAGE_LENGTH - 1] = '\0';
-    //std::cout << "Message data: " << data << std::endl;
-    
     uint8_t requesttype = (LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
-    numBytesTransferred = libusb_control_transfer(dev_handle, requesttype,
-                                                  STRING_MESSAGE, 0, 0, data,
+    numBytesTransferred = mTransport->controlTransfer(requesttype,
+                                                  STRING_MESSAGE, 0, 0, (unsigned char*)command.text(),
                                                   MAX_MESSAGE_LENGTH, HS_DELAY);
     
     if(numBytesTransferred < 0)
@@ -403,22 +662,19 @@ void MCCDevice::sendControlTransferString(std::string message)
 }
 
 //Receive a message from the device. This should follow a call to sendControlTransfer.
-//It will return a pointer to at most a 64 character array.
-std::string MCCDevice::getControlTransferString()
+//At most 64 characters, e.g. DEV:MFGSER=018FF921 in response to ?DEV:MFGSER
+void MCCDevice::getControlTransferString(MCCResponse* response)
 {
     int messageLength;
-    unsigned char message[MAX_MESSAGE_LENGTH];
-    std::string out_string;
     uint8_t requesttype = (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
-    messageLength = libusb_control_transfer(dev_handle,  requesttype,
-                                            STRING_MESSAGE, 0, 0, message,
+    messageLength = mTransport->controlTransfer( requesttype,
+                                            STRING_MESSAGE, 0, 0, (unsigned char*)response->text,
                                             MAX_MESSAGE_LENGTH, HS_DELAY);
     if(messageLength < 0)
         throw libUSBError(messageLength);
     
-    out_string = (char*)message;
-    //std::cout << "Got: " << return_string << "\n\n";
-    return out_string; //e.g. DEV:MFGSER=018FF921 in response to ?DEV:MFGSER
+    //A full 64-byte reply has no terminator of its own.
+    response->text[messageLength] = '\0';
 }
 
 
@@ -431,25 +687,370 @@ void MCCDevice::readScanData(unsigned short* data, int length)
     int err = 0, totalTransferred = 0, transferred;
     unsigned char* dataAsByte = (unsigned char*)data; //Change the type of the pointer to data.
     unsigned int timeout = 2000000;///(bulkPacketSize*rate);
+    double now;
+    
+    if (mStream)
+    {
+        if (readStreamData(dataAsByte, length*2, timeout) < length*2)
+        {
+            noteError(MCC_ERR_LIBUSB_TIMEOUT);
+            throw MCC_ERR_LIBUSB_TIMEOUT;
+        }
+        mSamplesRead += length;
+        return;
+    }
     
     do{
         //TODO: Convert to asynchronous I/O API
-        err =  libusb_bulk_transfer(dev_handle, endpoint_in, &dataAsByte[totalTransferred], bulkPacketSize, &transferred, timeout);
+        err = readBulk(&dataAsByte[totalTransferred], length*2 - totalTransferred,
+                       mSamplesReceived + totalTransferred / 2, timeout, &transferred);
         totalTransferred += transferred;
+        now = mccHostTime();
         //std::cout << "Transferred " << totalTransferred << "of " << length*2 << std::endl;
         /*if(err == LIBUSB_ERROR_TIMEOUT && transferred > 0)//a timeout may indicate that some data was transferred, but not all
          err = 0;*/
     }while (totalTransferred < length*2 && err >= 0); //TODO: Change 2 to bytes per sample.
     
     if (err < 0)
+    {
+        noteError(libUSBError(err));
+        throw libUSBError(err);
+    }
+    noteArrival(totalTransferred, now);
+    mSamplesRead += length;
+}
+
+int MCCDevice::readScanData(unsigned short* data, int length, unsigned int timeout)
+{
+    int err = 0, totalTransferred = 0, transferred;
+    unsigned char* dataAsByte = (unsigned char*)data;
+    double now = mccHostTime(), deadline = now + timeout / 1000.0;
+    
+    if (mStream)
+    {
+        totalTransferred = readStreamData(dataAsByte, length*2, timeout);
+        if (totalTransferred < length*2)
+            noteError(MCC_ERR_LIBUSB_TIMEOUT);
+        mSamplesRead += totalTransferred / 2;
+        return totalTransferred / 2;
+    }
+    
+    while (totalTransferred < length*2 && now < deadline)
+    {
+        err = readBulk(&dataAsByte[totalTransferred], length*2 - totalTransferred, mSamplesReceived + totalTransferred / 2,
+                       (unsigned int)std::max(1.0, (deadline - now) * 1000.0), &transferred);
+        totalTransferred += transferred;
+        now = mccHostTime();
+        if (err < 0)
+            break;
+    }
+    
+    if (err < 0 && err != LIBUSB_ERROR_TIMEOUT)
+    {
+        noteError(libUSBError(err));
         throw libUSBError(err);
+    }
+    if (totalTransferred < length*2)
+        noteError(MCC_ERR_LIBUSB_TIMEOUT);
+    if (totalTransferred > 0)
+        noteArrival(totalTransferred, now);
+    mSamplesRead += totalTransferred / 2;
+    return totalTransferred / 2;
+}
+
+//Copy up to length bytes out of the asynchronous stream, in order, waiting at most timeout ms.
+//Whatever is left of the last buffer is kept for the next call. Returns the bytes copied.
+int MCCDevice::readStreamData(unsigned char* dataAsByte, int length, unsigned int timeout)
+{
+    int totalTransferred = 0, chunk;
+    double deadline = mccHostTime() + timeout / 1000.0;
+    
+    while (totalTransferred < length)
+    {
+        //Once the time is up, nextStreamBuffer(0) still takes a buffer that has already arrived.
+        if (!mStreamHasBuffer && !nextStreamBuffer((unsigned int)std::max(0.0, (deadline - mccHostTime()) * 1000.0)))
+            break;
+        
+        chunk = std::min(length - totalTransferred, mStreamBuffer.length - mStreamOffset);
+        memcpy(&dataAsByte[totalTransferred], &mStreamBuffer.data[mStreamOffset], chunk);
+        totalTransferred += chunk;
+        mStreamOffset += chunk;
+        
+        if (mStreamOffset >= mStreamBuffer.length)
+        {
+            mStreamHasBuffer = false;
+            mStream->releaseBuffer(mStreamBuffer);
+        }
+    }
+    return totalTransferred;
+}
+
+int MCCDevice::pollScanData(unsigned short* data, int length)
+{
+    unsigned char* dataAsByte = (unsigned char*)data;
+    int totalTransferred = 0, chunk;
+    
+    if (!mStream)
+        throw MCC_ERR_NOT_STREAMING;
+    
+    length *= 2;
+    while (totalTransferred < length)
+    {
+        if (!mStreamHasBuffer && !nextStreamBuffer(0))
+            break;
+        
+        chunk = std::min(length - totalTransferred, mStreamBuffer.length - mStreamOffset);
+        memcpy(&dataAsByte[totalTransferred], &mStreamBuffer.data[mStreamOffset], chunk);
+        totalTransferred += chunk;
+        mStreamOffset += chunk;
+        
+        if (mStreamOffset >= mStreamBuffer.length)
+        {
+            mStreamHasBuffer = false;
+            mStream->releaseBuffer(mStreamBuffer);
+        }
+    }
+    mSamplesRead += totalTransferred / 2;
+    return totalTransferred / 2;
+}
+
+//Make the next completed transfer the current stream buffer, waiting up to timeout ms for it.
+//A timeout of 0 polls without handling libusb events. Returns false if no transfer completed.
+bool MCCDevice::nextStreamBuffer(unsigned int timeout)
+{
+    bool ok;
+    
+    try
+    {
+        ok = timeout > 0 ? mStream->waitBuffer(&mStreamBuffer, timeout) : mStream->pollBuffer(&mStreamBuffer);
+    }
+    catch(mcc_err err)
+    {
+        noteError(err);
+        throw err;
+    }
+    if (!ok)
+        return false;
+    
+    tapData(mStreamBuffer.data, mStreamBuffer.length, mSamplesReceived);
+    noteArrival(mStreamBuffer.length, mStreamBuffer.timestamp);
+    mStats.addTransfer(mStreamBuffer.length, mStream->transferSize(), mStreamBuffer.timestamp,
+                       mccHostTime() - mStreamBuffer.timestamp);
+    mStreamOffset = 0;
+    mStreamHasBuffer = true;
+    return true;
+}
+
+bool MCCDevice::acquireBuffer(MCCStreamBuffer* buffer, unsigned int timeout)
+{
+    unsigned long long first, end, start, stop;
+    
+    if (!mStream)
+        throw MCC_ERR_NOT_STREAMING;
+    
+    for (;;)
+    {
+        if (!mStreamHasBuffer && !nextStreamBuffer(timeout))
+            return false;
+        mStreamHasBuffer = false;
+        
+        //Stream samples [first, end) are left in this buffer: all of it, or what readScanData did not take.
+        //After a short transfer, or a partial read, they need not start or end on a scan boundary, so hand
+        //out only the whole scans among them and skip the partial ones at either end.
+        end = mSamplesReceived;
+        first = end - (mStreamBuffer.length - mStreamOffset) / 2;
+        start = mChannelCount > 0 ? (first + mChannelCount - 1) / mChannelCount * mChannelCount : first;
+        stop = mChannelCount > 0 ? end / mChannelCount * mChannelCount : end;
+        mSamplesRead += end - first;
+        if (stop > start)
+        {
+            //releaseBuffer only looks at index.
+            *buffer = mStreamBuffer;
+            buffer->data += mStreamOffset + (start - first) * 2;
+            buffer->length = (int)(stop - start) * 2;
+            mBuffersHeld++;
+            return true;
+        }
+        //Not even one whole scan: give it straight back and try the next.
+        mStream->releaseBuffer(mStreamBuffer);
+    }
+}
+
+void MCCDevice::releaseBuffer(const MCCStreamBuffer& buffer)
+{
+    if (!mStream || mBuffersHeld == 0)
+        return;
+    mBuffersHeld--;
+    mStream->releaseBuffer(buffer);
+}
+
+void MCCDevice::noteError(mcc_err err)
+{
+    switch(err)
+    {
+        case MCC_ERR_LIBUSB_TIMEOUT:
+            mStats.addTimeout();
+            break;
+        case MCC_ERR_PIPE:
+        case MCC_ERR_LIBUSB_TRANSFER_STALL:
+            mStats.addStall();
+            break;
+        default:
+            mStats.addError();
+            break;
+    }
+}
+
+void MCCDevice::tapData(const unsigned char* dataAsByte, int bytes, unsigned long long firstSample)
+{
+    if (bytes <= 0)
+        return;
+    //History first, so an event's scan is already in the ring when the event goes out.
+    if (mHistory)
+        mHistory->append((const unsigned short*)dataAsByte, bytes / 2, firstSample);
+    if (mTrigger)
+        mTrigger->process((const unsigned short*)dataAsByte, bytes / 2, firstSample);
+}
+
+void MCCDevice::noteArrival(int bytes, double hostTime)
+{
+    mSamplesReceived += bytes / 2;
+    //The point is the last complete scan that has arrived, and when it got here.
+    if (mChannelCount > 0 && mSamplesReceived >= (unsigned long long)mChannelCount)
+        mClock.addPoint((double)(mSamplesReceived / mChannelCount - 1), hostTime);
+}
+
+//Ask for as many whole packets as fit in what is left to read, up to the planned transfer size:
+//one transfer per packet costs a syscall per 32 samples on a full-speed device. A short packet
+//ends a transfer early, so asking for more than has arrived never waits for the rest.
+int MCCDevice::readChunkSize(int remaining) const
+{
+    int chunk = remaining - remaining % bulkPacketSize;
+    int limit = mHasTransferPolicy ? mTransferPlan.transferSize : mTransferPolicy.maxTransferSize();
+    
+    limit = std::max((int)bulkPacketSize, limit - limit % bulkPacketSize);
+    if (chunk <= 0)
+        return bulkPacketSize;
+    return std::min(chunk, limit);
+}
+
+//One synchronous bulk transfer of up to length bytes, sized by readChunkSize, fed to tapData and
+//mStats. The device may fill a whole packet, so a read shorter than one goes through mPacket, and
+//what does not fit is handed out by the next call before anything new is read. Returns the libusb status.
+int MCCDevice::readBulk(unsigned char* dataAsByte, int length, unsigned long long firstSample, unsigned int timeout, int* transferred)
+{
+    int err, chunk, received = 0;
+    unsigned char* buffer = dataAsByte;
+    
+    if (mPacketOffset < mPacketLength)
+    {
+        //Already tapped and in mStats from when its packet arrived.
+        *transferred = std::min(length, mPacketLength - mPacketOffset);
+        memcpy(dataAsByte, &mPacket[mPacketOffset], *transferred);
+        mPacketOffset += *transferred;
+        return 0;
+    }
+    
+    chunk = readChunkSize(length);
+    if (chunk > length)
+    {
+        mPacket.resize(chunk);
+        buffer = mPacket.data();
+    }
+    double start = mccHostTime();
+    err = mTransport->bulkTransfer(endpoint_in, buffer, chunk, &received, timeout);
+    double now = mccHostTime();
+    tapData(buffer, received, firstSample);
+    if (received > 0)
+        mStats.addTransfer(received, chunk, now, now - start);
+    
+    *transferred = std::min(length, received);
+    if (buffer == mPacket.data())
+    {
+        memcpy(dataAsByte, buffer, *transferred);
+        mPacketOffset = *transferred;
+        mPacketLength = received;
+    }
+    return err;
 }
 
 void MCCDevice::getBlock()
 {
+    mBlockScan = getScanCount();
     readScanData(mData, mSamplesPerBlock*mChannelCount);
 }
 
+void MCCDevice::startStream(int numTransfers, int transferSize, bool pinned)
+{
+    int step;
+    
+    stopStream();
+    //The rest of the last synchronous packet would belong before the stream's data. It is dropped,
+    //but still counted, so the samples that follow keep their numbers.
+    mSamplesReceived += (mPacketLength - mPacketOffset) / 2;
+    mPacketOffset = mPacketLength = 0;
+    
+    if (numTransfers <= 0)
+        numTransfers = mHasTransferPolicy ? mTransferPlan.numTransfers : 8;
+    if (transferSize <= 0 && mHasTransferPolicy)
+    {
+        //Already whole packets and whole scans.
+        transferSize = mTransferPlan.transferSize;
+    }
+    else if (transferSize <= 0)
+    {
+        //One block per transfer, rounded up to a whole number of packets so the device never overflows it.
+        //Zero-copy buffers are used in place, so they must also hold whole scans: round to lcm(packet, scan).
+        step = pinned ? MCCTransferPolicy::packetAndScanSize(bulkPacketSize, mChannelCount*2) : bulkPacketSize;
+        transferSize = mSamplesPerBlock*mChannelCount*2;
+        transferSize = ((transferSize + step - 1) / step) * step;
+    }
+    else if (transferSize % bulkPacketSize != 0)
+    {
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+    }
+    
+    mStream = mTransport->createBulkStream(endpoint_in, transferSize, numTransfers, pinned);
+    try
+    {
+        mStream->start();
+    }
+    catch(mcc_err err)
+    {
+        delete mStream;
+        mStream = nullptr;
+        throw err;
+    }
+}
+
+void MCCDevice::stopStream()
+{
+    if (!mStream)
+        return;
+    if (mBuffersHeld > 0)
+        throw MCC_ERR_BUFFERS_HELD; //Freeing them now would pull the memory out from under the caller.
+    
+    delete mStream; //Cancels outstanding transfers.
+    mStream = nullptr;
+    mStreamHasBuffer = false;
+    mStreamOffset = 0;
+}
+
+void MCCDevice::resetStream()
+{
+    if (!mStream)
+        return;
+    if (mBuffersHeld > 0)
+        throw MCC_ERR_BUFFERS_HELD;
+    
+    if (mStreamHasBuffer)
+        mStream->releaseBuffer(mStreamBuffer);
+    mStreamHasBuffer = false;
+    mStreamOffset = 0;
+    mStream->stop(); //Completed transfers that were never read are dropped too.
+    mStream->start();
+}
+
 /*
  void MCCDevice::getLimits()
  {
@@ -478,66 +1079,135 @@ void MCCDevice::getBlock()
  }
  */
 
-void MCCDevice::reconfigure()
+void MCCDevice::setTransferPolicy(const MCCTransferPolicy& policy)
+{
+    mTransferPolicy = policy;
+    mHasTransferPolicy = true;
+    planTransfers();
+    delete [] mData;
+    mData = new unsigned short [mChannelCount * mSamplesPerBlock];
+}
+
+void MCCDevice::clearTransferPolicy()
+{
+    mTransferPolicy = MCCTransferPolicy();
+    mHasTransferPolicy = false;
+}
+
+void MCCDevice::planTransfers()
+{
+    mTransferPlan = mTransferPolicy.plan(sampRate, mChannelCount, bulkPacketSize);
+    mSamplesPerBlock = mTransferPlan.samplesPerBlock;
+}
+
+void MCCDevice::reconfigure(bool forceRefresh)
 {
     int lowChan, highChan;
-    std::string respLow, respHigh, respOff, respSlope, respRange, respRate;
-    std::stringstream strOff, strSlope, strRange;
-    respLow = sendMessage("?AISCAN:LOWCHAN");
-    lowChan = fromString<int>(respLow.erase(0, 15));
-    respHigh = sendMessage("?AISCAN:HIGHCHAN");
-    highChan = fromString<int>(respHigh.erase(0, 16));
+    MCCResponse response;
+    MCCCalibrationEntry cached;
+    lowChan = queryInt(MCCCommand::query("AISCAN:LOWCHAN"));
+    highChan = queryInt(MCCCommand::query("AISCAN:HIGHCHAN"));
+    mLowChan = lowChan;
     mChannelCount = highChan - lowChan + 1;
-    respRate = sendMessage("?AISCAN:RATE");
-    sampRate = fromString<float>(respRate.erase(0, 12));
+    sampRate = (float)queryDouble(MCCCommand::query("AISCAN:RATE"));
+    mClock.setNominalRate(sampRate);
+    mConfigGeneration++;
+    if (mHasTransferPolicy)
+        planTransfers();
     delete [] mData;
     mData = new unsigned short [mChannelCount * mSamplesPerBlock];
     
-    //stringstream strBuff;
-    //strBuff << "AISCAN:BUFSIZE=" << mChannelCount*mSamplesPerBlock*2;
-    //sendMessage(strBuff.str());
-    //sendMessage("AISCAN:BUFOVERWRITE=DISABLE");
+    //The device buffer (AISCAN:BUFSIZE, AISCAN:BUFOVERWRITE) is set up by MCCScanController (mccscan.h).
     
     //Reset members that are per-channel arrays.
-    calSlope = nullptr; calSlope = new float[mChannelCount];
-    calOffset = nullptr; calOffset = new float[mChannelCount];
-    minVoltage = nullptr; minVoltage = new int[mChannelCount];
-    maxVoltage = nullptr; maxVoltage = new int[mChannelCount];
-    
-    for (int chanIdx = lowChan; chanIdx<=highChan; chanIdx++)
-    {
-        //Reset string streams.
-        strOff.str("");
-        strSlope.str("");
-        strRange.str("");
-        //strSlope = string("?AI{") + "}:SLOPE";
-        strSlope << "?AI{" << chanIdx << "}:SLOPE";
-        respSlope = sendMessage(strSlope.str());
-        calSlope[chanIdx - lowChan] = fromString<float>(respSlope.erase(0,12));
-        
-        strOff << "?AI{" << chanIdx << "}:OFFSET";
-        respOff = sendMessage(strOff.str());
-        calOffset[chanIdx - lowChan] = fromString<float>(respOff.erase(0,13));
-        //        calOffset[chanIdx-lowChan] = atof(respSlope.erase(0, 13).c_str());
-        
-        strRange << "?AI{" << chanIdx << "}:RANGE";
-        respRange = sendMessage(strRange.str());
-        respRange = respRange.erase(0, 12);
-        if (respRange == "BIP10V"){
-            minVoltage[chanIdx - lowChan] = -10;
-            maxVoltage[chanIdx - lowChan] = 10;
-        }else if (respRange == "BIP5V"){
-            minVoltage[chanIdx - lowChan] = -5;
-            maxVoltage[chanIdx - lowChan] = 5;
-        }else if (respRange == "BIP2V"){
-            minVoltage[chanIdx - lowChan] = -2;
-            maxVoltage[chanIdx - lowChan] = 2;
-        }else if (respRange == "BIP1V"){
-            minVoltage[chanIdx - lowChan] = -1;
-            maxVoltage[chanIdx - lowChan] = 1;
+    delete [] calSlope; calSlope = new float[mChannelCount];
+    delete [] calOffset; calOffset = new float[mChannelCount];
+    delete [] minVoltage; minVoltage = new int[mChannelCount];
+    delete [] maxVoltage; maxVoltage = new int[mChannelCount];
+    
+    //Same device and channel range as last time: reuse the cached calibration, as long as the device
+    //still has the range it was stored with. A power cycle, or another program, may have changed it.
+    bool useCache = !forceRefresh && !mSerialNumber.empty()
+        && MCCCalibrationCache::instance().lookup(mSerialNumber, lowChan, highChan, &cached);
+    if (useCache)
+    {
+        int minV, maxV;
+        const char* range = queryValue(MCCCommand::query("AI", lowChan, "RANGE"), &response);
+        useCache = parseRange(range, &minV, &maxV)
+            && minV == cached.channels[0].minVoltage && maxV == cached.channels[0].maxVoltage;
+    }
+    
+    if (useCache)
+    {
+        for (int i = 0; i < mChannelCount; i++)
+        {
+            calSlope[i] = cached.channels[i].slope;
+            calOffset[i] = cached.channels[i].offset;
+            minVoltage[i] = cached.channels[i].minVoltage;
+            maxVoltage[i] = cached.channels[i].maxVoltage;
         }
-        //cout << "Channel " << chanIdx << " Slope: " << calSlope[chanIdx-lowChan] << " Offset: " << calOffset[chanIdx-lowChan] << " in Range " << minVoltage[chanIdx-lowChan] << ":" << maxVoltage[chanIdx-lowChan] << "\n\n";
     }
+    else
+    {
+        for (int chanIdx = lowChan; chanIdx<=highChan; chanIdx++)
+        {
+            int i = chanIdx - lowChan;
+            calSlope[i] = (float)queryDouble(MCCCommand::query("AI", chanIdx, "SLOPE"));
+            calOffset[i] = (float)queryDouble(MCCCommand::query("AI", chanIdx, "OFFSET"));
+            
+            const char* range = queryValue(MCCCommand::query("AI", chanIdx, "RANGE"), &response);
+            parseRange(range, &minVoltage[i], &maxVoltage[i]);
+        }
+    }
+    
+    mConverter.setCalibration(mChannelCount, calSlope, calOffset, minVoltage, maxVoltage, maxCounts);
+    mChannelStats.configure(mConverter, maxCounts, mChannelStats.windowScans());
+    if (mTrigger)
+        mTrigger->setCalibration(mConverter);
+    if (mHistory)
+        mHistory->setCalibration(mConverter);
+    
+    if (!useCache && !mSerialNumber.empty())
+        MCCCalibrationCache::instance().store(mSerialNumber, getCalibration());
+}
+
+//Voltage limits of an AI{n}:RANGE value. Returns false, leaving them as they were, for a range this driver does not know.
+bool MCCDevice::parseRange(const char* range, int* minVoltage, int* maxVoltage)
+{
+    if (!range)
+        return false;
+    if (strcmp(range, "BIP10V") == 0){
+        *minVoltage = -10;
+        *maxVoltage = 10;
+    }else if (strcmp(range, "BIP5V") == 0){
+        *minVoltage = -5;
+        *maxVoltage = 5;
+    }else if (strcmp(range, "BIP2V") == 0){
+        *minVoltage = -2;
+        *maxVoltage = 2;
+    }else if (strcmp(range, "BIP1V") == 0){
+        *minVoltage = -1;
+        *maxVoltage = 1;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+MCCCalibrationEntry MCCDevice::getCalibration() const
+{
+    MCCCalibrationEntry entry;
+    entry.lowChan = mLowChan;
+    entry.highChan = mLowChan + mChannelCount - 1;
+    entry.channels.resize(mChannelCount);
+    for (int i = 0; i < mChannelCount; i++)
+    {
+        entry.channels[i].slope = calSlope[i];
+        entry.channels[i].offset = calOffset[i];
+        entry.channels[i].minVoltage = minVoltage[i];
+        entry.channels[i].maxVoltage = maxVoltage[i];
+    }
+    return entry;
 }
 
 //scale and calibrate data
@@ -555,23 +1225,50 @@ float MCCDevice::scaleAndCalibrateData(unsigned short data, int chanIdx){
     return scaledAndCalibratedData;
 }
 
+void MCCDevice::scaleAndCalibrateBlock(const unsigned short* data, float* out, int length) const
+{
+    mConverter.convert(data, out, length, MCC_LAYOUT_INTERLEAVED, &mChannelStats);
+}
+
+void MCCDevice::scaleAndCalibrateBlock(float* out) const
+{
+    mConverter.convert(mData, out, mSamplesPerBlock*mChannelCount, MCC_LAYOUT_INTERLEAVED, &mChannelStats);
+}
+
+void MCCDevice::scaleAndCalibrateBlock(float* out, MCCLayout layout) const
+{
+    mConverter.convert(mData, out, mSamplesPerBlock*mChannelCount, layout, &mChannelStats);
+}
+
+void MCCDevice::scaleAndCalibrateBlockMicrovolts(int32_t* out, MCCLayout layout) const
+{
+    mConverter.convertMicrovolts(mData, out, mSamplesPerBlock*mChannelCount, layout, &mChannelStats);
+}
+
+void MCCDevice::setChannelStatsWindow(int windowScans)
+{
+    mChannelStats.configure(mConverter, maxCounts, windowScans);
+}
+
 void MCCDevice::flushInputData()
 {
     int bytesTransfered = 0;
     int status;
     unsigned char * buf = new unsigned char [bulkPacketSize];
+    mPacketOffset = mPacketLength = 0;
     do
     {
-        status = libusb_bulk_transfer(dev_handle, endpoint_in, buf, bulkPacketSize, &bytesTransfered, 200);
+        status = mTransport->bulkTransfer(endpoint_in, buf, bulkPacketSize, &bytesTransfered, 200);
     } while (bytesTransfered > 0 && status == 0);
     delete[] buf;
 }
 
 uint8_t MCCDevice::getDIOTristate()
 {
+    std::unique_lock<std::mutex> lock = lockControl();
     uint8_t requesttype = (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
     uint8_t data = 0x0;
-    int res = libusb_control_transfer(dev_handle, requesttype, DTRISTATE,
+    int res = mTransport->controlTransfer(requesttype, DTRISTATE,
                                       0x0, 0x0, (unsigned char *) &data,
                                       sizeof(data), HS_DELAY);
     if (res < 0)
@@ -583,8 +1280,9 @@ uint8_t MCCDevice::getDIOTristate()
 
 void MCCDevice::setDIOTristate(uint8_t chanMask)
 {
+    std::unique_lock<std::mutex> lock = lockControl();
     uint8_t requesttype = (LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
-    int res = libusb_control_transfer(dev_handle, requesttype, DTRISTATE,
+    int res = mTransport->controlTransfer(requesttype, DTRISTATE,
                                       chanMask, 0x0, NULL, 0x0, HS_DELAY);
     if (res < 0)
     {
@@ -594,9 +1292,10 @@ void MCCDevice::setDIOTristate(uint8_t chanMask)
 
 uint8_t MCCDevice::getDIOPort()
 {
+    std::unique_lock<std::mutex> lock = lockControl();
     uint8_t requesttype = (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
     uint8_t data;
-    int res = libusb_control_transfer(dev_handle, requesttype, DPORT,
+    int res = mTransport->controlTransfer(requesttype, DPORT,
                                       0x0, 0x0, (unsigned char *) &data,
                                       sizeof(data), HS_DELAY);
     if (res < 0)
@@ -608,9 +1307,10 @@ uint8_t MCCDevice::getDIOPort()
 
 uint8_t MCCDevice::getDIOLatch()
 {
+    std::unique_lock<std::mutex> lock = lockControl();
     uint8_t requesttype = (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
     uint8_t data;
-    int res = libusb_control_transfer(dev_handle, requesttype, DLATCH,
+    int res = mTransport->controlTransfer(requesttype, DLATCH,
                                       0x0, 0x0, (unsigned char *) &data,
                                       sizeof(data), HS_DELAY);
     if (res < 0)
@@ -622,8 +1322,9 @@ uint8_t MCCDevice::getDIOLatch()
 
 void MCCDevice::setDIOLatch(uint8_t value)
 {
+    std::unique_lock<std::mutex> lock = lockControl();
     uint8_t requesttype = (LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE);
-    int res = libusb_control_transfer(dev_handle, requesttype, DLATCH, value,
+    int res = mTransport->controlTransfer(requesttype, DLATCH, value,
                                       0x0, NULL, 0x0, HS_DELAY);
     if (res < 0)
     {
@@ -19,6 +19,20 @@
 #include <string>
 #include <sstream>
 #include <exception>
+#include <vector>
+#include <mutex>
+#include "mccerror.h"
+#include "mccstream.h"
+#include "mcccommand.h"
+#include "mccconvert.h"
+#include "mccchanstats.h"
+#include "mcctrigger.h"
+#include "mcchistory.h"
+#include "mcctransport.h"
+#include "mcccalcache.h"
+#include "mccclock.h"
+#include "mccstats.h"
+#include "mcctransfer.h"
 
 /*
  #ifdef _MSC_VER
@@ -56,45 +70,40 @@
 #define FIRSTHALF true
 #define SECONDHALF false
 
-/////////////
-//Error Codes
-/////////////
-enum mcc_err{
-    MCC_ERR_NO_DEVICE,
-    MCC_ERR_INVALID_ID,
-    MCC_ERR_USB_INIT,
-    MCC_ERR_PIPE,
-    MCC_ERR_LIBUSB_TIMEOUT,
-    MCC_ERR_TRANSFER_FAILED,
-    MCC_ERR_LIBUSB_TRANSFER_STALL,
-    MCC_ERR_LIBUSB_TRANSFER_OVERFLOW,
-    MCC_ERR_UNKNOWN_LIB_USB_ERR,
-    MCC_ERR_INVALID_BUFFER_SIZE,
-    MCC_ERR_CANT_OPEN_FPGA_FILE,
-    MCC_ERR_FPGA_UPLOAD_FAILED,
-    MCC_ERR_ACCESS,
-};
-
 
 //////////////////
 //Static functions
 //////////////////
 
 //Convert a libusb error code into an mcc_err
-static mcc_err libUSBError(int err);
+mcc_err libUSBError(int err);
+
+//Convert the status of a completed asynchronous libusb_transfer into an mcc_err
+mcc_err libUSBTransferError(int status);
 
 //Convert an mcc_err int to a human readable string
-static std::string errorString(int err);
+std::string errorString(int err);
 
-static std::string toNameString(int idProduct);
+std::string toNameString(int idProduct);
 
 //Is the specified product ID is an MCC product ID? Called when initializing.
-static bool isMCCProduct(int idProduct);
+bool isMCCProduct(int idProduct);
 
 /////////
 //Classes
 /////////
 
+//An attached MCC device, as reported by MCCDevice::listDevices.
+struct MCCDeviceInfo
+{
+    int idProduct;
+    std::string name;           //toNameString(idProduct)
+    std::string serialNumber;   //USB serial number string descriptor; empty if it could not be read.
+    int bus;
+    int port;
+    int address;
+};
+
 class intTransferInfo
 {
 public:
@@ -118,41 +127,170 @@ class MCCDevice
 public:
     MCCDevice(int idProduct);
     MCCDevice(int idProduct, std::string mfgSerialNumber);
+    MCCDevice(int idProduct, std::string mfgSerialNumber, libusb_context* ctx); //Shares the caller's libusb context.
+    MCCDevice(int idProduct, MCCTransport* transport); //Takes ownership of transport.
     ~MCCDevice();
     
+    //List attached MCC devices from their USB descriptors only: no interface is claimed and
+    //no DAQFlex message is sent, so devices in use by other processes are listed too.
+    static std::vector<MCCDeviceInfo> listDevices();
+    
     std::string sendMessage(std::string message);
+    //Typed DAQFlex messages (see mcccommand.h). Nothing is allocated, and the reply must echo the
+    //command or MCC_ERR_BAD_RESPONSE is thrown, e.g. queryDouble(MCCCommand::query("AI", 10, "SLOPE")).
+    void transact(const MCCCommand& command, MCCResponse* response); //Does not check the reply.
+    void execute(const MCCCommand& command);
+    int queryInt(const MCCCommand& query);
+    double queryDouble(const MCCCommand& query);
+    const char* queryValue(const MCCCommand& query, MCCResponse* response); //Points into response.
+    //Queue a message instead (see mcccontrol.h): a batch goes out back to back, and the reply comes
+    //back as a future or callback. The queue and its thread are created on the first of these calls.
+    //The calls above and the DIO calls stay immediate; they wait until the queue is idle and keep
+    //anything new from being queued while they run, so the two never interleave. A queued callback
+    //must therefore not call this device's control methods.
+    std::future<MCCResponse> submit(const MCCCommand& command);
+    void submit(const MCCCommand& command, MCCControlCallback callback);
+    std::future<uint8_t> getDIOPortAsync();
+    void getDIOPortAsync(MCCControlCallback callback);
+    MCCControlQueue& getControlQueue(); //Anything queued on it directly is not kept apart from the immediate calls.
     void flushInputData();
     void readScanData(unsigned short* data, int length);//, int rate);
+    //Read up to length samples, waiting at most timeout ms in all. Returns the number read, which is
+    //less than length only if the timeout expired; nothing is lost, the next read continues from there.
+    int readScanData(unsigned short* data, int length, unsigned int timeout);
     void getBlock();
-    void reconfigure(); //Called during initialization, should be called again after any settings are changed.
+    //Keep numTransfers asynchronous bulk transfers queued on endpoint_in. readScanData and getBlock
+    //read from the stream until stopStream(). transferSize is in bytes; 0 takes the transfer plan's,
+    //or without a policy one block rounded up to bulkPacketSize. numTransfers 0 takes the plan's, or 8.
+    //pinned allocates the transfer buffers for zero-copy use with acquireBuffer (see MCCBufferMemory);
+    //a default transferSize is then also rounded to whole scans, so every buffer starts at channel 0.
+    void startStream(int numTransfers = 0, int transferSize = 0, bool pinned = false);
+    //Frees the transfer buffers, so it throws MCC_ERR_BUFFERS_HELD while any acquireBuffer buffer has
+    //not been released; resetStream and startStream, which stop the stream first, do too.
+    void stopStream();
+    //Cancel and resubmit every stream transfer and drop the partly read buffer, so nothing received
+    //before (e.g. from a scan that has since been restarted) is returned.
+    void resetStream();
+    bool isStreaming() const { return mStream != nullptr; }
+    //Copy up to length samples that have already arrived on the stream, without waiting or handling
+    //libusb events (whoever owns the libusb context does that). Returns the number of samples copied.
+    int pollScanData(unsigned short* data, int length);
+    //Zero-copy reads: hand out the next completed transfer buffer itself instead of copying from it.
+    //The samples are buffer->data as unsigned short, buffer->length bytes. The buffer's transfer is
+    //not resubmitted until releaseBuffer, so hold fewer buffers than numTransfers at a time.
+    //Every buffer handed out starts at channel 0 and holds whole scans: if a short transfer or a
+    //partial readScanData left a scan split across buffers, that scan is skipped. getScanCount() is
+    //then the scan after the buffer's last, so a skipped scan shows up as a gap.
+    //timeout is in ms; 0 only polls and never handles libusb events. Returns false on timeout.
+    bool acquireBuffer(MCCStreamBuffer* buffer, unsigned int timeout = 2000);
+    void releaseBuffer(const MCCStreamBuffer& buffer);
+    MCCBufferMemory getStreamMemory() const { return mStream ? mStream->memory() : MCC_MEMORY_HEAP; }
+    //Called during initialization, should be called again after any settings are changed.
+    //Per-channel calibration comes from MCCCalibrationCache when the channel range is unchanged;
+    //forceRefresh always queries the device and refreshes the cache.
+    void reconfigure(bool forceRefresh = false);
+    //Size blocks and transfers from a latency target (see mcctransfer.h) instead of by hand. The plan
+    //is made now and again by every reconfigure(): mSamplesPerBlock becomes one transfer's worth of
+    //scans, and readScanData and a default startStream() use its transfer size. A running stream
+    //keeps its transfers until it is started again.
+    void setTransferPolicy(const MCCTransferPolicy& policy);
+    void clearTransferPolicy(); //Back to mSamplesPerBlock as set by hand.
+    bool hasTransferPolicy() const { return mHasTransferPolicy; }
+    const MCCTransferPlan& getTransferPlan() const { return mTransferPlan; } //Valid while a policy is set.
     float scaleAndCalibrateData(unsigned short data, int chanIdx);
+    //Convert a block of interleaved samples (length samples, starting at the first channel) to volts in one pass.
+    void scaleAndCalibrateBlock(const unsigned short* data, float* out, int length) const;
+    void scaleAndCalibrateBlock(float* out) const; //Converts mData.
+    //Convert mData straight into a caller-owned buffer in the requested layout (see mccconvert.h).
+    void scaleAndCalibrateBlock(float* out, MCCLayout layout) const;
+    void scaleAndCalibrateBlockMicrovolts(int32_t* out, MCCLayout layout = MCC_LAYOUT_INTERLEAVED) const;
+    const MCCConverter& getConverter() const { return mConverter; }
+    //Per-channel min, max, mean, RMS and clipping over windows of windowScans scans (see mccchanstats.h),
+    //gathered by the scaleAndCalibrateBlock calls in the same pass as the conversion, which then take
+    //whole scans only. 0 (the default) turns it off. Follows reconfigure(); read it from any thread.
+    void setChannelStatsWindow(int windowScans);
+    const MCCChannelStats& getChannelStats() const { return mChannelStats; }
+    //Scan every transfer for threshold crossings as it arrives (see mcctrigger.h), in the thread
+    //reading the data. The engine is not owned; NULL detaches it. reconfigure() updates its
+    //thresholds and AISCAN:START re-arms it.
+    void setTriggerEngine(MCCTriggerEngine* engine) { mTrigger = engine; }
+    //Append every transfer to a pre-trigger history ring as it arrives (see mcchistory.h), before
+    //the trigger engine sees it. Not owned; NULL detaches it. reconfigure() updates its calibration.
+    void setHistoryRing(MCCHistoryRing* history) { mHistory = history; }
     //static short calData(unsigned short data, int slope, int offset);//?
     uint8_t getDIOTristate();
     void setDIOTristate(uint8_t chanMask);
     uint8_t getDIOPort();
     uint8_t getDIOLatch();
     void setDIOLatch(uint8_t value);
+    int getChannelCount() const { return mChannelCount; }
+    std::string getSerialNumber() const { return mSerialNumber; }
+    int getProductId() const { return idProduct; }
+    unsigned short getMaxCounts() const { return maxCounts; }
+    //Channel range and per-channel calibration found by the last reconfigure().
+    MCCCalibrationEntry getCalibration() const;
+    unsigned int getConfigGeneration() const { return mConfigGeneration; } //Counts reconfigure() calls.
+    //Host timing. Each arriving transfer is stamped with mccHostTime() and fed to a clock estimator
+    //that maps scan index to host time (see mccclock.h). Counts restart at AISCAN:START.
+    unsigned long long getScanCount() const { return mChannelCount > 0 ? mSamplesRead / mChannelCount : 0; } //Scans read so far.
+    double getBlockTimestamp() const { return mClock.timeOf((double)mBlockScan); } //Host time of the first scan in mData.
+    double getScanTimestamp(unsigned long long scan) const { return mClock.timeOf((double)scan); }
+    MCCClockEstimator& getClock() { return mClock; }
+    unsigned long long getSamplesReceived() const { return mSamplesReceived; } //Arrived from the device since AISCAN:START.
+    //Transfer counters and latency histograms (see mccstats.h). Safe to read from any thread at any time.
+    MCCStats& getStats() { return mStats; }
     
     float sampRate;
-    unsigned short* mData;
+    unsigned short* mData = nullptr;
     int mSamplesPerBlock;
     
 private:
     //variables set during class instantiation
     int idProduct;
-    libusb_device ** list; //This is a member variable because it is used during destruction too.
-    libusb_device_handle* dev_handle;
+    std::string mSerialNumber; //DEV:MFGSER, keys MCCCalibrationCache.
+    libusb_device ** list = nullptr; //This is a member variable because it is used during destruction too.
+    libusb_context* mContext = NULL; //NULL (the default context) unless shared through the constructor.
+    bool mOwnsContext = false; //True if this object called libusb_init and must call libusb_exit.
+    MCCTransport* mTransport = nullptr; //All control and bulk transfers go through this.
+    MCCControlQueue* mControl = nullptr; //Created by the first submit or getDIOPortAsync.
+    std::mutex mControlMutex; //Held while an immediate transfer runs or a request is queued.
     unsigned short maxCounts;
     //Variables set by getScanParams (libusb_control_transfer of LIBUSB_REQUEST_GET_DESCRIPTOR)
     unsigned char endpoint_in;
     unsigned char endpoint_out;
     unsigned short bulkPacketSize;
     //Variables set by reconfigure
-    float *calSlope;
-    float *calOffset;
-    int *minVoltage;
-    int *maxVoltage;
+    float *calSlope = nullptr;
+    float *calOffset = nullptr;
+    int *minVoltage = nullptr;
+    int *maxVoltage = nullptr;
+    int mLowChan;
     int mChannelCount;
+    MCCConverter mConverter; //Per-channel gain and offset folded from the above.
+    mutable MCCChannelStats mChannelStats; //Fed by the (const) block conversions.
+    MCCTriggerEngine* mTrigger = nullptr; //Set by setTriggerEngine, fed by every transfer.
+    MCCHistoryRing* mHistory = nullptr; //Set by setHistoryRing, fed by every transfer.
+    unsigned int mConfigGeneration;
+    //Transfer sizing, set by setTransferPolicy and redone by reconfigure
+    MCCTransferPolicy mTransferPolicy;
+    MCCTransferPlan mTransferPlan;
+    bool mHasTransferPolicy;
+    //Asynchronous streaming, set by startStream
+    MCCBulkStream* mStream = nullptr;
+    MCCStreamBuffer mStreamBuffer; //Partially consumed buffer carried over between readScanData calls.
+    int mStreamOffset = 0;
+    bool mStreamHasBuffer = false;
+    int mBuffersHeld = 0; //Handed out by acquireBuffer and not yet released.
+    //Last packet of a synchronous read that did not fit the caller's buffer; [mPacketOffset, mPacketLength) is still to be read.
+    std::vector<unsigned char> mPacket;
+    int mPacketOffset = 0;
+    int mPacketLength = 0;
+    //Host timing, restarted by AISCAN:START
+    MCCClockEstimator mClock;
+    unsigned long long mSamplesReceived = 0; //Samples that have arrived from the device.
+    unsigned long long mSamplesRead = 0; //Samples handed to the caller.
+    unsigned long long mBlockScan = 0; //Index of the first scan in mData.
+    MCCStats mStats;
     
     /*
      struct limit {
@@ -168,10 +306,28 @@ private:
     
     // Methods
     void initDevice(int idProduct, std::string mfgSerialNumber);//Called by constructors.
+    void initBuffers(int idProduct);//Called by constructors once mTransport is open.
+    void releaseDevice();//Called by the destructor and by constructors that throw.
     void getScanParams(); //Called during initialization. sets endpoint_in, endpoint_out, bulkPacketSize
     //void getLimits(); //Called during initialization. Gets chan range, scan rate, etc.
-    void sendControlTransferString(std::string message);//Called by sendMessage
-    std::string getControlTransferString();//Called by sendMessage
+    void sendControlTransferString(const MCCCommand& command);//Called by transact
+    void getControlTransferString(MCCResponse* response);//Called by transact
+    static bool isCalibrationSetting(const char* message);//Called by noteCommand
+    void noteCommand(const MCCCommand& command);
+    std::unique_lock<std::mutex> lockControl(); //Called by transact and the DIO calls
+    MCCControlQueue& controlQueue(); //With mControlMutex held
+    static int replyInt(const MCCCommand& query, const MCCResponse& response);
+    static double replyDouble(const MCCCommand& query, const MCCResponse& response);
+    static bool parseRange(const char* range, int* minVoltage, int* maxVoltage);//Called by reconfigure
+    static std::string getDescriptorSerial(libusb_device* device, libusb_device_handle* dev_handle);//Called by listDevices, initDevice
+    int readStreamData(unsigned char* dataAsByte, int length, unsigned int timeout);//Called by readScanData when streaming
+    bool nextStreamBuffer(unsigned int timeout);//Called by readStreamData, pollScanData, acquireBuffer
+    void noteArrival(int bytes, double hostTime);//Called whenever scan data arrives. Feeds mClock.
+    void noteError(mcc_err err);//Counts a failed transfer in mStats.
+    void tapData(const unsigned char* dataAsByte, int bytes, unsigned long long firstSample);//Feeds newly arrived data to mHistory and mTrigger.
+    void planTransfers();//Called by setTransferPolicy, reconfigure. Sets mTransferPlan and mSamplesPerBlock.
+    int readChunkSize(int remaining) const;//Bytes readScanData asks one bulk transfer for.
+    int readBulk(unsigned char* dataAsByte, int length, unsigned long long firstSample, unsigned int timeout, int* transferred);//Called by readScanData
     
     //static unsigned int getNumRanges();//?
     
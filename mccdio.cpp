@@ -0,0 +1,147 @@
+//
+//  mccdio.cpp
+//
+
+#include <chrono>
+#include "mccdio.h"
+#include "mccclock.h"
+
+MCCDIOMonitor::MCCDIOMonitor(MCCDevice& device, double rate, uint8_t mask, size_t capacity)
+:   mDevice(device), mPeriod(1.0 / rate), mMask(mask), mEvents(capacity),
+    mHaveValue(false), mLast(0), mLastTime(0), mValue(0), mPolls(0), mMissed(0), mDropped(0),
+    mError(-1), mRunning(false), mOutstanding(false), mStopRequested(false)
+{
+    if (rate <= 0 || capacity == 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+}
+
+MCCDIOMonitor::~MCCDIOMonitor()
+{
+    stop();
+}
+
+void MCCDIOMonitor::start()
+{
+    if (mThread.joinable())
+        return;
+    mStopRequested = false;
+    mHaveValue = false;     //The first read sets the levels edges are measured from.
+    mError = -1;
+    mRunning = true;
+    mThread = std::thread(&MCCDIOMonitor::run, this);
+}
+
+void MCCDIOMonitor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopRequested = true;
+    }
+    mTickCond.notify_one();
+    if (mThread.joinable())
+        mThread.join();
+
+    //The completion callback refers to this object.
+    std::unique_lock<std::mutex> lock(mMutex);
+    mReadCond.wait(lock, [this]{ return !mOutstanding; });
+}
+
+void MCCDIOMonitor::run()
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(mPeriod));
+    Clock::time_point next = Clock::now();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mStopRequested && mError.load() < 0)
+    {
+        if (mOutstanding)
+        {
+            mMissed.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            mOutstanding = true;
+            lock.unlock();
+            mDevice.getDIOPortAsync([this](const MCCControlResult& result){ completed(result); });
+            lock.lock();
+        }
+
+        //Sleep to the next tick. After a stall, start again from now rather than catch up in a burst.
+        next += period;
+        Clock::time_point now = Clock::now();
+        if (next < now)
+            next = now;
+        mTickCond.wait_until(lock, next, [this]{ return mStopRequested || mError.load() >= 0; });
+    }
+    lock.unlock();
+
+    {
+        std::lock_guard<std::mutex> waitLock(mWaitMutex);
+        mRunning = false;
+    }
+    mWaitCond.notify_all();
+}
+
+void MCCDIOMonitor::completed(const MCCControlResult& result)
+{
+    double now = mccHostTime();
+
+    if (result.error >= 0)
+    {
+        mError = result.error;
+        mTickCond.notify_one();
+    }
+    else
+    {
+        mPolls.fetch_add(1, std::memory_order_relaxed);
+        mValue.store(result.value, std::memory_order_relaxed);
+        uint8_t changed = (uint8_t)((result.value ^ mLast) & mMask);
+        if (mHaveValue && changed)
+        {
+            MCCDIOEvent event;
+            event.time = now;
+            event.window = now - mLastTime;
+            event.value = result.value;
+            event.rising = changed & result.value;
+            event.falling = changed & mLast;
+            if (mEvents.push(event))
+            {
+                {
+                    std::lock_guard<std::mutex> waitLock(mWaitMutex);
+                }
+                mWaitCond.notify_one();
+            }
+            else
+            {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        mHaveValue = true;
+        mLast = result.value;
+        mLastTime = now;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mOutstanding = false;
+    mReadCond.notify_all();
+}
+
+bool MCCDIOMonitor::pop(MCCDIOEvent* event)
+{
+    if (mEvents.pop(*event))
+        return true;
+    int err = mError.load();
+    if (err >= 0 && !isRunning() && mEvents.empty())
+        throw (mcc_err)err;
+    return false;
+}
+
+bool MCCDIOMonitor::wait(MCCDIOEvent* event, unsigned int timeout)
+{
+    std::unique_lock<std::mutex> lock(mWaitMutex);
+    mWaitCond.wait_for(lock, std::chrono::milliseconds(timeout),
+                       [this]{ return !mEvents.empty() || !isRunning(); });
+    lock.unlock();
+    return pop(event);
+}
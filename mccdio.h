@@ -0,0 +1,87 @@
+//
+//  mccdio.h
+//  Watching the digital port for edges.
+//  MCCDIOMonitor reads DPORT through the device's control queue at a fixed rate. The reads are
+//  timed by a thread that sleeps between them, and each reply is handled in the queue's completion
+//  callback, so no thread spins. Bits that changed since the previous read become timestamped
+//  events in a lock-free queue. Timestamps are mccHostTime() seconds, so they line up with the
+//  analog stream through device.getClock().scanAt(event.time).
+//
+//  An edge is only seen if the line holds its new level until the next read: pulses shorter than
+//  the poll period can be missed.
+//
+
+#ifndef ____mccdio__
+#define ____mccdio__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "mccdevice.h"
+#include "mccring.h"
+
+struct MCCDIOEvent
+{
+    double time;        //mccHostTime() when the read that saw the change completed.
+    double window;      //Seconds since the previous read: the edge happened within [time - window, time].
+    uint8_t value;      //Port value after the change, all bits.
+    uint8_t rising;     //Watched bits that went from 0 to 1.
+    uint8_t falling;    //Watched bits that went from 1 to 0.
+};
+
+class MCCDIOMonitor
+{
+public:
+    //Read the port rate times per second and report edges on the bits in mask. capacity events
+    //can wait to be read; more are dropped and counted. The device's control queue is shared, so
+    //messages sent meanwhile are delayed by at most one port read.
+    MCCDIOMonitor(MCCDevice& device, double rate = 1000, uint8_t mask = 0xFF, size_t capacity = 4096);
+    ~MCCDIOMonitor();
+
+    void start();
+    void stop();    //Returns once the last read has completed.
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+
+    //Take the oldest edge event. pop never blocks; wait sleeps until there is one or timeout (ms)
+    //expires. Both return false if there was none. Once polling has stopped on a device error and
+    //every event has been taken, they throw that error. Call from one thread only.
+    bool pop(MCCDIOEvent* event);
+    bool wait(MCCDIOEvent* event, unsigned int timeout);
+
+    uint8_t value() const { return mValue.load(std::memory_order_relaxed); }   //Port at the last read.
+    unsigned long long polls() const { return mPolls.load(std::memory_order_relaxed); }
+    //Ticks skipped because the read before had not completed: the rate is more than the bus can carry.
+    unsigned long long missed() const { return mMissed.load(std::memory_order_relaxed); }
+    unsigned long long dropped() const { return mDropped.load(std::memory_order_relaxed); }  //Events lost to a full queue.
+
+private:
+    MCCDevice& mDevice;
+    double mPeriod;
+    uint8_t mMask;
+    MCCSpscQueue<MCCDIOEvent> mEvents;
+    //Completion callback state. Callbacks never overlap (see MCCControlQueue), so they are the single producer.
+    bool mHaveValue;
+    uint8_t mLast;
+    double mLastTime;
+    std::atomic<uint8_t> mValue;
+    std::atomic<unsigned long long> mPolls;
+    std::atomic<unsigned long long> mMissed;
+    std::atomic<unsigned long long> mDropped;
+    std::atomic<int> mError;                //mcc_err that stopped polling, or -1.
+    std::atomic<bool> mRunning;
+    bool mOutstanding;                      //A read is queued. Guarded by mMutex.
+    bool mStopRequested;                    //Guarded by mMutex.
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mTickCond;      //Wakes the timing thread early to stop.
+    std::condition_variable mReadCond;      //A read completed.
+    std::mutex mWaitMutex;                  //Only used to sleep readers of events.
+    std::condition_variable mWaitCond;
+
+    void run();
+    void completed(const MCCControlResult& result);
+};
+
+#endif /* defined(____mccdio__) */
@@ -0,0 +1,34 @@
+//
+//  mccerror.h
+//  Error codes thrown by MCCDevice and the modules around it.
+//  Kept apart from mccdevice.h so that the conversion, filter and trigger code can
+//  throw them without pulling in the device and libusb.
+//
+
+#ifndef ____mccerror__
+#define ____mccerror__
+
+enum mcc_err{
+    MCC_ERR_NO_DEVICE,
+    MCC_ERR_INVALID_ID,
+    MCC_ERR_USB_INIT,
+    MCC_ERR_PIPE,
+    MCC_ERR_LIBUSB_TIMEOUT,
+    MCC_ERR_TRANSFER_FAILED,
+    MCC_ERR_LIBUSB_TRANSFER_STALL,
+    MCC_ERR_LIBUSB_TRANSFER_OVERFLOW,
+    MCC_ERR_UNKNOWN_LIB_USB_ERR,
+    MCC_ERR_INVALID_BUFFER_SIZE,
+    MCC_ERR_CANT_OPEN_FPGA_FILE,
+    MCC_ERR_FPGA_UPLOAD_FAILED,
+    MCC_ERR_ACCESS,
+    MCC_ERR_NOT_STREAMING,
+    MCC_ERR_CONFIG_MISMATCH,
+    MCC_ERR_FILE_IO,
+    MCC_ERR_BAD_FILE_FORMAT,
+    MCC_ERR_BAD_RESPONSE,
+    MCC_ERR_SCAN_OVERRUN,
+    MCC_ERR_BUFFERS_HELD,
+};
+
+#endif /* defined(____mccerror__) */
@@ -0,0 +1,218 @@
+//
+//  mccfilter.cpp
+//
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "mccerror.h"
+#include "mccfilter.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MCC_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if MCC_HAVE_SSE2 && defined(__GNUC__)
+#define MCC_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define TILE_SCANS 1024 //Scans deinterleaved into the per-channel lines at a time.
+
+static float dotScalar(const float* a, const float* b, int n)
+{
+    float sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += a[i]*b[i];
+    return sum;
+}
+
+#if MCC_HAVE_SSE2
+//Two accumulators so consecutive adds do not wait on each other.
+static float dotSSE2(const float* a, const float* b, int n)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&a[i + 4]), _mm_loadu_ps(&b[i + 4])));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotScalar(&a[i], &b[i], n - i);
+}
+#endif
+
+#if MCC_HAVE_AVX2
+__attribute__((target("avx2,fma")))
+static float dotAVX2(const float* a, const float* b, int n)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i;
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i + 8]), _mm256_loadu_ps(&b[i + 8]), acc1);
+    }
+    if (i + 8 <= n)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), acc0);
+        i += 8;
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotScalar(&a[i], &b[i], n - i);
+}
+
+static bool cpuHasAVX2()
+{
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+}
+#endif
+
+typedef float (*DotKernel)(const float* a, const float* b, int n);
+
+static DotKernel dotKernel()
+{
+#if MCC_HAVE_AVX2
+    if (cpuHasAVX2())
+        return dotAVX2;
+#endif
+#if MCC_HAVE_SSE2
+    return dotSSE2;
+#else
+    return dotScalar;
+#endif
+}
+
+MCCDecimator::MCCDecimator(int channelCount, const std::vector<float>& taps, int factor)
+:   mChannelCount(channelCount), mFactor(factor), mTaps(taps.rbegin(), taps.rend())
+{
+    if (channelCount <= 0 || factor <= 0 || taps.empty())
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+    mLines.resize(channelCount, std::vector<float>(mTaps.size() - 1 + TILE_SCANS));
+    reset();
+}
+
+std::vector<float> MCCDecimator::lowpass(int factor, int tapsPerPhase)
+{
+    if (factor <= 0 || tapsPerPhase <= 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    int length = tapsPerPhase*factor + 1;
+    double cutoff = 0.8 * 0.5 / factor;     //Cycles per input scan.
+    double middle = (length - 1) / 2.0, sum = 0;
+    std::vector<float> taps(length);
+    std::vector<double> exact(length);
+    for (int i = 0; i < length; i++)
+    {
+        double x = i - middle;
+        double sinc = x == 0 ? 2*cutoff : sin(2*M_PI*cutoff*x) / (M_PI*x);
+        double window = length == 1 ? 1 : 0.42 - 0.5*cos(2*M_PI*i / (length - 1)) + 0.08*cos(4*M_PI*i / (length - 1));
+        exact[i] = sinc*window;
+        sum += exact[i];
+    }
+    for (int i = 0; i < length; i++)
+        taps[i] = (float)(exact[i] / sum);
+    return taps;
+}
+
+void MCCDecimator::reset()
+{
+    mPhase = 0;
+    mPrimed = false;
+}
+
+double MCCDecimator::delay() const
+{
+    return (mTaps.size() - 1) / 2.0;
+}
+
+const char* MCCDecimator::kernelName()
+{
+#if MCC_HAVE_AVX2
+    if (cpuHasAVX2())
+        return "avx2";
+#endif
+#if MCC_HAVE_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+int MCCDecimator::process(const unsigned short* data, int scans, float* out)
+{
+    return filter(data, scans, out, NULL);
+}
+
+int MCCDecimator::process(const unsigned short* data, int scans, float* out, const MCCConverter& converter)
+{
+    if (converter.channelCount() != mChannelCount)
+        throw MCC_ERR_CONFIG_MISMATCH;
+    return filter(data, scans, out, &converter);
+}
+
+int MCCDecimator::process(const float* data, int scans, float* out)
+{
+    return filter(data, scans, out, NULL);
+}
+
+template <typename T>
+int MCCDecimator::filter(const T* data, int scans, float* out, const MCCConverter* converter)
+{
+    DotKernel dot = dotKernel();
+    int numTaps = (int)mTaps.size(), history = numTaps - 1;
+    int written = 0;
+    float tapSum = 0;
+
+    if (scans <= 0)
+        return 0;
+    if (converter)
+    {
+        for (int k = 0; k < numTaps; k++)
+            tapSum += mTaps[k];
+    }
+    if (!mPrimed)
+    {
+        for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+            std::fill(mLines[chanIdx].begin(), mLines[chanIdx].begin() + history, (float)data[chanIdx]);
+        mPrimed = true;
+    }
+
+    for (int start = 0; start < scans; start += TILE_SCANS)
+    {
+        int n = std::min(TILE_SCANS, scans - start);
+        int count = mPhase < n ? (n - mPhase + mFactor - 1) / mFactor : 0;
+        for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+        {
+            //Deinterleave the tile behind the channel's history, so each window is contiguous.
+            float* line = mLines[chanIdx].data();
+            float* fresh = line + history;
+            const T* src = data + (size_t)start*mChannelCount + chanIdx;
+            for (int i = 0; i < n; i++)
+                fresh[i] = (float)src[(size_t)i*mChannelCount];
+
+            float gain = 1, offset = 0;
+            if (converter)
+            {
+                gain = converter->gain(chanIdx);
+                offset = converter->offset(chanIdx)*tapSum;
+            }
+            //Output at scan j covers line[j] (oldest) through fresh[j] (newest).
+            float* dst = out + (size_t)written*mChannelCount + chanIdx;
+            for (int k = 0, j = mPhase; k < count; k++, j += mFactor)
+                dst[(size_t)k*mChannelCount] = dot(mTaps.data(), line + j, numTaps)*gain + offset;
+
+            memmove(line, line + n, history*sizeof(float));
+        }
+        written += count;
+        mPhase += count*mFactor - n;
+    }
+    return written;
+}
@@ -0,0 +1,68 @@
+//
+//  mccfilter.h
+//  Decimating the scan stream at the source.
+//  Scanning at the device's full rate and filtering down keeps aliasing out of the band of
+//  interest, but a separate pass over every block costs as much as the acquisition itself.
+//  MCCDecimator filters each channel of an interleaved block with one FIR and keeps one scan in
+//  factor. Only the kept outputs are computed (the polyphase form), each as one vectorized dot
+//  product, so the work per input scan is taps/factor multiply-adds per channel:
+//
+//      MCCDecimator dec(dev.getChannelCount(), MCCDecimator::lowpass(10), 10);
+//      std::vector<float> out(dec.maxOutputScans(dev.mSamplesPerBlock) * dev.getChannelCount());
+//      dev.getBlock();
+//      int scans = dec.process(dev.mData, dev.mSamplesPerBlock, out.data(), dev.getConverter());
+//
+//  The filter state carries over between calls, so blocks of any length filter as one stream.
+//  Because the filter and the calibration are both linear, raw counts can be filtered first and
+//  calibrated after, on factor times fewer samples; the result is the same as filtering volts.
+//
+
+#ifndef ____mccfilter__
+#define ____mccfilter__
+
+#include <vector>
+#include "mccconvert.h"
+
+class MCCDecimator
+{
+public:
+    //taps are applied to every channel, taps[0] to the newest scan. Output scan k is the filter at
+    //input scan k*factor, counted from the first scan after construction or reset().
+    MCCDecimator(int channelCount, const std::vector<float>& taps, int factor);
+
+    //Windowed-sinc (Blackman) lowpass for decimating by factor: cutoff at 0.8 of the new Nyquist
+    //frequency, tapsPerPhase*factor + 1 taps, unity gain at DC.
+    static std::vector<float> lowpass(int factor, int tapsPerPhase = 16);
+
+    //Forget the filter state. The next call primes it with its first scan, so the output starts
+    //settled at that level instead of rising from zero.
+    void reset();
+
+    //Filter scans interleaved scans (data[0] is the first channel) and write the kept outputs,
+    //interleaved, to out. Returns the number of output scans written, at most maxOutputScans(scans).
+    int process(const unsigned short* data, int scans, float* out);            //In counts.
+    int process(const unsigned short* data, int scans, float* out, const MCCConverter& converter);  //In volts.
+    int process(const float* data, int scans, float* out);                     //Already calibrated.
+
+    int maxOutputScans(int scans) const { return (scans + mFactor - 1) / mFactor; }
+    int channelCount() const { return mChannelCount; }
+    int factor() const { return mFactor; }
+    int numTaps() const { return (int)mTaps.size(); }
+    double delay() const;   //Group delay in input scans, for a symmetric filter such as lowpass().
+
+    //Which kernel the dot products dispatch to: "avx2", "sse2" or "scalar".
+    static const char* kernelName();
+
+private:
+    int mChannelCount;
+    int mFactor;
+    std::vector<float> mTaps;       //Reversed, so an output is a dot product with the oldest scan first.
+    //Per channel: the last numTaps() - 1 scans followed by room for one tile of new ones.
+    std::vector<std::vector<float> > mLines;
+    int mPhase;                     //Scans to skip before the next kept output.
+    bool mPrimed;
+
+    template <typename T> int filter(const T* data, int scans, float* out, const MCCConverter* converter);
+};
+
+#endif /* defined(____mccfilter__) */
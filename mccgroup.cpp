@@ -0,0 +1,260 @@
+//
+//  mccgroup.cpp
+//
+
+#include <string.h>
+#include <chrono>
+#include "mccgroup.h"
+
+#define EVENT_TIMEOUT_US 1000   //Longest the event thread sleeps in libusb before checking the streams again.
+
+MCCDeviceGroup::MCCDeviceGroup()
+:   ctx(NULL), mRing(0, 0), mSamplesPerBlock(0), mChannelCount(0), mStartSkew(0),
+    mRunning(false), mStopRequested(false), mOverruns(0), mError(-1)
+{
+    if (libusb_init(&ctx) != 0)
+        throw MCC_ERR_USB_INIT;
+}
+
+MCCDeviceGroup::~MCCDeviceGroup()
+{
+    stop();
+    for (size_t i = 0; i < mDevices.size(); i++)
+        delete mDevices[i];
+    libusb_exit(ctx);
+}
+
+MCCDevice& MCCDeviceGroup::addDevice(int idProduct, std::string mfgSerialNumber)
+{
+    mDevices.push_back(new MCCDevice(idProduct, mfgSerialNumber, ctx));
+    return *mDevices.back();
+}
+
+MCCDevice& MCCDeviceGroup::addDevice(int idProduct, MCCTransport* transport)
+{
+    mDevices.push_back(new MCCDevice(idProduct, transport));
+    return *mDevices.back();
+}
+
+void MCCDeviceGroup::start(int samplesPerBlock, int numTransfers, int numBlocks)
+{
+    if (mThread.joinable() || mDevices.empty())
+        return;
+
+    //Scans are merged by index, which only makes sense if every device scans at the same rate.
+    mChannelCount = 0;
+    for (size_t i = 0; i < mDevices.size(); i++)
+    {
+        if (mDevices[i]->sampRate != mDevices[0]->sampRate)
+            throw MCC_ERR_CONFIG_MISMATCH;
+        mChannelCount += mDevices[i]->getChannelCount();
+    }
+
+    mSamplesPerBlock = samplesPerBlock;
+    mStaging.resize(mDevices.size());
+    for (size_t i = 0; i < mDevices.size(); i++)
+    {
+        mStaging[i].data.resize((size_t)samplesPerBlock * mDevices[i]->getChannelCount());
+        mStaging[i].filled = 0;
+    }
+    mRing.reset(numBlocks, samplesPerBlock * mChannelCount);
+
+    //Queue transfers everywhere first so no device has to wait for the host once it starts scanning.
+    for (size_t i = 0; i < mDevices.size(); i++)
+        mDevices[i]->startStream(numTransfers);
+
+    mStopRequested = false;
+    mError = -1;
+    if (mRealtime.lockMemory)
+    {
+        //Fault in everything the event thread writes, so its first pass does not stall on page faults.
+        mccPrefault(mRing.storage(), mRing.storageBytes());
+        for (size_t i = 0; i < mStaging.size(); i++)
+            mccPrefault(mStaging[i].data.data(), mStaging[i].data.size() * sizeof(unsigned short));
+    }
+    mRunning = true;
+    mRealtimeApplied = std::promise<MCCRealtimeStatus>();
+    std::future<MCCRealtimeStatus> applied = mRealtimeApplied.get_future();
+    mThread = std::thread(&MCCDeviceGroup::run, this);
+    mRealtimeStatus = applied.get();
+    if (mRealtime.required && !mRealtimeStatus.applied)
+    {
+        stop();
+        throw MCC_ERR_ACCESS;
+    }
+    //A device that refused AISCAN:START: stop whatever did start.
+    int err = mError.load();
+    if (err >= 0)
+    {
+        stop();
+        throw (mcc_err)err;
+    }
+}
+
+//Called by the event thread before it handles any events, so AISCAN:START resetting each device's
+//scan count and clock never races with the transfers that update them.
+void MCCDeviceGroup::startScans()
+{
+    std::chrono::steady_clock::time_point first = std::chrono::steady_clock::now(), last = first;
+    for (size_t i = 0; i < mDevices.size(); i++)
+    {
+        mDevices[i]->execute(MCCCommand::raw("AISCAN:START"));
+        last = std::chrono::steady_clock::now();
+        if (i == 0)
+            first = last;
+    }
+    mStartSkew = std::chrono::duration<double>(last - first).count();
+}
+
+void MCCDeviceGroup::stop()
+{
+    mStopRequested = true;
+    if (!mThread.joinable())
+        return;
+    mThread.join();
+
+    for (size_t i = 0; i < mDevices.size(); i++)
+    {
+        try
+        {
+            mDevices[i]->execute(MCCCommand::raw("AISCAN:STOP"));
+        }
+        catch(mcc_err err)
+        {
+            //Keep stopping the others; a device that has gone away has stopped anyway.
+        }
+        mDevices[i]->stopStream();
+    }
+}
+
+//Interleave one staged block from every device into out, scan by scan.
+void MCCDeviceGroup::merge(unsigned short* out)
+{
+    size_t pos = 0;
+    for (int scan = 0; scan < mSamplesPerBlock; scan++)
+    {
+        for (size_t i = 0; i < mDevices.size(); i++)
+        {
+            int channels = mDevices[i]->getChannelCount();
+            memcpy(&out[pos], &mStaging[i].data[(size_t)scan * channels], channels * sizeof(unsigned short));
+            pos += channels;
+        }
+    }
+}
+
+void MCCDeviceGroup::run()
+{
+    struct timeval tv;
+    bool complete;
+    unsigned short* slot;
+    MCCRealtimeStatus realtime = mccApplyRealtime(mRealtime);
+    bool refused = mRealtime.required && !realtime.applied;
+
+    if (!refused)
+    {
+        try
+        {
+            startScans();
+        }
+        catch(mcc_err err)
+        {
+            mError = err;
+            refused = true;
+        }
+    }
+    mRealtimeApplied.set_value(realtime);
+    try
+    {
+        while (!refused && !mStopRequested.load(std::memory_order_relaxed))
+        {
+            //One thread handles the events of every device on the shared context.
+            tv.tv_sec = 0;
+            tv.tv_usec = EVENT_TIMEOUT_US;
+            int err = libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+            if (err < 0 && err != LIBUSB_ERROR_INTERRUPTED)
+                throw libUSBError(err);
+
+            do
+            {
+                complete = true;
+                for (size_t i = 0; i < mDevices.size(); i++)
+                {
+                    Staging& st = mStaging[i];
+                    int size = (int)st.data.size();
+                    if (st.filled < size)
+                        st.filled += mDevices[i]->pollScanData(&st.data[st.filled], size - st.filled);
+                    if (st.filled < size)
+                        complete = false;
+                }
+                if (!complete)
+                    break;
+
+                slot = mRing.writeSlot();
+                if (slot)
+                {
+                    merge(slot);
+                    mRing.commitWrite();
+                    {
+                        std::lock_guard<std::mutex> lock(mWaitMutex);
+                    }
+                    mWaitCond.notify_one();
+                }
+                else
+                {
+                    mOverruns.fetch_add(1, std::memory_order_relaxed);
+                    for (size_t i = 0; i < mDevices.size(); i++)
+                        mDevices[i]->getStats().addOverruns(1);
+                }
+                for (size_t i = 0; i < mStaging.size(); i++)
+                    mStaging[i].filled = 0;
+            } while (true);
+        }
+    }
+    catch(mcc_err err)
+    {
+        mError = err;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mWaitMutex);
+        mRunning = false;
+    }
+    mWaitCond.notify_all();
+}
+
+bool MCCDeviceGroup::copyOut(unsigned short* data)
+{
+    const unsigned short* slot = mRing.readSlot();
+    if (!slot)
+    {
+        int err = mError.load();
+        if (err >= 0 && !isRunning())
+            throw (mcc_err)err;
+        return false;
+    }
+    memcpy(data, slot, sizeof(unsigned short) * mRing.blockLength());
+    mRing.commitRead();
+    return true;
+}
+
+bool MCCDeviceGroup::tryRead(unsigned short* data)
+{
+    return copyOut(data);
+}
+
+bool MCCDeviceGroup::read(unsigned short* data)
+{
+    std::unique_lock<std::mutex> lock(mWaitMutex);
+    mWaitCond.wait(lock, [this]{ return mRing.available() > 0 || !isRunning(); });
+    lock.unlock();
+    return copyOut(data);
+}
+
+bool MCCDeviceGroup::read(unsigned short* data, unsigned int timeout)
+{
+    std::unique_lock<std::mutex> lock(mWaitMutex);
+    mWaitCond.wait_for(lock, std::chrono::milliseconds(timeout),
+                       [this]{ return mRing.available() > 0 || !isRunning(); });
+    lock.unlock();
+    return copyOut(data);
+}
@@ -0,0 +1,97 @@
+//
+//  mccgroup.h
+//  Synchronized acquisition from several MCC devices.
+//  All devices are opened on one shared libusb context and every bulk endpoint is serviced
+//  from a single event-handling thread, however many devices there are. Each device streams
+//  into its own staging block; once every device has delivered a block's worth of scans the
+//  blocks are merged scan by scan into one ring:
+//
+//      scan 0: dev0 ch0..chN, dev1 ch0..chM, ...   scan 1: ...
+//
+//  Scans are aligned by index, so the devices must run at the same AISCAN:RATE. Their scans are
+//  started back to back (startSkew() reports the spread); for sample-exact alignment drive all
+//  devices from one pacer clock (see AISCAN:EXTPACER in the DAQFlex manual).
+//
+
+#ifndef ____mccgroup__
+#define ____mccgroup__
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mccdevice.h"
+#include "mccring.h"
+#include "mccrealtime.h"
+
+class MCCDeviceGroup
+{
+public:
+    MCCDeviceGroup();
+    ~MCCDeviceGroup();
+
+    //Open a device on the group's libusb context. Configure it (sendMessage, reconfigure) before start().
+    MCCDevice& addDevice(int idProduct, std::string mfgSerialNumber);
+    //Add a device on another transport, e.g. MCCSimTransport. The group takes ownership.
+    MCCDevice& addDevice(int idProduct, MCCTransport* transport);
+    int deviceCount() const { return (int)mDevices.size(); }
+    MCCDevice& device(int index) { return *mDevices[index]; }
+
+    //Queue numTransfers transfers per device, then start the event thread, which sends AISCAN:START
+    //to every device before it handles any transfers. Throws the error of a device that refused to
+    //start, with the group stopped. Merged blocks hold samplesPerBlock scans; numBlocks of them are buffered.
+    void start(int samplesPerBlock, int numTransfers = 16, int numBlocks = 64);
+    //Scheduling, CPU set and memory locking for the event thread (see mccrealtime.h), applied by
+    //start(). With options.required, start() throws MCC_ERR_ACCESS before any scan is started if
+    //one of them is refused.
+    void setRealtime(const MCCRealtimeOptions& options) { mRealtime = options; }
+    const MCCRealtimeStatus& realtimeStatus() const { return mRealtimeStatus; }  //As of the last start().
+    //Stop the event thread, send AISCAN:STOP to every device and stop their streams.
+    void stop();
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+
+    //Copy the oldest merged block (blockLength() samples) into data. Same semantics as MCCAcquisition.
+    bool read(unsigned short* data);
+    bool read(unsigned short* data, unsigned int timeout);
+    bool tryRead(unsigned short* data);
+
+    int channelCount() const { return mChannelCount; }  //Total over all devices.
+    int blockLength() const { return mRing.blockLength(); }
+    unsigned long long overruns() const { return mOverruns.load(std::memory_order_relaxed); }
+    double startSkew() const { return mStartSkew; }     //Seconds between the first and last AISCAN:START.
+
+private:
+    struct Staging
+    {
+        std::vector<unsigned short> data;   //One block of this device's scans.
+        int filled;                         //Samples received so far.
+    };
+
+    libusb_context* ctx;
+    std::vector<MCCDevice*> mDevices;
+    std::vector<Staging> mStaging;
+    MCCBlockRing mRing; //A member, not a heap object, so its counters keep their cache-line alignment.
+    int mSamplesPerBlock;
+    int mChannelCount;
+    double mStartSkew;
+    std::thread mThread;
+    std::atomic<bool> mRunning;
+    std::atomic<bool> mStopRequested;
+    std::atomic<unsigned long long> mOverruns;
+    std::atomic<int> mError;
+    std::mutex mWaitMutex;
+    std::condition_variable mWaitCond;
+    MCCRealtimeOptions mRealtime;
+    MCCRealtimeStatus mRealtimeStatus;
+    std::promise<MCCRealtimeStatus> mRealtimeApplied;  //Set by the event thread before it handles events.
+
+    void run();
+    void startScans();
+    void merge(unsigned short* out);
+    bool copyOut(unsigned short* data);
+};
+
+#endif /* defined(____mccgroup__) */
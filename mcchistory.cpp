@@ -0,0 +1,191 @@
+//
+//  mcchistory.cpp
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "mccerror.h"
+#include "mcchistory.h"
+
+#ifndef _WIN32
+//An unnamed shared memory object of bytes: memfd on Linux, an shm object unlinked right away elsewhere.
+static int openAnonymousShm(size_t bytes)
+{
+    int fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = (int)syscall(SYS_memfd_create, "mcchistory", 0);
+#endif
+    if (fd < 0)
+    {
+        static std::atomic<unsigned> counter(0);
+        char name[64];
+        snprintf(name, sizeof(name), "/mcchistory-%d-%u", (int)getpid(), counter.fetch_add(1));
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0)
+            shm_unlink(name);
+    }
+    if (fd >= 0 && ftruncate(fd, (off_t)bytes) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+#endif
+
+MCCHistoryRing::MCCHistoryRing(const MCCConverter& converter, int capacityScans)
+:   mData(NULL), mCapacity(0), mBytes(0), mChannelCount(converter.channelCount()), mConverter(converter),
+    mWritten(0), mReserved(0), mBase(0), mStart(0)
+{
+    if (capacityScans <= 0 || mChannelCount <= 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+#ifdef _WIN32
+    throw MCC_ERR_FILE_IO;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    mBytes = ((size_t)capacityScans * mChannelCount * sizeof(unsigned short) + page - 1) / page * page;
+    mCapacity = mBytes / sizeof(unsigned short);
+
+    int fd = openAnonymousShm(mBytes);
+    if (fd < 0)
+        throw MCC_ERR_FILE_IO;
+    //Reserve room for both mappings, then put the object in each half.
+    char* base = (char*)mmap(NULL, 2 * mBytes, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        throw MCC_ERR_FILE_IO;
+    }
+    if (mmap(base, mBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + mBytes, mBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, 2 * mBytes);
+        close(fd);
+        throw MCC_ERR_FILE_IO;
+    }
+    close(fd);
+    mData = (unsigned short*)base;
+#endif
+}
+
+MCCHistoryRing::~MCCHistoryRing()
+{
+#ifndef _WIN32
+    if (mData)
+        munmap(mData, 2 * mBytes);
+#endif
+}
+
+void MCCHistoryRing::setCalibration(const MCCConverter& converter)
+{
+    if (converter.channelCount() != mChannelCount)
+    {
+        if (converter.channelCount() <= 0)
+            throw MCC_ERR_INVALID_BUFFER_SIZE;
+        mChannelCount = converter.channelCount();
+        mStart.store(mWritten.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+    mConverter = converter;
+}
+
+void MCCHistoryRing::append(const unsigned short* data, int length, unsigned long long firstSample)
+{
+    unsigned long long written = mWritten.load(std::memory_order_relaxed);
+
+    if (length <= 0)
+        return;
+    if (written - firstSample != mBase.load(std::memory_order_relaxed))
+    {
+        //Not where the last call ended: number the scans from here on.
+        mBase.store(written - firstSample, std::memory_order_relaxed);
+        mStart.store(written, std::memory_order_release);
+    }
+    if ((size_t)length > mCapacity)
+    {
+        //Only the last ring's worth can be kept.
+        written += length - mCapacity;
+        data += length - mCapacity;
+        length = (int)mCapacity;
+    }
+
+    //Readers of the samples about to be overwritten see this and know their view is gone.
+    mReserved.store(written + length, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    //Contiguous even across the end of the ring, thanks to the second mapping.
+    memcpy(&mData[written % mCapacity], data, length * sizeof(unsigned short));
+    mWritten.store(written + length, std::memory_order_release);
+}
+
+unsigned long long MCCHistoryRing::oldestPosition() const
+{
+    unsigned long long reserved = mReserved.load(std::memory_order_acquire);
+    unsigned long long start = mStart.load(std::memory_order_acquire);
+    return std::max(start, reserved > mCapacity ? reserved - mCapacity : 0);
+}
+
+bool MCCHistoryRing::makeView(unsigned long long position, unsigned long long base, int scans, MCCHistoryView* view) const
+{
+    unsigned long long length = (unsigned long long)scans * mChannelCount;
+    unsigned long long written = mWritten.load(std::memory_order_acquire);
+
+    if (scans <= 0 || length > mCapacity)
+        return false;
+    if (position > written || written - position < length || position < oldestPosition())
+        return false;
+    view->data = &mData[position % mCapacity];
+    view->firstScan = (position - base) / mChannelCount;
+    view->scans = scans;
+    view->channelCount = mChannelCount;
+    view->position = position;
+    view->converter = &mConverter;
+    return true;
+}
+
+bool MCCHistoryRing::window(unsigned long long scan, int pre, int post, MCCHistoryView* view) const
+{
+    if (pre < 0 || post < 0 || scan < (unsigned long long)pre)
+        return false;
+    unsigned long long base = mBase.load(std::memory_order_acquire);
+    unsigned long long position = base + (scan - pre) * mChannelCount;
+    //A scan from before the current count began lands before mStart, or wraps past mWritten.
+    return makeView(position, base, pre + post, view);
+}
+
+bool MCCHistoryRing::latest(int scans, MCCHistoryView* view) const
+{
+    unsigned long long end = scansWritten();
+    if (scans <= 0 || end < (unsigned long long)scans)
+        return false;
+    return window(end - scans, 0, scans, view);
+}
+
+bool MCCHistoryRing::intact(const MCCHistoryView& view) const
+{
+    //Pairs with the fence in append(): anything that wrote over the view has raised mReserved by now.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    unsigned long long reserved = mReserved.load(std::memory_order_relaxed);
+    return reserved <= view.position + mCapacity;
+}
+
+unsigned long long MCCHistoryRing::scansWritten() const
+{
+    unsigned long long base = mBase.load(std::memory_order_acquire);
+    return (mWritten.load(std::memory_order_acquire) - base) / mChannelCount;
+}
+
+unsigned long long MCCHistoryRing::oldestScan() const
+{
+    unsigned long long base = mBase.load(std::memory_order_acquire);
+    return (oldestPosition() - base + mChannelCount - 1) / mChannelCount;
+}
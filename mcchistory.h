@@ -0,0 +1,104 @@
+//
+//  mcchistory.h
+//  Pre-trigger history: the last few seconds of raw scans, in a ring that never needs unwrapping.
+//  MCCHistoryRing maps the same memory twice, back to back, so the samples that follow the end of
+//  the ring appear again right after it. Any window of up to a ring's length is then one
+//  contiguous run of memory wherever it starts, and window() hands it out in place, without a
+//  copy. Volts are computed only when a view is converted.
+//
+//  Attached with MCCDevice::setHistoryRing, every transfer is appended as it arrives, before an
+//  attached MCCTriggerEngine sees it, so a trigger event's scan is already in the ring when the
+//  event is delivered:
+//
+//      MCCHistoryRing history(dev.getConverter(), 2 * (int)dev.sampRate);    //2 s of scans
+//      dev.setHistoryRing(&history);
+//      ...                                                                 //event from mcctrigger.h
+//      MCCHistoryView view;
+//      if (history.window(event.scan, pre, post, &view))                   //[scan - pre, scan + post)
+//      {
+//          view.convert(volts);                                            //Or read view.data in counts.
+//          if (!history.intact(view))
+//              ...                                                         //Overwritten meanwhile: discard.
+//      }
+//
+//  One thread appends; any number of threads may take and read views. Appending never waits for
+//  readers, so a view of old data can be overwritten while it is read; intact() says whether it was.
+//  The double mapping needs mmap of shared memory, which is not available on Windows.
+//
+
+#ifndef ____mcchistory__
+#define ____mcchistory__
+
+#include <stdint.h>
+#include <atomic>
+#include "mccconvert.h"
+
+struct MCCHistoryView
+{
+    const unsigned short* data;     //scans*channelCount interleaved samples in place, starting at the first channel.
+    unsigned long long firstScan;   //Counted like MCCDevice::getScanCount().
+    int scans;
+    int channelCount;
+    unsigned long long position;    //Ring position of data[0], for MCCHistoryRing::intact.
+    const MCCConverter* converter;  //The ring's calibration.
+
+    float volts(int scan, int chanIdx) const
+    {
+        return (float)data[(size_t)scan*channelCount + chanIdx]*converter->gain(chanIdx) + converter->offset(chanIdx);
+    }
+    void convert(float* out, MCCLayout layout = MCC_LAYOUT_INTERLEAVED) const
+    {
+        converter->convert(data, out, scans*channelCount, layout);
+    }
+    void convertMicrovolts(int32_t* out, MCCLayout layout = MCC_LAYOUT_INTERLEAVED) const
+    {
+        converter->convertMicrovolts(data, out, scans*channelCount, layout);
+    }
+};
+
+class MCCHistoryRing
+{
+public:
+    //Keep at least capacityScans scans of converter.channelCount() channels. The ring is rounded up
+    //to whole pages. Throws MCC_ERR_FILE_IO if the memory cannot be mapped twice.
+    MCCHistoryRing(const MCCConverter& converter, int capacityScans);
+    ~MCCHistoryRing();
+
+    //New calibration for views, e.g. after reconfigure() (MCCDevice does this for an attached ring).
+    //A different channel count drops the history. Not while views are taken.
+    void setCalibration(const MCCConverter& converter);
+
+    //Producer side. Copy length interleaved samples in; firstSample is the stream index of data[0]
+    //(scans times channels plus channel), which numbers the scans. A gap or a restarted count
+    //simply renumbers what follows.
+    void append(const unsigned short* data, int length, unsigned long long firstSample);
+
+    //A view of scans [scan - pre, scan + post), in place. Returns false if any of them has not
+    //arrived yet or has already been overwritten; scansWritten() and oldestScan() say which.
+    bool window(unsigned long long scan, int pre, int post, MCCHistoryView* view) const;
+    //The newest scans complete scans.
+    bool latest(int scans, MCCHistoryView* view) const;
+    //True if none of the view's samples has been overwritten since it was taken. Check after reading.
+    bool intact(const MCCHistoryView& view) const;
+
+    unsigned long long scansWritten() const;    //Scan number one past the newest complete scan.
+    unsigned long long oldestScan() const;      //Oldest scan still complete in the ring.
+    int capacityScans() const { return mChannelCount > 0 ? (int)(mCapacity / mChannelCount) : 0; }
+    int channelCount() const { return mChannelCount; }
+
+private:
+    unsigned short* mData;      //mCapacity samples, mapped again right after themselves.
+    size_t mCapacity;           //Samples.
+    size_t mBytes;              //Of one mapping.
+    int mChannelCount;
+    MCCConverter mConverter;
+    std::atomic<unsigned long long> mWritten;   //Ring position one past the newest sample.
+    std::atomic<unsigned long long> mReserved;  //Ring position up to which samples may be being written.
+    std::atomic<unsigned long long> mBase;      //Ring position of stream sample 0 (modulo 2^64).
+    std::atomic<unsigned long long> mStart;     //Ring position where that numbering began.
+
+    unsigned long long oldestPosition() const;
+    bool makeView(unsigned long long position, unsigned long long base, int scans, MCCHistoryView* view) const;
+};
+
+#endif /* defined(____mcchistory__) */
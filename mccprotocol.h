@@ -0,0 +1,50 @@
+//
+//  mccprotocol.h
+//  USB request codes and limits of the DAQFlex protocol.
+//  Shared by MCCDevice and the transports that carry or emulate it.
+//
+
+#ifndef ____mccprotocol__
+#define ____mccprotocol__
+
+#include <libusb.h>
+
+/* These definitions are used to build the request type in usb_control_msg */
+#define MCC_VID         (0x09db)  // Vendor ID for Measurement Computing
+#define CTRL_IN         (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN)
+#define CTRL_OUT        (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT)
+#define INTR_LENGTH     64
+
+#define  INPUT_REPORT   (1 << 8)
+#define  OUTPUT_REPORT  (2 << 8)
+
+/* Digital I/O Commands */
+#define DTRISTATE     (0x00)   // Read/Write Tristate register
+#define DPORT         (0x01)   // Read digital port pins
+#define DLATCH        (0x02)   // Read/Write Digital port output latch register
+
+/* Description of the requestType byte */
+// Data transfer direction D7;  libusb_endpoint_direction
+//#define HOST_TO_DEVICE (0x0 << 7)  // LIBUSB_ENDPOINT_IN
+//#define DEVICE_TO_HOST (0x1 << 7)  // LIBUSB_ENDPOINT_OUT
+// Type D5-D6; libusb_request_type
+//#define STANDARD_TYPE (0x0 << 5)  // LIBUSB_REQUEST_TYPE_STANDARD
+//#define CLASS_TYPE    (0x1 << 5)  // LIBUSB_REQUEST_TYPE_CLASS
+//#define VENDOR_TYPE   (0x2 << 5)  // LIBUSB_REQUEST_TYPE_VENDOR
+//#define RESERVED_TYPE (0x3 << 5)
+// Recipient D0 - D4; libusb_request_recipient
+//#define DEVICE_RECIPIENT    (0x0)  // LIBUSB_RECIPIENT_DEVICE
+//#define INTERFACE_RECIPIENT (0x1)  // LIBUSB_RECIPIENT_INTERFACE
+//#define ENDPOINT_RECIPIENT  (0x2)  // LIBUSB_RECIPIENT_ENDPOINT
+//#define OTHER_RECIPIENT     (0x3)  // LIBUSB_RECIPIENT_OTHER
+//#define RESERVED_RECIPIENT  (0x4)
+
+/* MDB Control Transfers */
+#define MAX_MESSAGE_LENGTH 64      // max length of MBD Packet in bytes
+                                   // Request types:
+#define STRING_MESSAGE     (0x80)  // Send string messages to the device
+#define RAW_DATA           (0x81)  // Return RAW data from the device
+#define FPGADATAREQUEST    (0x51)
+#define HS_DELAY            1000   // wjasper uses 20
+
+#endif /* defined(____mccprotocol__) */
@@ -0,0 +1,147 @@
+//
+//  mccrealtime.cpp
+//
+
+#include <errno.h>
+#include <string.h>
+#include <sstream>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+#include "mccrealtime.h"
+
+#define STACK_PREFAULT_BYTES (256*1024) //Stack the time-critical loop may use, faulted in up front.
+
+#ifndef _WIN32
+static std::string limitString(rlim_t limit)
+{
+    std::ostringstream out;
+    if (limit == RLIM_INFINITY)
+        out << "unlimited";
+    else
+        out << (unsigned long long)limit;
+    return out.str();
+}
+
+static size_t pageSize()
+{
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+//Not inlined, so the array really is on the stack below the caller.
+__attribute__((noinline)) static void prefaultStack()
+{
+    volatile unsigned char stack[STACK_PREFAULT_BYTES];
+    for (size_t i = 0; i < sizeof(stack); i += pageSize())
+        stack[i] = 0;
+}
+#endif
+
+MCCRealtimeStatus mccApplyRealtime(const MCCRealtimeOptions& options)
+{
+    MCCRealtimeStatus status;
+    std::ostringstream message;
+
+#ifdef _WIN32
+    if (options.any())
+    {
+        status.applied = false;
+        status.message = "Real-time options are not supported on this platform.\n";
+    }
+    return status;
+#else
+    if (options.lockMemory)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        {
+            status.memoryLocked = true;
+        }
+        else
+        {
+            int err = errno;
+            struct rlimit limit;
+            getrlimit(RLIMIT_MEMLOCK, &limit);
+            message << "mlockall failed (" << strerror(err) << "): needs CAP_IPC_LOCK or an RLIMIT_MEMLOCK covering the process (it is "
+                    << limitString(limit.rlim_cur) << " bytes). Buffers are prefaulted but can be paged out.\n";
+        }
+        prefaultStack();
+    }
+
+    if (!options.cpus.empty())
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < options.cpus.size(); i++)
+            if (options.cpus[i] >= 0 && options.cpus[i] < CPU_SETSIZE)
+                CPU_SET(options.cpus[i], &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err == 0)
+            status.pinned = true;
+        else
+            message << "CPU affinity failed (" << strerror(err) << "): none of the requested CPUs is available to this process.\n";
+#else
+        message << "CPU affinity is not supported on this platform.\n";
+#endif
+    }
+
+    if (options.priority > 0)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = options.priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err == 0)
+        {
+            status.scheduled = true;
+        }
+        else if (err == EPERM)
+        {
+#ifdef RLIMIT_RTPRIO
+            struct rlimit limit;
+            getrlimit(RLIMIT_RTPRIO, &limit);
+            message << "SCHED_FIFO priority " << options.priority << " refused: needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at least "
+                    << options.priority << " (it is " << limitString(limit.rlim_cur) << ").\n";
+#else
+            message << "SCHED_FIFO priority " << options.priority << " refused: needs more privileges.\n";
+#endif
+        }
+        else
+        {
+            message << "SCHED_FIFO priority " << options.priority << " failed (" << strerror(err) << "): the range is "
+                    << sched_get_priority_min(SCHED_FIFO) << " to " << sched_get_priority_max(SCHED_FIFO) << ".\n";
+        }
+    }
+
+    status.message = message.str();
+    status.applied = status.message.empty();
+    //The caller will not run, so take back the one change that outlives its thread.
+    if (options.required && !status.applied && status.memoryLocked)
+    {
+        munlockall();
+        status.memoryLocked = false;
+    }
+    return status;
+#endif
+}
+
+void mccPrefault(void* buffer, size_t bytes)
+{
+    volatile unsigned char* p = (volatile unsigned char*)buffer;
+    if (bytes == 0)
+        return;
+#ifdef _WIN32
+    const size_t step = 4096;
+#else
+    const size_t step = pageSize();
+#endif
+    //Writing back what was read faults the page in for writing without changing it.
+    for (size_t i = 0; i < bytes; i += step)
+        p[i] = p[i];
+    p[bytes - 1] = p[bytes - 1];
+}
@@ -0,0 +1,65 @@
+//
+//  mccrealtime.h
+//  Keeping the acquisition thread on time under load.
+//  The device FIFO only covers a short stall, and an ordinary thread can be held up for
+//  milliseconds by higher-priority work, by other threads on its CPU, or by page faults the
+//  first time a buffer is touched. MCCRealtimeOptions asks for SCHED_FIFO at a fixed priority,
+//  a CPU set to run on, and memory locked and faulted in ahead of time. MCCAcquisition and
+//  MCCDeviceGroup apply them to their own thread when it starts:
+//
+//      MCCRealtimeOptions rt;
+//      rt.priority = 80;
+//      rt.cpus.push_back(3);
+//      rt.lockMemory = true;
+//      acq.setRealtime(rt);
+//      acq.start();
+//      if (!acq.realtimeStatus().applied)
+//          std::cerr << acq.realtimeStatus().message;
+//
+//  Each of these needs privileges: SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO (see
+//  /etc/security/limits.conf, "rtprio") of at least the priority, and locking memory needs
+//  CAP_IPC_LOCK or an RLIMIT_MEMLOCK ("memlock") large enough for the whole process. Whatever is
+//  refused is reported in the status with the limit that refused it. CPU sets are Linux only.
+//
+
+#ifndef ____mccrealtime__
+#define ____mccrealtime__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct MCCRealtimeOptions
+{
+    int priority;               //SCHED_FIFO priority, 1 (lowest) to 99. 0 leaves scheduling alone.
+    std::vector<int> cpus;      //CPUs the thread may run on. Empty leaves affinity alone.
+    //mlockall(MCL_CURRENT | MCL_FUTURE), which covers the whole process including transfer buffers
+    //allocated later, then fault in the owner's sample buffers and the thread's stack.
+    bool lockMemory;
+    //Fail start() with MCC_ERR_ACCESS if anything is refused, instead of running without it. The
+    //memory lock is then undone again (munlockall, so also one the application made itself).
+    bool required;
+
+    MCCRealtimeOptions() : priority(0), lockMemory(false), required(false) {}
+    bool any() const { return priority > 0 || !cpus.empty() || lockMemory; }
+};
+
+struct MCCRealtimeStatus
+{
+    bool applied;               //Everything requested is in effect.
+    bool scheduled;             //Running under SCHED_FIFO at the requested priority.
+    bool pinned;                //Affinity set to the requested CPUs.
+    bool memoryLocked;          //mlockall succeeded.
+    std::string message;        //One line per request that was refused, saying why. Empty if none.
+
+    MCCRealtimeStatus() : applied(true), scheduled(false), pinned(false), memoryLocked(false) {}
+};
+
+//Apply options to the calling thread (and, for lockMemory, to the process).
+MCCRealtimeStatus mccApplyRealtime(const MCCRealtimeOptions& options);
+
+//Touch every page of buffer so it is backed by memory before the time-critical loop first writes it.
+//Contents are left as they are.
+void mccPrefault(void* buffer, size_t bytes);
+
+#endif /* defined(____mccrealtime__) */
@@ -0,0 +1,528 @@
+//
+//  mccrecorder.cpp
+//
+
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "mccrecorder.h"
+
+#define WRITER_POLL_MS 10   //Longest the writer sleeps if a wake-up from append() is missed.
+#define NO_CHUNK ((uint64_t)-1)
+
+static_assert(sizeof(MCCRecordingHeader) <= MCC_RECORDING_HEADER_SIZE, "recording header does not fit");
+
+//Header fields that other processes read while the file grows. The fences order them against the samples.
+static void publishProgress(unsigned char* map, uint64_t scans, uint64_t dataBytes)
+{
+    volatile MCCRecordingHeader* header = (volatile MCCRecordingHeader*)map;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->dataBytes = dataBytes;
+    header->scanCount = scans;
+}
+
+static void readProgress(const unsigned char* map, uint64_t* scans, uint64_t* dataBytes)
+{
+    const volatile MCCRecordingHeader* header = (const volatile MCCRecordingHeader*)map;
+    *scans = header->scanCount;
+    *dataBytes = header->dataBytes;
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+MCCRecorder::MCCRecorder(MCCDevice& device, const std::string& path, int numBlocks, int blockLength,
+                         uint64_t growScans, MCCEncoding encoding)
+:   mRing(numBlocks, blockLength > 0 ? blockLength : device.mSamplesPerBlock * device.getChannelCount()),
+    fd(-1), mChannelCount(device.getChannelCount()), mEncoding(encoding), mMap(NULL), mMapBytes(0), mGrowBytes(0),
+    mScans(0), mDataBytes(0), mCodec(device.getChannelCount()), mChunkScans(0),
+    mBytesWritten(0), mScansWritten(0), mDropped(0), mStopRequested(false), mError(-1)
+{
+    if (mChannelCount > MCC_RECORDING_MAX_CHANNELS || mRing.blockLength() % mChannelCount != 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    if (mEncoding == MCC_ENCODING_DELTA)
+    {
+        mChunk.resize((size_t)MCC_RECORDING_CHUNK_SCANS * mChannelCount);
+        mEncoded.resize(sizeof(MCCChunkHeader) + MCCDeltaCodec::maxEncodedSize(mChannelCount, MCC_RECORDING_CHUNK_SCANS));
+    }
+
+#ifdef _WIN32
+    //Recordings are files mapped with mmap, which Windows does not have.
+    throw MCC_ERR_FILE_IO;
+#else
+    //Grow in steps of whole pages, at least one block.
+    uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+    if (growScans == 0)
+        growScans = (uint64_t)(device.sampRate * 60);
+    mGrowBytes = std::max(growScans * mChannelCount, (uint64_t)mRing.blockLength()) * sizeof(unsigned short);
+    if (mEncoding == MCC_ENCODING_DELTA)
+        mGrowBytes = std::max(mGrowBytes, (uint64_t)mEncoded.size());
+    mGrowBytes = (mGrowBytes + pageSize - 1) / pageSize * pageSize;
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw MCC_ERR_FILE_IO;
+    try
+    {
+        grow(MCC_RECORDING_HEADER_SIZE + mGrowBytes);
+    }
+    catch(mcc_err err)
+    {
+        unmap();
+        ::close(fd);
+        throw err;
+    }
+
+    MCCRecordingHeader* header = (MCCRecordingHeader*)mMap;
+    MCCCalibrationEntry cal = device.getCalibration();
+    memcpy(header->magic, MCC_RECORDING_MAGIC, sizeof(header->magic));
+    header->version = MCC_RECORDING_VERSION;
+    header->headerSize = MCC_RECORDING_HEADER_SIZE;
+    header->idProduct = device.getProductId();
+    header->lowChan = cal.lowChan;
+    header->highChan = cal.highChan;
+    header->channelCount = mChannelCount;
+    header->maxCounts = device.getMaxCounts();
+    header->complete = 0;
+    header->sampRate = device.sampRate;
+    header->startTime = (int64_t)time(NULL);
+    header->scanCount = 0;
+    strncpy(header->serialNumber, device.getSerialNumber().c_str(), sizeof(header->serialNumber) - 1);
+    for (int i = 0; i < mChannelCount; i++)
+    {
+        header->calSlope[i] = cal.channels[i].slope;
+        header->calOffset[i] = cal.channels[i].offset;
+        header->minVoltage[i] = cal.channels[i].minVoltage;
+        header->maxVoltage[i] = cal.channels[i].maxVoltage;
+    }
+    header->encoding = mEncoding;
+    header->scansPerChunk = mEncoding == MCC_ENCODING_DELTA ? MCC_RECORDING_CHUNK_SCANS : 0;
+    header->dataBytes = 0;
+    header->indexOffset = 0;
+    header->chunkCount = 0;
+
+    mThread = std::thread(&MCCRecorder::run, this);
+#endif
+}
+
+MCCRecorder::~MCCRecorder()
+{
+    try
+    {
+        close();
+    }
+    catch(mcc_err err)
+    {
+        //Nothing to report it to. Call close() first to see writer errors.
+    }
+}
+
+bool MCCRecorder::append(const unsigned short* data)
+{
+    unsigned short* slot = mRing.writeSlot();
+    if (!slot)
+    {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    memcpy(slot, data, sizeof(unsigned short) * mRing.blockLength());
+    mRing.commitWrite();
+    mWakeCond.notify_one();  //Without the mutex: a missed wake-up costs at most WRITER_POLL_MS.
+    return true;
+}
+
+void MCCRecorder::close()
+{
+    if (mThread.joinable())
+    {
+        mStopRequested = true;
+        mWakeCond.notify_one();
+        mThread.join();
+    }
+    if (fd < 0)
+        return;
+
+#ifndef _WIN32
+    //The writer has stopped, so its state is ours now. Append the chunk index after the data.
+    uint64_t end = MCC_RECORDING_HEADER_SIZE + mDataBytes;
+    if (mMap && mEncoding == MCC_ENCODING_DELTA && mError.load() < 0)
+    {
+        try
+        {
+            uint64_t indexBytes = mChunkOffsets.size() * sizeof(uint64_t);
+            reserve(indexBytes);
+            if (indexBytes > 0)
+                memcpy(mMap + end, mChunkOffsets.data(), indexBytes);
+            ((MCCRecordingHeader*)mMap)->indexOffset = end;
+            ((MCCRecordingHeader*)mMap)->chunkCount = mChunkOffsets.size();
+            end += indexBytes;
+        }
+        catch(mcc_err err)
+        {
+            mError = err;
+        }
+    }
+    if (mMap)
+    {
+        ((MCCRecordingHeader*)mMap)->complete = 1;
+        publishProgress(mMap, mScans, mDataBytes);
+        msync(mMap, mMapBytes, MS_SYNC);
+    }
+    unmap();
+    int err = ftruncate(fd, end);
+    ::close(fd);
+    fd = -1;
+
+    if (mError.load() >= 0)
+        throw (mcc_err)mError.load();
+    if (err != 0)
+        throw MCC_ERR_FILE_IO;
+#endif
+}
+
+void MCCRecorder::run()
+{
+    try
+    {
+        while (true)
+        {
+            const unsigned short* block = mRing.readSlot();
+            if (!block)
+            {
+                //close() comes after the last append(), so once stop is seen an empty ring stays empty.
+                if (mStopRequested.load() && mRing.available() == 0)
+                    break;
+                std::unique_lock<std::mutex> lock(mWakeMutex);
+                mWakeCond.wait_for(lock, std::chrono::milliseconds(WRITER_POLL_MS),
+                                   [this]{ return mRing.available() > 0 || mStopRequested.load(); });
+                continue;
+            }
+            writeBlock(block);
+            mRing.commitRead();
+        }
+        if (mEncoding == MCC_ENCODING_DELTA)
+            flushChunk();
+    }
+    catch(mcc_err err)
+    {
+        mError = err;
+    }
+}
+
+void MCCRecorder::writeBlock(const unsigned short* block)
+{
+    const int scans = mRing.blockLength() / mChannelCount;
+
+    if (mEncoding == MCC_ENCODING_RAW)
+    {
+        uint64_t bytes = mRing.blockLength() * sizeof(unsigned short);
+        reserve(bytes);
+        memcpy(mMap + MCC_RECORDING_HEADER_SIZE + mDataBytes, block, bytes);
+        mDataBytes += bytes;
+        mScans += scans;
+        publish();
+        return;
+    }
+
+    //Blocks and chunks need not line up: fill the chunk, compress it when full, carry the rest over.
+    for (int done = 0; done < scans; )
+    {
+        int n = std::min(scans - done, MCC_RECORDING_CHUNK_SCANS - mChunkScans);
+        memcpy(&mChunk[(size_t)mChunkScans * mChannelCount], &block[(size_t)done * mChannelCount],
+               (size_t)n * mChannelCount * sizeof(unsigned short));
+        mChunkScans += n;
+        done += n;
+        if (mChunkScans == MCC_RECORDING_CHUNK_SCANS)
+            flushChunk();
+    }
+}
+
+void MCCRecorder::flushChunk()
+{
+    if (mChunkScans == 0)
+        return;
+
+    MCCChunkHeader chunk;
+    chunk.magic = MCC_RECORDING_CHUNK_MAGIC;
+    chunk.scanCount = mChunkScans;
+    chunk.firstScan = mScans;
+    chunk.bytes = (uint32_t)mCodec.encode(mChunk.data(), mChunkScans, &mEncoded[sizeof(MCCChunkHeader)]);
+    memcpy(&mEncoded[0], &chunk, sizeof(chunk));
+
+    uint64_t bytes = sizeof(MCCChunkHeader) + chunk.bytes;
+    reserve(bytes);
+    mChunkOffsets.push_back(MCC_RECORDING_HEADER_SIZE + mDataBytes);
+    memcpy(mMap + MCC_RECORDING_HEADER_SIZE + mDataBytes, mEncoded.data(), bytes);
+    mDataBytes += bytes;
+    mScans += mChunkScans;
+    mChunkScans = 0;
+    publish();
+}
+
+void MCCRecorder::publish()
+{
+    publishProgress(mMap, mScans, mDataBytes);
+    mBytesWritten.store(mDataBytes, std::memory_order_relaxed);
+    mScansWritten.store(mScans, std::memory_order_release);
+}
+
+void MCCRecorder::reserve(uint64_t bytes)
+{
+    uint64_t needed = MCC_RECORDING_HEADER_SIZE + mDataBytes + bytes;
+    if (needed > mMapBytes)
+        grow(needed);
+}
+
+void MCCRecorder::grow(uint64_t minBytes)
+{
+#ifdef _WIN32
+    (void)minBytes;
+    throw MCC_ERR_FILE_IO;
+#else
+    uint64_t newBytes = std::max(minBytes, mMapBytes + mGrowBytes);
+    if (ftruncate(fd, newBytes) != 0)
+        throw MCC_ERR_FILE_IO;
+#ifdef __linux__
+    //Reserve the blocks now so a full disk shows up here, not as SIGBUS on a later memcpy.
+    if (posix_fallocate(fd, mMapBytes, newBytes - mMapBytes) != 0)
+        throw MCC_ERR_FILE_IO;
+#endif
+
+    unmap();
+    void* map = mmap(NULL, newBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        throw MCC_ERR_FILE_IO;
+    mMap = (unsigned char*)map;
+    mMapBytes = newBytes;
+#endif
+}
+
+void MCCRecorder::unmap()
+{
+#ifndef _WIN32
+    if (mMap)
+        munmap(mMap, mMapBytes);
+#endif
+    mMap = NULL;
+}
+
+MCCRecordingReader::MCCRecordingReader(const std::string& path)
+:   fd(-1), mMap(NULL), mMapBytes(0), mScanCount(0), mWalkOffset(0), mDecodedChunk(NO_CHUNK)
+{
+#ifdef _WIN32
+    throw MCC_ERR_FILE_IO;
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw MCC_ERR_FILE_IO;
+    try
+    {
+        remap();
+        if (mMapBytes < MCC_RECORDING_HEADER_SIZE)
+            throw MCC_ERR_BAD_FILE_FORMAT;
+        const MCCRecordingHeader& h = header();
+        if (memcmp(h.magic, MCC_RECORDING_MAGIC, sizeof(h.magic)) != 0 || h.version != MCC_RECORDING_VERSION
+            || h.headerSize < sizeof(MCCRecordingHeader) || h.channelCount <= 0 || h.channelCount > MCC_RECORDING_MAX_CHANNELS
+            || h.encoding > MCC_ENCODING_DELTA || (h.encoding == MCC_ENCODING_DELTA && h.scansPerChunk == 0))
+            throw MCC_ERR_BAD_FILE_FORMAT;
+    }
+    catch(mcc_err err)
+    {
+        if (mMap)
+            munmap(mMap, mMapBytes);
+        ::close(fd);
+        throw err;
+    }
+
+    const MCCRecordingHeader& h = header();
+    mConverter.setCalibration(h.channelCount, h.calSlope, h.calOffset,
+                              (const int*)h.minVoltage, (const int*)h.maxVoltage, (unsigned short)h.maxCounts);
+    mWalkOffset = h.headerSize;
+    if (h.encoding == MCC_ENCODING_DELTA)
+        mDecoded.resize((size_t)h.scansPerChunk * h.channelCount);
+    scanCount();
+#endif
+}
+
+MCCRecordingReader::~MCCRecordingReader()
+{
+#ifndef _WIN32
+    if (mMap)
+        munmap(mMap, mMapBytes);
+    ::close(fd);
+#endif
+}
+
+void MCCRecordingReader::remap()
+{
+#ifdef _WIN32
+    throw MCC_ERR_FILE_IO;
+#else
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        throw MCC_ERR_FILE_IO;
+    if ((uint64_t)st.st_size == mMapBytes)
+        return;
+
+    if (mMap)
+        munmap(mMap, mMapBytes);
+    mMap = NULL;
+    mMapBytes = 0;
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        throw MCC_ERR_FILE_IO;
+    mMap = (unsigned char*)map;
+    mMapBytes = st.st_size;
+#endif
+}
+
+uint64_t MCCRecordingReader::scanCount()
+{
+    uint64_t scans, dataBytes;
+    readProgress(mMap, &scans, &dataBytes);
+    const uint64_t headerSize = header().headerSize;
+
+    if (header().encoding == MCC_ENCODING_RAW)
+    {
+        const uint64_t frameBytes = header().channelCount * sizeof(unsigned short);
+        if (headerSize + scans * frameBytes > mMapBytes)
+            remap();
+        //Never hand out samples past the end of the mapping, whatever the header claims.
+        mScanCount = std::min(scans, (mMapBytes - headerSize) / frameBytes);
+        return mScanCount;
+    }
+
+    if (headerSize + dataBytes > mMapBytes)
+        remap();
+    findChunks(std::min(dataBytes, mMapBytes - headerSize));
+    return mScanCount;
+}
+
+//Index compressed chunks. A closed file has the index at indexOffset; one still being written
+//(or never closed) is walked chunk header by chunk header, up to dataBytes.
+void MCCRecordingReader::findChunks(uint64_t dataBytes)
+{
+    const MCCRecordingHeader& h = header();
+    const uint64_t end = h.headerSize + dataBytes;
+
+    if (h.complete && h.indexOffset && mChunkOffsets.empty()
+        && h.indexOffset + h.chunkCount * sizeof(uint64_t) <= mMapBytes)
+    {
+        mChunkOffsets.resize(h.chunkCount);
+        memcpy(mChunkOffsets.data(), mMap + h.indexOffset, h.chunkCount * sizeof(uint64_t));
+        mWalkOffset = end;
+        mScanCount = h.scanCount;
+        return;
+    }
+
+    while (mWalkOffset + sizeof(MCCChunkHeader) <= end)
+    {
+        MCCChunkHeader chunk;
+        memcpy(&chunk, mMap + mWalkOffset, sizeof(chunk));
+        if (chunk.magic != MCC_RECORDING_CHUNK_MAGIC || chunk.firstScan != mScanCount)
+            throw MCC_ERR_BAD_FILE_FORMAT;
+        if (mWalkOffset + sizeof(chunk) + chunk.bytes > end)
+            break;
+        mChunkOffsets.push_back(mWalkOffset);
+        mScanCount += chunk.scanCount;
+        mWalkOffset += sizeof(chunk) + chunk.bytes;
+    }
+}
+
+bool MCCRecordingReader::isComplete() const
+{
+    return ((const volatile MCCRecordingHeader*)mMap)->complete != 0;
+}
+
+const unsigned short* MCCRecordingReader::chunk(uint64_t index)
+{
+    if (index >= mChunkOffsets.size())
+        return NULL;
+    if (index == mDecodedChunk)
+        return mDecoded.data();
+
+    MCCChunkHeader chunk;
+    uint64_t offset = mChunkOffsets[index];
+    memcpy(&chunk, mMap + offset, sizeof(chunk));
+    if (chunk.magic != MCC_RECORDING_CHUNK_MAGIC || chunk.scanCount > header().scansPerChunk
+        || offset + sizeof(chunk) + chunk.bytes > mMapBytes)
+        throw MCC_ERR_BAD_FILE_FORMAT;
+
+    MCCDeltaCodec codec(header().channelCount);
+    mDecodedChunk = NO_CHUNK;
+    if (!codec.decode(mMap + offset + sizeof(chunk), chunk.bytes, chunk.scanCount, mDecoded.data()))
+        throw MCC_ERR_BAD_FILE_FORMAT;
+    mDecodedChunk = index;
+    return mDecoded.data();
+}
+
+const unsigned short* MCCRecordingReader::scans(uint64_t first, uint64_t count)
+{
+    if (header().encoding != MCC_ENCODING_RAW)
+        return NULL;
+    if (first + count > mScanCount && first + count > scanCount())
+        return NULL;
+    return (const unsigned short*)(mMap + header().headerSize) + first * header().channelCount;
+}
+
+bool MCCRecordingReader::read(uint64_t first, uint64_t count, unsigned short* out)
+{
+    const int channels = header().channelCount;
+
+    if (header().encoding == MCC_ENCODING_RAW)
+    {
+        const unsigned short* data = scans(first, count);
+        if (!data)
+            return false;
+        memcpy(out, data, count * channels * sizeof(unsigned short));
+        return true;
+    }
+
+    if (first + count > mScanCount && first + count > scanCount())
+        return false;
+    //Every chunk but the last holds scansPerChunk scans, so the chunk of any scan is a division away.
+    const uint64_t perChunk = header().scansPerChunk;
+    while (count > 0)
+    {
+        const unsigned short* decoded = chunk(first / perChunk);
+        uint64_t offset = first % perChunk;
+        uint64_t n = std::min(count, perChunk - offset);
+        memcpy(out, decoded + offset * channels, n * channels * sizeof(unsigned short));
+        out += n * channels;
+        first += n;
+        count -= n;
+    }
+    return true;
+}
+
+const unsigned short* MCCRecordingReader::slice(uint64_t first, uint64_t count)
+{
+    if (header().encoding == MCC_ENCODING_RAW)
+        return scans(first, count);
+    mScratch.resize(count * header().channelCount);
+    return read(first, count, mScratch.data()) ? mScratch.data() : NULL;
+}
+
+bool MCCRecordingReader::convert(uint64_t first, uint64_t count, float* out, MCCLayout layout)
+{
+    const unsigned short* data = slice(first, count);
+    if (!data)
+        return false;
+    mConverter.convert(data, out, (int)(count * header().channelCount), layout);
+    return true;
+}
+
+bool MCCRecordingReader::convertMicrovolts(uint64_t first, uint64_t count, int32_t* out, MCCLayout layout)
+{
+    const unsigned short* data = slice(first, count);
+    if (!data)
+        return false;
+    mConverter.convertMicrovolts(data, out, (int)(count * header().channelCount), layout);
+    return true;
+}
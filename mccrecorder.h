@@ -0,0 +1,187 @@
+//
+//  mccrecorder.h
+//  Recording raw counts to disk without slowing acquisition down.
+//  MCCRecorder::append only copies a block into a lock-free ring; a background thread moves it
+//  into a memory-mapped file that is preallocated and grown in large steps, so the acquisition
+//  thread never waits on the disk. MCCRecordingReader maps a finished or still-growing file and
+//  converts any slice to volts on demand.
+//
+//  File layout (native byte order, little-endian on every supported platform):
+//      MCCRecordingHeader, padded to headerSize bytes
+//      MCC_ENCODING_RAW:   scanCount scans of channelCount unsigned short counts, interleaved as the device sends them
+//      MCC_ENCODING_DELTA: chunks of scansPerChunk scans, each an MCCChunkHeader and MCCDeltaCodec output,
+//                          then (once closed) the chunk index: chunkCount uint64 file offsets of the chunks
+//  While recording, the file is longer than the data; scanCount and dataBytes say how much of it
+//  is valid. Closing the recorder writes the index, truncates the file and sets complete.
+//  Both classes map the file with mmap, so on Windows their constructors throw MCC_ERR_FILE_IO.
+//
+
+#ifndef ____mccrecorder__
+#define ____mccrecorder__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mccdevice.h"
+#include "mccring.h"
+#include "mcccodec.h"
+
+#define MCC_RECORDING_MAGIC         "MCCREC01"
+#define MCC_RECORDING_VERSION       1
+#define MCC_RECORDING_HEADER_SIZE   4096
+#define MCC_RECORDING_MAX_CHANNELS  64
+#define MCC_RECORDING_CHUNK_MAGIC   0x4B4E4843  //"CHNK"
+#define MCC_RECORDING_CHUNK_SCANS   4096        //Scans per compressed chunk: the unit of random access.
+
+enum MCCEncoding
+{
+    MCC_ENCODING_RAW,       //Counts as they came from the device.
+    MCC_ENCODING_DELTA,     //Chunks compressed with MCCDeltaCodec, typically 2-4x smaller.
+};
+
+//Everything reconfigure() found out, so a file can be converted without the device.
+struct MCCRecordingHeader
+{
+    char magic[8];              //MCC_RECORDING_MAGIC, not NUL-terminated.
+    uint32_t version;
+    uint32_t headerSize;        //Offset of the first sample.
+    int32_t idProduct;
+    int32_t lowChan;
+    int32_t highChan;
+    int32_t channelCount;
+    uint32_t maxCounts;
+    uint32_t complete;          //1 once the recorder has closed the file.
+    double sampRate;
+    int64_t startTime;          //Wall clock at the start of the recording, seconds since 1970.
+    uint64_t scanCount;         //Valid scans in the file. Grows while recording.
+    char serialNumber[32];      //DEV:MFGSER, NUL-terminated.
+    float calSlope[MCC_RECORDING_MAX_CHANNELS];
+    float calOffset[MCC_RECORDING_MAX_CHANNELS];
+    int32_t minVoltage[MCC_RECORDING_MAX_CHANNELS];
+    int32_t maxVoltage[MCC_RECORDING_MAX_CHANNELS];
+    uint32_t encoding;          //MCCEncoding.
+    uint32_t scansPerChunk;     //MCC_ENCODING_DELTA: scans in every chunk but the last.
+    uint64_t dataBytes;         //Valid bytes after the header. Grows while recording.
+    uint64_t indexOffset;       //MCC_ENCODING_DELTA: file offset of the chunk index, 0 until closed.
+    uint64_t chunkCount;        //Entries in the chunk index.
+};
+
+//Precedes every compressed chunk, so a file that is still growing (or was never closed) can be walked.
+struct MCCChunkHeader
+{
+    uint32_t magic;             //MCC_RECORDING_CHUNK_MAGIC
+    uint32_t scanCount;
+    uint64_t firstScan;
+    uint32_t bytes;             //Encoded bytes following this header.
+    uint32_t reserved;
+};
+
+class MCCRecorder
+{
+public:
+    //Create (or truncate) path with a header describing device's current scan, and start the writer.
+    //append() takes blocks of blockLength samples (0: the device's mSamplesPerBlock scans); numBlocks
+    //of them can be waiting for the writer. The file grows growScans scans at a time (0: one minute).
+    //With MCC_ENCODING_DELTA the writer thread also compresses, so append() costs the same either way.
+    MCCRecorder(MCCDevice& device, const std::string& path, int numBlocks = 256, int blockLength = 0,
+                uint64_t growScans = 0, MCCEncoding encoding = MCC_ENCODING_RAW);
+    ~MCCRecorder();
+
+    //Queue one block for writing. Never blocks; returns false and counts the block as dropped if
+    //the writer is that far behind. Call from one thread only.
+    bool append(const unsigned short* data);
+    //Write everything queued, stop the writer, trim the file and mark it complete. Throws the
+    //writer's mcc_err if it failed.
+    void close();
+
+    int blockLength() const { return mRing.blockLength(); }
+    uint64_t scansWritten() const { return mScansWritten.load(std::memory_order_acquire); }
+    uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+    uint64_t bytesWritten() const { return mBytesWritten.load(std::memory_order_relaxed); }  //Data bytes, header excluded.
+
+private:
+    MCCBlockRing mRing;
+    int fd;
+    int mChannelCount;
+    MCCEncoding mEncoding;
+    unsigned char* mMap;        //The whole file, header included.
+    uint64_t mMapBytes;
+    uint64_t mGrowBytes;
+    //Writer thread state
+    uint64_t mScans;
+    uint64_t mDataBytes;
+    MCCDeltaCodec mCodec;
+    std::vector<unsigned short> mChunk;     //Scans waiting to be compressed.
+    int mChunkScans;
+    std::vector<uint8_t> mEncoded;
+    std::vector<uint64_t> mChunkOffsets;
+    std::atomic<uint64_t> mBytesWritten;
+    std::atomic<uint64_t> mScansWritten;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<bool> mStopRequested;
+    std::atomic<int> mError;
+    std::thread mThread;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCond;
+
+    void run();
+    void writeBlock(const unsigned short* block);
+    void flushChunk();
+    void publish();                 //Make mScans and mDataBytes visible to readers.
+    void reserve(uint64_t bytes);   //Make room for bytes more after the data. Writer thread only.
+    void grow(uint64_t minBytes);   //Extend the file and remap it.
+    void unmap();
+};
+
+class MCCRecordingReader
+{
+public:
+    explicit MCCRecordingReader(const std::string& path);
+    ~MCCRecordingReader();
+
+    const MCCRecordingHeader& header() const { return *(const MCCRecordingHeader*)mMap; }
+    int channelCount() const { return header().channelCount; }
+    //Valid scans now. For a file still being recorded this picks up whatever has been written since the last call.
+    uint64_t scanCount();
+    bool isComplete() const;
+
+    MCCEncoding encoding() const { return (MCCEncoding)header().encoding; }
+
+    //Raw counts of scans [first, first + count) in place, or NULL if they are not all in the file
+    //yet or the file is compressed. The pointer stays valid until the next call on this reader.
+    const unsigned short* scans(uint64_t first, uint64_t count);
+    //Copy (decompressing if needed) scans [first, first + count) into out. Returns false if out of range.
+    bool read(uint64_t first, uint64_t count, unsigned short* out);
+    //Convert scans [first, first + count) with the calibration in the header. Returns false if out of range.
+    bool convert(uint64_t first, uint64_t count, float* out, MCCLayout layout = MCC_LAYOUT_INTERLEAVED);
+    bool convertMicrovolts(uint64_t first, uint64_t count, int32_t* out, MCCLayout layout = MCC_LAYOUT_INTERLEAVED);
+    const MCCConverter& getConverter() const { return mConverter; }
+
+    //Compressed files: chunks found so far (call scanCount() to pick up new ones), and one decoded
+    //chunk (header().scansPerChunk scans, fewer for the last). Throws MCC_ERR_BAD_FILE_FORMAT if it is corrupt.
+    uint64_t chunkCount() const { return mChunkOffsets.size(); }
+    const unsigned short* chunk(uint64_t index);
+
+private:
+    int fd;
+    unsigned char* mMap;
+    uint64_t mMapBytes;
+    uint64_t mScanCount;
+    MCCConverter mConverter;
+    //Compressed files
+    std::vector<uint64_t> mChunkOffsets;
+    uint64_t mWalkOffset;               //Where the next chunk header is expected while the file grows.
+    std::vector<unsigned short> mDecoded;
+    uint64_t mDecodedChunk;             //Chunk held in mDecoded, or UINT64_MAX.
+    std::vector<unsigned short> mScratch;
+
+    void remap();
+    void findChunks(uint64_t dataBytes);
+    const unsigned short* slice(uint64_t first, uint64_t count);   //In place or assembled in mScratch.
+};
+
+#endif /* defined(____mccrecorder__) */
@@ -0,0 +1,112 @@
+//
+//  mccring.h
+//  Lock-free single-producer/single-consumer rings.
+//  Exactly one thread may write and exactly one thread may read. Neither side ever blocks
+//  or allocates; a full ring refuses the write and the producer decides what to drop.
+//
+
+#ifndef ____mccring__
+#define ____mccring__
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+//Ring of fixed-size elements (events, small records).
+template<class T>
+class MCCSpscQueue
+{
+public:
+    MCCSpscQueue(size_t capacity)
+    :   mBuffer(capacity + 1), mHead(0), mTail(0)
+    {}
+
+    //Producer side. Returns false if the queue is full.
+    bool push(const T& value)
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        size_t next = (head + 1) % mBuffer.size();
+        if (next == mTail.load(std::memory_order_acquire))
+            return false;
+        mBuffer[head] = value;
+        mHead.store(next, std::memory_order_release);
+        return true;
+    }
+
+    //Consumer side. Returns false if the queue is empty.
+    bool pop(T& value)
+    {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire))
+            return false;
+        value = mBuffer[tail];
+        mTail.store((tail + 1) % mBuffer.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return mTail.load(std::memory_order_acquire) == mHead.load(std::memory_order_acquire); }
+    size_t capacity() const { return mBuffer.size() - 1; }
+
+private:
+    std::vector<T> mBuffer;
+    alignas(64) std::atomic<size_t> mHead;  //Next slot to write. Owned by the producer.
+    alignas(64) std::atomic<size_t> mTail;  //Next slot to read. Owned by the consumer.
+};
+
+//Ring of sample blocks, each blockLength samples long, stored contiguously.
+//The producer fills writeSlot() in place and publishes it with commitWrite();
+//the consumer reads readSlot() in place and frees it with commitRead().
+class MCCBlockRing
+{
+public:
+    MCCBlockRing(int numBlocks, int blockLength)
+    :   mNumBlocks(numBlocks), mBlockLength(blockLength),
+        mStorage((size_t)numBlocks * blockLength), mWritten(0), mRead(0)
+    {}
+
+    //Empty the ring and give it a new shape. Only while neither side is running.
+    void reset(int numBlocks, int blockLength)
+    {
+        mNumBlocks = numBlocks;
+        mBlockLength = blockLength;
+        mStorage.assign((size_t)numBlocks * blockLength, 0);
+        mWritten.store(0, std::memory_order_relaxed);
+        mRead.store(0, std::memory_order_relaxed);
+    }
+
+    //Producer side. nullptr if the ring is full.
+    unsigned short* writeSlot()
+    {
+        unsigned long long written = mWritten.load(std::memory_order_relaxed);
+        if (written - mRead.load(std::memory_order_acquire) >= (unsigned long long)mNumBlocks)
+            return nullptr;
+        return &mStorage[(size_t)(written % mNumBlocks) * mBlockLength];
+    }
+    void commitWrite() { mWritten.store(mWritten.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    //Consumer side. nullptr if the ring is empty.
+    const unsigned short* readSlot() const
+    {
+        unsigned long long read = mRead.load(std::memory_order_relaxed);
+        if (read == mWritten.load(std::memory_order_acquire))
+            return nullptr;
+        return &mStorage[(size_t)(read % mNumBlocks) * mBlockLength];
+    }
+    void commitRead() { mRead.store(mRead.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    int available() const { return (int)(mWritten.load(std::memory_order_acquire) - mRead.load(std::memory_order_acquire)); }
+    int numBlocks() const { return mNumBlocks; }
+    int blockLength() const { return mBlockLength; }
+    //The whole backing store, e.g. to prefault it before the producer starts.
+    void* storage() { return mStorage.data(); }
+    size_t storageBytes() const { return mStorage.size() * sizeof(unsigned short); }
+
+private:
+    int mNumBlocks;
+    int mBlockLength;
+    std::vector<unsigned short> mStorage;
+    alignas(64) std::atomic<unsigned long long> mWritten;  //Blocks published. Owned by the producer.
+    alignas(64) std::atomic<unsigned long long> mRead;     //Blocks consumed. Owned by the consumer.
+};
+
+#endif /* defined(____mccring__) */
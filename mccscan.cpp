@@ -0,0 +1,201 @@
+//
+//  mccscan.cpp
+//
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "mccscan.h"
+#include "mccclock.h"
+
+MCCScanController::MCCScanController(MCCDevice& device, int bufferScans, bool autoRestart, double statusInterval)
+:   device(device), mBufferScans(bufferScans), mAutoRestart(autoRestart), mStatusInterval(statusInterval),
+    mBlock((size_t)device.mSamplesPerBlock * device.getChannelCount()), mFilled(0),
+    mScanBase(0), mNextScan(0), mPendingLoss(0), mLostScans(0), mRunStart(0),
+    mStatus(MCC_SCAN_UNKNOWN), mBufferBytes(0), mFill(0), mPeakFill(0), mPolling(false), mLastPoll(0), mLastData(0),
+    mReceivedAtPoll(0)
+{
+}
+
+void MCCScanController::start()
+{
+    const int channels = device.getChannelCount();
+
+    if (mBufferScans > 0)
+        device.execute(MCCCommand::set("AISCAN:BUFSIZE", mBufferScans * channels * 2));
+    device.execute(MCCCommand::set("AISCAN:BUFOVERWRITE", "DISABLE"));
+    try
+    {
+        mBufferBytes = device.queryInt(MCCCommand::query("AISCAN:BUFSIZE"));
+    }
+    catch(mcc_err err)
+    {
+        if (err != MCC_ERR_BAD_RESPONSE)
+            throw err;
+        mBufferBytes = 0;   //Not reported; bufferFill() stays 0.
+    }
+
+    mBlock.assign((size_t)device.mSamplesPerBlock * channels, 0);
+    mFilled = 0;
+    mScanBase = mNextScan = 0;
+    mPendingLoss = mLostScans = 0;
+    mOverruns.clear();
+    mFill = mPeakFill = 0;
+    mRunStart = startScan();
+    mStatus = MCC_SCAN_RUNNING;
+    mLastPoll = mLastData = mccHostTime();
+}
+
+//Send AISCAN:START and return the host time the scan started, halfway through the exchange.
+double MCCScanController::startScan()
+{
+    double before = mccHostTime();
+    device.execute(MCCCommand::raw("AISCAN:START"));
+    return (before + mccHostTime()) / 2;
+}
+
+void MCCScanController::stop()
+{
+    if (mPolling)
+    {
+        mStatusReply.wait();
+        mCountReply.wait();
+        mPolling = false;
+    }
+    device.execute(MCCCommand::raw("AISCAN:STOP"));
+    mStatus = MCC_SCAN_IDLE;
+}
+
+bool MCCScanController::read(unsigned short* data, MCCScanBlock* block, unsigned int timeout)
+{
+    const int length = blockLength();
+    const double deadline = mccHostTime() + timeout / 1000.0;
+
+    while (mFilled < length)
+    {
+        poll(false);
+        //Read in slices so the status is polled while waiting.
+        double now = mccHostTime();
+        double slice = std::max(0.0, std::min(deadline - now, mStatusInterval));
+        int n = device.readScanData(&mBlock[mFilled], length - mFilled, (unsigned int)(slice * 1000));
+        mFilled += n;
+        now = mccHostTime();
+        if (n > 0)
+        {
+            mLastData = now;
+        }
+        else if (now - mLastData >= mStatusInterval)
+        {
+            //Nothing for a while: ask whether the scan is still running.
+            mLastData = now;
+            poll(true);
+            if (mStatus == MCC_SCAN_OVERRUN)
+            {
+                recover();
+                continue;
+            }
+        }
+        if (mFilled < length && now >= deadline)
+            return false;
+    }
+
+    memcpy(data, mBlock.data(), sizeof(unsigned short) * length);
+    block->firstScan = mNextScan;
+    block->lostScans = mPendingLoss;
+    block->timestamp = device.getScanTimestamp(mNextScan - mScanBase);
+    mNextScan += device.mSamplesPerBlock;
+    mPendingLoss = 0;
+    mFilled = 0;
+    return true;
+}
+
+//Collect the last status poll if its replies are in (or, with wait, wait for them) and start the next one when it is due.
+void MCCScanController::poll(bool wait)
+{
+    static const MCCCommand statusQuery = MCCCommand::query("AISCAN:STATUS");
+    static const MCCCommand countQuery = MCCCommand::query("AISCAN:COUNT");
+    double now = mccHostTime();
+
+    if (!mPolling && (wait || now - mLastPoll >= mStatusInterval))
+    {
+        mStatusReply = device.submit(statusQuery);
+        mCountReply = device.submit(countQuery);
+        mReceivedAtPoll = device.getSamplesReceived();
+        mLastPoll = now;
+        mPolling = true;
+    }
+    if (!mPolling)
+        return;
+    if (!wait && (mStatusReply.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+                  || mCountReply.wait_for(std::chrono::seconds(0)) != std::future_status::ready))
+        return;
+
+    mPolling = false;
+    MCCResponse status = mStatusReply.get();
+    MCCResponse count = mCountReply.get();
+    const char* value = status.value(statusQuery);
+    mStatus = value ? parseStatus(value) : MCC_SCAN_UNKNOWN;
+
+    //COUNT is samples acquired since AISCAN:START; what has not arrived yet is still in the FIFO (or on the bus).
+    double acquired;
+    if (mBufferBytes > 0 && count.toDouble(countQuery, &acquired))
+    {
+        mFill = std::max(0.0, (acquired - (double)mReceivedAtPoll) * 2 / mBufferBytes);
+        mPeakFill = std::max(mPeakFill, mFill);
+    }
+}
+
+MCCScanStatus MCCScanController::parseStatus(const char* value)
+{
+    if (strcmp(value, "RUNNING") == 0)
+        return MCC_SCAN_RUNNING;
+    if (strcmp(value, "IDLE") == 0)
+        return MCC_SCAN_IDLE;
+    if (strcmp(value, "OVERRUN") == 0)
+        return MCC_SCAN_OVERRUN;
+    return MCC_SCAN_UNKNOWN;
+}
+
+//The FIFO overran and the scan stopped; everything it held has been read. Restart the scan and
+//account for the scans acquired neither before the overrun nor after the restart.
+void MCCScanController::recover()
+{
+    const unsigned long long partial = mFilled / device.getChannelCount();
+    const double detected = mccHostTime();
+
+    MCCScanOverrun overrun;
+    overrun.detected = detected;
+    if (!mAutoRestart)
+    {
+        overrun.scan = mNextScan + partial;
+        overrun.lostScans = partial;
+        overrun.lostSamples = partial * device.getChannelCount();
+        mOverruns.push_back(overrun);
+        throw MCC_ERR_SCAN_OVERRUN;
+    }
+
+    //The FIFO was read until nothing more came, so only transfers the stream still holds need dropping.
+    device.execute(MCCCommand::raw("AISCAN:STOP"));
+    if (device.isStreaming())
+        device.resetStream();
+    double restarted = startScan();
+
+    //Scans the old run would have produced by now, less the ones delivered. Measured from AISCAN:START
+    //at the nominal rate: the clock fit is thrown off by the burst of buffered data before an overrun.
+    double due = floor((restarted - mRunStart) * device.sampRate + 0.5);
+    unsigned long long lost = (unsigned long long)std::max(0.0, due - (double)(mNextScan - mScanBase));
+    lost = std::max(lost, partial);
+    mRunStart = restarted;
+    overrun.scan = mNextScan + lost;
+    overrun.lostScans = lost;
+    overrun.lostSamples = lost * device.getChannelCount();
+    mOverruns.push_back(overrun);
+
+    mScanBase = mNextScan = mNextScan + lost;
+    mPendingLoss += lost;
+    mLostScans += lost;
+    mFilled = 0;
+    mStatus = MCC_SCAN_RUNNING;
+    mLastData = mLastPoll = restarted;
+}
@@ -0,0 +1,107 @@
+//
+//  mccscan.h
+//  Supervised analog scans.
+//  The device buffers scans in a FIFO of AISCAN:BUFSIZE bytes until the host reads them. If the
+//  host falls that far behind, the FIFO overruns: with AISCAN:BUFOVERWRITE=ENABLE the oldest
+//  samples are replaced without any sign in the data, with DISABLE the scan stops. MCCScanController
+//  always disables overwrite, polls ?AISCAN:STATUS and ?AISCAN:COUNT through the control queue to
+//  report how full the FIFO is, and on an overrun restarts the scan and marks the gap:
+//
+//      MCCScanController scan(dev, 32768);
+//      scan.start();
+//      MCCScanBlock block;
+//      if (scan.read(data, &block) && block.lostScans > 0)
+//          ...    //block.firstScan - block.lostScans .. block.firstScan - 1 never arrived.
+//
+//  Blocks are dev.mSamplesPerBlock scans, read with readScanData (or from the stream, if one is
+//  running). Scan numbers count on across restarts, lost scans included, so they stay proportional
+//  to time.
+//
+
+#ifndef ____mccscan__
+#define ____mccscan__
+
+#include <future>
+#include <vector>
+#include "mccdevice.h"
+
+enum MCCScanStatus
+{
+    MCC_SCAN_IDLE,
+    MCC_SCAN_RUNNING,
+    MCC_SCAN_OVERRUN,
+    MCC_SCAN_UNKNOWN,       //Not polled yet, or a reply this library does not know.
+};
+
+struct MCCScanBlock
+{
+    unsigned long long firstScan;   //Of the block, counted from start() across restarts.
+    unsigned long long lostScans;   //Scans missing right before this block; 0 unless the scan was restarted.
+    double timestamp;               //mccHostTime() of the first scan.
+};
+
+struct MCCScanOverrun
+{
+    unsigned long long scan;        //First scan after the gap.
+    unsigned long long lostScans;   //Including the scans of a partly read block, which are dropped.
+    unsigned long long lostSamples;
+    double detected;                //mccHostTime() when the overrun was found.
+};
+
+class MCCScanController
+{
+public:
+    //bufferScans sets AISCAN:BUFSIZE (0 keeps the device's). With autoRestart off, read() throws
+    //MCC_ERR_SCAN_OVERRUN instead of restarting. statusInterval is the seconds between status polls.
+    MCCScanController(MCCDevice& device, int bufferScans = 0, bool autoRestart = true, double statusInterval = 0.1);
+
+    //Configure the device buffer and send AISCAN:START. stop() sends AISCAN:STOP.
+    void start();
+    void stop();
+
+    //Read the next block (blockLength() samples) into data, waiting at most timeout ms. Returns
+    //false if it did not arrive in time; what did arrive is kept for the next call. An overrun is
+    //detected here: the remaining data is drained, the partial block is dropped, and the scan is
+    //restarted; the next block returned has lostScans set.
+    bool read(unsigned short* data, MCCScanBlock* block, unsigned int timeout = 2000);
+
+    int blockLength() const { return (int)mBlock.size(); }
+    MCCScanStatus status() const { return mStatus; }        //As of the last poll.
+    int bufferBytes() const { return mBufferBytes; }        //?AISCAN:BUFSIZE after start().
+    double bufferFill() const { return mFill; }             //Fraction of the FIFO waiting to be read, at the last poll.
+    double peakFill() const { return mPeakFill; }
+    const std::vector<MCCScanOverrun>& overruns() const { return mOverruns; }
+    unsigned long long lostScans() const { return mLostScans; }
+
+private:
+    MCCDevice& device;
+    int mBufferScans;
+    bool mAutoRestart;
+    double mStatusInterval;
+    std::vector<unsigned short> mBlock;     //Block being assembled.
+    int mFilled;                            //Samples in mBlock.
+    unsigned long long mScanBase;           //Scan number of device scan 0 of the current run.
+    unsigned long long mNextScan;           //Scan number of the next block.
+    unsigned long long mPendingLoss;        //Lost scans to report with the next block.
+    unsigned long long mLostScans;
+    std::vector<MCCScanOverrun> mOverruns;
+    double mRunStart;                       //mccHostTime() of the last AISCAN:START.
+    //Status polling
+    MCCScanStatus mStatus;
+    int mBufferBytes;
+    double mFill;
+    double mPeakFill;
+    bool mPolling;
+    double mLastPoll;
+    double mLastData;                       //mccHostTime() data last arrived.
+    unsigned long long mReceivedAtPoll;
+    std::future<MCCResponse> mStatusReply;
+    std::future<MCCResponse> mCountReply;
+
+    void poll(bool wait);
+    static MCCScanStatus parseStatus(const char* value);
+    void recover();
+    double startScan();
+};
+
+#endif /* defined(____mccscan__) */
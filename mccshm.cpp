@@ -0,0 +1,414 @@
+//
+//  mccshm.cpp
+//
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#include "mccshm.h"
+#include "mccclock.h"
+
+#define MCC_SHM_MAGIC 0x4d434353 //"MCCS"
+#define MCC_SHM_VERSION 1
+#define POLL_INTERVAL_US 200 //Where there is no futex.
+
+//The atomics are shared between processes, so they must not need a lock.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared memory ring needs lock-free atomics");
+
+//Layout of the shared memory object: this header, then numSlots slots of slotStride bytes.
+struct MCCShmHeader
+{
+    std::atomic<uint32_t> magic;        //Written last, so a reader never sees a half-built header.
+    uint32_t version;
+    uint32_t numSlots;
+    uint32_t slotSamples;
+    uint32_t slotStride;
+    uint32_t headerSize;
+    std::atomic<uint32_t> closed;
+    alignas(64) std::atomic<uint64_t> configSeq;    //Seqlock over config: odd while it is written.
+    MCCShmConfig config;
+    alignas(64) std::atomic<uint64_t> head;         //Blocks published.
+    std::atomic<uint32_t> futex;                    //Bumped with head, for readers to sleep on.
+    alignas(64) std::atomic<uint32_t> waiters;      //Readers asleep, so the publisher only wakes when needed.
+};
+
+//Followed by slotSamples samples.
+struct alignas(64) MCCShmSlot
+{
+    std::atomic<uint64_t> seq;      //2*sequence + 1 while block sequence is written, 2*sequence + 2 once it is complete.
+    uint64_t firstScan;
+    double timestamp;
+    uint32_t samples;
+    uint32_t generation;
+
+    unsigned short* data() { return (unsigned short*)(this + 1); }
+};
+
+static size_t headerSize()
+{
+    return (sizeof(MCCShmHeader) + 63) / 64 * 64;
+}
+
+static void futexWake(std::atomic<uint32_t>* word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+//Sleep until *word is no longer value or timeout seconds pass (spuriously, too).
+static void futexWait(std::atomic<uint32_t>* word, uint32_t value, double timeout)
+{
+#ifdef __linux__
+    struct timespec ts;
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1e9);
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, value, &ts, NULL, 0);
+#else
+    (void)word; (void)value;
+    std::this_thread::sleep_for(std::chrono::microseconds((long long)std::min(timeout * 1e6, (double)POLL_INTERVAL_US)));
+#endif
+}
+
+MCCShmPublisher::MCCShmPublisher(MCCDevice& device, const std::string& name, int numSlots, int slotSamples, int mode)
+:   device(device), mName(name), mNumSlots(numSlots), mSlotSamples(slotSamples), mSize(0), mHeader(NULL),
+    mNext(0), mPending(-1), mGeneration(0)
+{
+    if (mSlotSamples <= 0)
+        mSlotSamples = device.mSamplesPerBlock * device.getChannelCount();
+    if (numSlots <= 0 || mSlotSamples <= 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+    size_t stride = (sizeof(MCCShmSlot) + mSlotSamples*sizeof(unsigned short) + 63) / 64 * 64;
+    mSize = headerSize() + stride*numSlots;
+
+#ifdef _WIN32
+    (void)mode;
+    throw MCC_ERR_FILE_IO;
+#else
+    //A publisher that crashed leaves its object behind; start over rather than join its ring.
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, (mode_t)mode);
+    if (fd < 0)
+        throw MCC_ERR_FILE_IO;
+    fchmod(fd, (mode_t)mode);   //Past the umask.
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, (off_t)mSize) == 0)
+        memory = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        throw MCC_ERR_FILE_IO;
+    }
+
+    //The object starts zeroed, so every slot reads as empty.
+    mHeader = new (memory) MCCShmHeader();
+    mHeader->version = MCC_SHM_VERSION;
+    mHeader->numSlots = numSlots;
+    mHeader->slotSamples = mSlotSamples;
+    mHeader->slotStride = (uint32_t)stride;
+    mHeader->headerSize = (uint32_t)headerSize();
+    for (int i = 0; i < numSlots; i++)
+        new (slot(i)) MCCShmSlot();
+    publishConfig();
+    mHeader->magic.store(MCC_SHM_MAGIC, std::memory_order_release);
+#endif
+}
+
+MCCShmPublisher::~MCCShmPublisher()
+{
+#ifndef _WIN32
+    mHeader->closed.store(1, std::memory_order_release);
+    mHeader->futex.fetch_add(1);
+    futexWake(&mHeader->futex);
+    munmap(mHeader, mSize);
+    shm_unlink(mName.c_str());  //Readers keep their mappings until they detach.
+#endif
+}
+
+MCCShmSlot* MCCShmPublisher::slot(unsigned long long sequence) const
+{
+    return (MCCShmSlot*)((char*)mHeader + mHeader->headerSize + (size_t)(sequence % mNumSlots) * mHeader->slotStride);
+}
+
+void MCCShmPublisher::publishConfig()
+{
+    MCCCalibrationEntry calibration = device.getCalibration();
+    int channels = device.getChannelCount();
+    MCCShmConfig& config = mHeader->config;
+
+    if (channels > MCC_SHM_MAX_CHANNELS)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+    mGeneration = device.getConfigGeneration();
+
+    uint64_t seq = mHeader->configSeq.load(std::memory_order_relaxed);
+    mHeader->configSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    config.generation = mGeneration;
+    config.channelCount = channels;
+    config.lowChan = calibration.lowChan;
+    config.sampRate = device.sampRate;
+    config.maxCounts = device.getMaxCounts();
+    for (int i = 0; i < channels; i++)
+    {
+        config.calSlope[i] = calibration.channels[i].slope;
+        config.calOffset[i] = calibration.channels[i].offset;
+        config.minVoltage[i] = calibration.channels[i].minVoltage;
+        config.maxVoltage[i] = calibration.channels[i].maxVoltage;
+    }
+    mHeader->configSeq.store(seq + 2, std::memory_order_release);
+}
+
+unsigned short* MCCShmPublisher::beginBlock(int samples)
+{
+    if (samples <= 0 || samples > mSlotSamples)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+    if (device.getConfigGeneration() != mGeneration)
+        publishConfig();
+
+    //Readers still on the block this slot held see the odd count and know it is gone.
+    MCCShmSlot* s = slot(mNext);
+    s->seq.store(2*mNext + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mPending = samples;
+    return s->data();
+}
+
+void MCCShmPublisher::commitBlock(unsigned long long firstScan, double timestamp)
+{
+    if (mPending < 0)
+        return;
+    MCCShmSlot* s = slot(mNext);
+    s->firstScan = firstScan;
+    s->timestamp = timestamp;
+    s->samples = (uint32_t)mPending;
+    s->generation = mGeneration;
+    s->seq.store(2*mNext + 2, std::memory_order_release);
+    mPending = -1;
+    mNext++;
+
+    mHeader->head.store(mNext, std::memory_order_release);
+    //Sequentially consistent against the reader's waiters increment: either it sees the new
+    //futex value before sleeping, or this sees it waiting.
+    mHeader->futex.fetch_add(1);
+    if (mHeader->waiters.load() > 0)
+        futexWake(&mHeader->futex);
+}
+
+void MCCShmPublisher::publishBlock()
+{
+    int samples = device.mSamplesPerBlock * device.getChannelCount();
+    unsigned long long scan = device.getScanCount();
+    unsigned short* data = beginBlock(samples);
+    device.readScanData(data, samples);
+    commitBlock(scan, device.getScanTimestamp(scan));
+}
+
+void MCCShmPublisher::publish(const unsigned short* data, int samples, unsigned long long firstScan, double timestamp)
+{
+    memcpy(beginBlock(samples), data, samples*sizeof(unsigned short));
+    commitBlock(firstScan, timestamp);
+}
+
+MCCShmReader::MCCShmReader(const std::string& name)
+:   mName(name), mSize(0), mHeader(NULL), mNext(0), mLostBlocks(0), mHeld(NULL), mHeldSeq(0)
+{
+#ifdef _WIN32
+    throw MCC_ERR_FILE_IO;
+#else
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw MCC_ERR_FILE_IO;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < headerSize())
+    {
+        close(fd);
+        throw MCC_ERR_BAD_FILE_FORMAT;
+    }
+    mSize = (size_t)st.st_size;
+    void* memory = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        throw MCC_ERR_FILE_IO;
+
+    mHeader = (MCCShmHeader*)memory;
+    if (mHeader->magic.load(std::memory_order_acquire) != MCC_SHM_MAGIC || mHeader->version != MCC_SHM_VERSION
+        || mHeader->headerSize + (size_t)mHeader->numSlots * mHeader->slotStride > mSize)
+    {
+        munmap(memory, mSize);
+        throw MCC_ERR_BAD_FILE_FORMAT;
+    }
+    mNext = mHeader->head.load(std::memory_order_acquire);
+#endif
+}
+
+MCCShmReader::~MCCShmReader()
+{
+#ifndef _WIN32
+    munmap(mHeader, mSize);
+#endif
+}
+
+MCCShmSlot* MCCShmReader::slot(unsigned long long sequence) const
+{
+    return (MCCShmSlot*)((char*)mHeader + mHeader->headerSize + (size_t)(sequence % mHeader->numSlots) * mHeader->slotStride);
+}
+
+bool MCCShmReader::waitFor(unsigned long long sequence, double deadline)
+{
+    while (true)
+    {
+        uint32_t seen = mHeader->futex.load();
+        if (mHeader->head.load(std::memory_order_acquire) > sequence)
+            return true;
+        double now = mccHostTime();
+        if (isClosed() || now >= deadline)
+            return false;
+        mHeader->waiters.fetch_add(1);
+        if (mHeader->head.load() <= sequence)
+            futexWait(&mHeader->futex, seen, deadline - now);
+        mHeader->waiters.fetch_sub(1);
+    }
+}
+
+const unsigned short* MCCShmReader::acquire(MCCShmBlock* block, unsigned int timeout)
+{
+    double deadline = mccHostTime() + timeout / 1000.0;
+    unsigned long long lost = 0;
+
+    release();
+    while (waitFor(mNext, deadline))
+    {
+        //The slot after head may already be being rewritten, so the oldest safe block is one short of a ring.
+        unsigned long long head = mHeader->head.load(std::memory_order_acquire);
+        if (head - mNext >= mHeader->numSlots)
+        {
+            lost += head - mHeader->numSlots + 1 - mNext;
+            mNext = head - mHeader->numSlots + 1;
+        }
+
+        MCCShmSlot* s = slot(mNext);
+        uint64_t seq = s->seq.load(std::memory_order_acquire);
+        if (seq != 2*mNext + 2)
+        {
+            //Overwritten between reading head and the slot: count it and look again.
+            lost++;
+            mNext++;
+            continue;
+        }
+        block->sequence = mNext;
+        block->firstScan = s->firstScan;
+        block->timestamp = s->timestamp;
+        block->samples = (int)s->samples;
+        block->generation = s->generation;
+        block->lostBlocks = lost;
+        //The header fields were read under the same sequence number.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s->seq.load(std::memory_order_relaxed) != seq)
+        {
+            lost++;
+            mNext++;
+            continue;
+        }
+        mLostBlocks += lost;
+        mHeld = s;
+        mHeldSeq = seq;
+        mNext++;
+        return s->data();
+    }
+    mLostBlocks += lost;
+    return NULL;
+}
+
+bool MCCShmReader::release()
+{
+    if (!mHeld)
+        return true;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool intact = mHeld->seq.load(std::memory_order_relaxed) == mHeldSeq;
+    mHeld = NULL;
+    if (!intact)
+        mLostBlocks++;
+    return intact;
+}
+
+bool MCCShmReader::read(unsigned short* data, MCCShmBlock* block, unsigned int timeout)
+{
+    double deadline = mccHostTime() + timeout / 1000.0;
+    unsigned long long lost = 0;
+    while (true)
+    {
+        double now = mccHostTime();
+        const unsigned short* shared = acquire(block, (unsigned int)std::max(0.0, (deadline - now) * 1000.0));
+        if (!shared)
+            return false;
+        lost += block->lostBlocks;
+        memcpy(data, shared, block->samples*sizeof(unsigned short));
+        if (release())
+        {
+            block->lostBlocks = lost;
+            return true;
+        }
+        lost++;
+    }
+}
+
+void MCCShmReader::getConfig(MCCShmConfig* config) const
+{
+    while (true)
+    {
+        uint64_t seq = mHeader->configSeq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        memcpy(config, &mHeader->config, sizeof(MCCShmConfig));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mHeader->configSeq.load(std::memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+void MCCShmReader::seekLatest()
+{
+    release();
+    mNext = mHeader->head.load(std::memory_order_acquire);
+}
+
+unsigned long long MCCShmReader::lag() const
+{
+    return mHeader->head.load(std::memory_order_acquire) - mNext;
+}
+
+bool MCCShmReader::isClosed() const
+{
+    return mHeader->closed.load(std::memory_order_acquire) != 0;
+}
+
+int MCCShmReader::slotSamples() const
+{
+    return (int)mHeader->slotSamples;
+}
+
+int MCCShmReader::numSlots() const
+{
+    return (int)mHeader->numSlots;
+}
@@ -0,0 +1,143 @@
+//
+//  mccshm.h
+//  Sharing one device's scan with other processes.
+//  Only one process can claim the device. MCCShmPublisher, in that process, puts each block in a
+//  ring of slots in POSIX shared memory, together with the calibration found by reconfigure().
+//  Any number of MCCShmReader in other processes map the same memory and read the blocks in
+//  place. The publisher never waits for readers and does not know how many there are: each
+//  reader keeps its own cursor, and one that falls more than a ring behind is told how many
+//  blocks it missed.
+//
+//      //Acquiring process                      //Any other process
+//      MCCShmPublisher pub(dev, "/mcc-scan");    MCCShmReader reader("/mcc-scan");
+//      dev.sendMessage("AISCAN:START");         MCCShmBlock block;
+//      while (running)                          while (const unsigned short* data = reader.acquire(&block))
+//          pub.publishBlock();                  {
+//                                                   ...                 //block.samples samples
+//                                                   if (!reader.release())
+//                                                       ...             //Overwritten meanwhile: discard.
+//                                               }
+//
+//  Each slot is guarded by a sequence number (a seqlock): the publisher makes it odd while it
+//  writes the slot and even once the block is complete, and a reader checks that it did not
+//  change while it looked at the data. publishBlock() reads from the device straight into the
+//  slot, so the data is never copied on either side. Readers that wait sleep on a futex on Linux
+//  and poll elsewhere.
+//
+
+#ifndef ____mccshm__
+#define ____mccshm__
+
+#include <stdint.h>
+#include <string>
+#include "mccdevice.h"
+
+#define MCC_SHM_MAX_CHANNELS 64
+
+//Scan parameters and calibration as of the publisher's last reconfigure(). The arrays fit
+//MCCConverter::setCalibration for the first channelCount channels.
+struct MCCShmConfig
+{
+    uint32_t generation;        //Changes whenever the publisher's device is reconfigured.
+    int32_t channelCount;
+    int32_t lowChan;
+    float sampRate;
+    uint16_t maxCounts;
+    float calSlope[MCC_SHM_MAX_CHANNELS];
+    float calOffset[MCC_SHM_MAX_CHANNELS];
+    int minVoltage[MCC_SHM_MAX_CHANNELS];
+    int maxVoltage[MCC_SHM_MAX_CHANNELS];
+};
+
+struct MCCShmBlock
+{
+    unsigned long long sequence;    //Blocks published before this one.
+    unsigned long long firstScan;   //Device scan count of the first scan (MCCDevice::getScanCount()).
+    double timestamp;               //mccHostTime() of the first scan, in the publisher's clock (same machine).
+    int samples;                    //Interleaved, starting at the first channel.
+    uint32_t generation;            //MCCShmConfig::generation the block was scanned with.
+    unsigned long long lostBlocks;  //Overwritten before this reader got to them, right before this block.
+};
+
+struct MCCShmHeader;
+struct MCCShmSlot;
+
+class MCCShmPublisher
+{
+public:
+    //Create the shared memory object name ("/something"), replacing a stale one. Each slot holds up
+    //to slotSamples samples; 0 takes the device's current block. mode is the object's permission
+    //bits: readers need read and write access.
+    MCCShmPublisher(MCCDevice& device, const std::string& name, int numSlots = 64, int slotSamples = 0, int mode = 0660);
+    ~MCCShmPublisher();    //Tells readers the stream has ended and unlinks the name.
+
+    //Read one block of device.mSamplesPerBlock scans from the device into the next slot and publish it.
+    void publishBlock();
+    //Publish a block read elsewhere, e.g. from MCCAcquisition. This one copies.
+    void publish(const unsigned short* data, int samples, unsigned long long firstScan, double timestamp);
+    //Or fill the next slot yourself: beginBlock returns it, commitBlock publishes it. Until then
+    //readers skip it; if the block is abandoned, the next beginBlock returns the same slot again.
+    unsigned short* beginBlock(int samples);
+    void commitBlock(unsigned long long firstScan, double timestamp);
+
+    //Republish the device's configuration. Blocks do this by themselves after a reconfigure().
+    void publishConfig();
+
+    const std::string& name() const { return mName; }
+    int slotSamples() const { return mSlotSamples; }
+    unsigned long long published() const { return mNext; }
+
+private:
+    MCCDevice& device;
+    std::string mName;
+    int mNumSlots;
+    int mSlotSamples;
+    size_t mSize;
+    MCCShmHeader* mHeader;
+    unsigned long long mNext;       //Sequence of the next block.
+    int mPending;                   //Samples of the block begun, or -1.
+    uint32_t mGeneration;           //Device configuration last published.
+
+    MCCShmSlot* slot(unsigned long long sequence) const;
+};
+
+class MCCShmReader
+{
+public:
+    //Attach to a publisher's stream. Reading starts with the next block published.
+    explicit MCCShmReader(const std::string& name);
+    ~MCCShmReader();
+
+    //The next block, in place, or NULL if none arrived within timeout ms or the publisher has
+    //closed. The data stays in the slot until release(), which returns false if the publisher
+    //overwrote it meanwhile; whatever was computed from it must then be discarded. A reader that
+    //is more than a ring behind skips ahead and reports the skipped blocks in block->lostBlocks.
+    const unsigned short* acquire(MCCShmBlock* block, unsigned int timeout = 2000);
+    bool release();
+    //The same, copied to data (at least slotSamples() long). Returns false on timeout or close.
+    bool read(unsigned short* data, MCCShmBlock* block, unsigned int timeout = 2000);
+
+    //Copy the current configuration. Compare its generation with the blocks'.
+    void getConfig(MCCShmConfig* config) const;
+
+    void seekLatest();                      //Skip what is waiting and continue with the next block.
+    unsigned long long lag() const;         //Blocks published but not read yet.
+    unsigned long long lostBlocks() const { return mLostBlocks; }
+    bool isClosed() const;                  //The publisher is gone.
+    int slotSamples() const;
+    int numSlots() const;
+
+private:
+    std::string mName;
+    size_t mSize;
+    MCCShmHeader* mHeader;
+    unsigned long long mNext;       //Sequence of the next block to read.
+    unsigned long long mLostBlocks;
+    MCCShmSlot* mHeld;              //Slot handed out by acquire, or NULL.
+    uint64_t mHeldSeq;
+
+    MCCShmSlot* slot(unsigned long long sequence) const;
+    bool waitFor(unsigned long long sequence, double deadline);
+};
+
+#endif /* defined(____mccshm__) */
@@ -0,0 +1,355 @@
+//
+//  mccsimdevice.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+#include "mccdevice.h"
+#include "mccprotocol.h"
+#include "mccsimdevice.h"
+
+#define SIM_ENDPOINT_IN  (0x81)
+#define SIM_ENDPOINT_OUT (0x02)
+#define SIM_POLL_MS      10     //Longest sleep before re-checking scan state.
+
+//Stream over MCCSimTransport::produce. Buffers are filled when the consumer polls for them,
+//so there is no event loop to drive.
+class MCCSimBulkStream : public MCCBulkStream
+{
+public:
+    MCCSimBulkStream(MCCSimTransport* sim, int transferSize, int numTransfers)
+    :   sim(sim), mTransferSize(transferSize), mNumTransfers(numTransfers), mRunning(false),
+        mBuffers((size_t)transferSize * numTransfers)
+    {
+        if (transferSize <= 0 || numTransfers <= 0)
+            throw MCC_ERR_INVALID_BUFFER_SIZE;
+    }
+
+    void start()
+    {
+        mQueue.clear();
+        for (int i = 0; i < mNumTransfers; i++)
+            mQueue.push_back(i);
+        mRunning = true;
+    }
+    void stop()
+    {
+        mRunning = false;
+        mQueue.clear();
+    }
+    bool isRunning() const { return mRunning; }
+
+    bool pollBuffer(MCCStreamBuffer* buffer)
+    {
+        return fill(buffer, std::chrono::steady_clock::now());
+    }
+    bool waitBuffer(MCCStreamBuffer* buffer, unsigned int timeout)
+    {
+        return fill(buffer, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout));
+    }
+    void releaseBuffer(const MCCStreamBuffer& buffer)
+    {
+        if (mRunning)
+            mQueue.push_back(buffer.index);
+    }
+
+    int transferSize() const { return mTransferSize; }
+    int numTransfers() const { return mNumTransfers; }
+
+private:
+    MCCSimTransport* sim;
+    int mTransferSize;
+    int mNumTransfers;
+    bool mRunning;
+    std::vector<unsigned char> mBuffers;
+    std::deque<int> mQueue;     //Queued (not yet delivered) buffers in submission order.
+
+    bool fill(MCCStreamBuffer* buffer, std::chrono::steady_clock::time_point deadline)
+    {
+        if (mQueue.empty())
+            return false;
+        int index = mQueue.front();
+        unsigned char* data = &mBuffers[(size_t)index * mTransferSize];
+        if (sim->produce(data, mTransferSize, deadline) == 0)
+            return false;
+        mQueue.pop_front();
+        buffer->data = data;
+        buffer->length = mTransferSize;
+        buffer->index = index;
+        buffer->timestamp = mccHostTime();
+        return true;
+    }
+};
+
+static std::string formatNumber(const char* format, double value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), format, value);
+    return text;
+}
+
+MCCSimTransport::MCCSimTransport(int numChannels, int bulkPacketSize)
+:   mNumChannels(numChannels), mBulkPacketSize((unsigned short)bulkPacketSize),
+    mTristate(0xFF), mLatch(0), mInput(0), mPaced(true),
+    mScanning(false), mSamplesSent(0), mOverrunAt(0), mScanLowChan(0), mScanChannelCount(1), mScanRate(0)
+{
+    static std::atomic<int> instances(0);
+    char serial[16];
+    snprintf(serial, sizeof(serial), "SIM%05d", ++instances);
+
+    mProperties["DEV:MFGSER"] = serial;
+    mProperties["AISCAN:LOWCHAN"] = "0";
+    mProperties["AISCAN:HIGHCHAN"] = formatNumber("%.0f", numChannels - 1);
+    mProperties["AISCAN:RATE"] = "1000.000";
+    mProperties["AISCAN:BUFSIZE"] = "65536";
+    mProperties["AISCAN:BUFOVERWRITE"] = "DISABLE";
+    for (int chanIdx = 0; chanIdx < numChannels; chanIdx++)
+    {
+        std::string prefix = "AI{" + formatNumber("%.0f", chanIdx) + "}:";
+        mProperties[prefix + "SLOPE"] = "1.000000";
+        mProperties[prefix + "OFFSET"] = "0.000000";
+        mProperties[prefix + "RANGE"] = "BIP10V";
+    }
+}
+
+MCCSimTransport::~MCCSimTransport()
+{
+}
+
+void MCCSimTransport::setPaced(bool paced)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPaced = paced;
+}
+
+void MCCSimTransport::setDIOInput(uint8_t value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mInput = value;
+}
+
+void MCCSimTransport::setProperty(const std::string& name, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mProperties[name] = value;
+}
+
+unsigned short MCCSimTransport::sampleValue(unsigned long long scan, int chanIdx)
+{
+    return (unsigned short)(scan + (unsigned long long)chanIdx * 0x1000);
+}
+
+//Called with mMutex held.
+void MCCSimTransport::handleMessage(const std::string& message)
+{
+    std::string msg = message;
+    std::transform(msg.begin(), msg.end(), msg.begin(), ::toupper);
+
+    if (!msg.empty() && msg[0] == '?')
+    {
+        std::string name = msg.substr(1);
+        updateBuffer(std::chrono::steady_clock::now());
+        if (name == "AISCAN:STATUS")
+            mReply = name + "=" + (mOverrunAt ? "OVERRUN" : mScanning ? "RUNNING" : "IDLE");
+        else if (name == "AISCAN:COUNT")
+            mReply = name + "=" + formatNumber("%.0f", (double)(mScanning ? samplesAcquired(std::chrono::steady_clock::now()) : mSamplesSent));
+        else if (mProperties.count(name))
+            mReply = name + "=" + mProperties[name];
+        else
+            mReply = msg;
+        return;
+    }
+
+    size_t eq = msg.find('=');
+    if (eq != std::string::npos)
+    {
+        mProperties[msg.substr(0, eq)] = msg.substr(eq + 1);
+    }
+    else if (msg == "AISCAN:START")
+    {
+        int lowChan = atoi(mProperties["AISCAN:LOWCHAN"].c_str());
+        int highChan = atoi(mProperties["AISCAN:HIGHCHAN"].c_str());
+        mScanLowChan = lowChan;
+        mScanChannelCount = std::max(1, highChan - lowChan + 1);
+        mScanRate = atof(mProperties["AISCAN:RATE"].c_str());
+        mSamplesSent = 0;
+        mOverrunAt = 0;
+        mScanStart = std::chrono::steady_clock::now();
+        mScanning = true;
+    }
+    else if (msg == "AISCAN:STOP")
+    {
+        mScanning = false;
+        mOverrunAt = 0;
+    }
+    mReply = msg;
+}
+
+//Samples the device has acquired since AISCAN:START, read or not. Called with mMutex held.
+unsigned long long MCCSimTransport::samplesAcquired(std::chrono::steady_clock::time_point now) const
+{
+    if (!mPaced || mScanRate <= 0)
+        return mSamplesSent;
+    double seconds = std::chrono::duration<double>(now - mScanStart).count();
+    unsigned long long acquired = (unsigned long long)(seconds * mScanRate) * mScanChannelCount;
+    if (mOverrunAt)
+        acquired = std::min(acquired, mOverrunAt);
+    return std::max(acquired, mSamplesSent);
+}
+
+//Overrun the buffer if the host has fallen more than AISCAN:BUFSIZE behind. Called with mMutex held.
+void MCCSimTransport::updateBuffer(std::chrono::steady_clock::time_point now)
+{
+    if (!mScanning || mOverrunAt)
+        return;
+    unsigned long long bufferSamples = std::max(1LL, atoll(mProperties["AISCAN:BUFSIZE"].c_str()) / 2);
+    unsigned long long acquired = samplesAcquired(now);
+    if (acquired - mSamplesSent <= bufferSamples)
+        return;
+    if (mProperties["AISCAN:BUFOVERWRITE"] == "ENABLE")
+        mSamplesSent = acquired - bufferSamples;    //Oldest samples overwritten, silently.
+    else
+        mOverrunAt = mSamplesSent + bufferSamples;  //Acquisition stopped when the buffer filled.
+}
+
+//Configuration descriptor with one interface, a bulk IN and a bulk OUT endpoint; what getScanParams parses.
+int MCCSimTransport::getDescriptor(unsigned char* data, uint16_t length)
+{
+    unsigned char lo = (unsigned char)(mBulkPacketSize & 0xFF), hi = (unsigned char)(mBulkPacketSize >> 8);
+    const unsigned char descriptor[] = {
+        9, 0x02, 32, 0, 1, 1, 0, 0x80, 50,             //Configuration
+        9, 0x04, 0, 0, 2, 0xFF, 0, 0, 0,                //Interface
+        7, 0x05, SIM_ENDPOINT_IN, 0x02, lo, hi, 0,      //Bulk IN
+        7, 0x05, SIM_ENDPOINT_OUT, 0x02, lo, hi, 0,     //Bulk OUT
+    };
+    int n = std::min((int)length, (int)sizeof(descriptor));
+    memcpy(data, descriptor, n);
+    if (n < length)
+        data[n] = 0; //getScanParams stops at a zero-length descriptor.
+    return n;
+}
+
+//Request directions follow MCCDevice: messages and register writes are issued with
+//LIBUSB_ENDPOINT_IN set, replies and register reads with it clear.
+int MCCSimTransport::controlTransfer(uint8_t requestType, uint8_t request, uint16_t wValue, uint16_t wIndex,
+                                     unsigned char* data, uint16_t length, unsigned int timeout)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    bool hostWrites = (requestType & LIBUSB_ENDPOINT_IN) != 0;
+
+    if ((requestType & LIBUSB_REQUEST_TYPE_VENDOR) == 0)
+    {
+        if (request == LIBUSB_REQUEST_GET_DESCRIPTOR)
+            return getDescriptor(data, length);
+        return LIBUSB_ERROR_PIPE;
+    }
+
+    switch (request)
+    {
+        case STRING_MESSAGE:
+            if (hostWrites)
+            {
+                handleMessage(std::string((const char*)data, strnlen((const char*)data, length)));
+                return length;
+            }
+            else
+            {
+                int n = std::min((int)mReply.size(), (int)length - 1);
+                memcpy(data, mReply.c_str(), n);
+                data[n] = '\0';
+                return n + 1;
+            }
+        case DTRISTATE:
+            if (hostWrites)
+                mTristate = (uint8_t)wValue;
+            else if (length > 0)
+                data[0] = mTristate;
+            return hostWrites ? 0 : 1;
+        case DPORT:
+            if (hostWrites || length == 0)
+                return LIBUSB_ERROR_PIPE;
+            data[0] = (uint8_t)((mLatch & ~mTristate) | (mInput & mTristate));
+            return 1;
+        case DLATCH:
+            if (hostWrites)
+                mLatch = (uint8_t)wValue;
+            else if (length > 0)
+                data[0] = mLatch;
+            return hostWrites ? 0 : 1;
+        default:
+            return LIBUSB_ERROR_PIPE;
+    }
+}
+
+int MCCSimTransport::produce(unsigned char* data, int length, std::chrono::steady_clock::time_point deadline)
+{
+    int samples = length / 2;
+
+    while (true)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point due = now;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            updateBuffer(now);
+            if (mScanning && mOverrunAt && mSamplesSent + samples > mOverrunAt)
+            {
+                //The buffer has been drained up to the overrun; nothing more will come.
+                due = now + std::chrono::milliseconds(SIM_POLL_MS);
+            }
+            else if (mScanning)
+            {
+                if (mPaced && mScanRate > 0)
+                {
+                    double seconds = (double)(mSamplesSent + samples) / (mScanRate * mScanChannelCount);
+                    due = mScanStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+                }
+                if (due <= now)
+                {
+                    for (int i = 0; i < samples; i++)
+                    {
+                        unsigned long long s = mSamplesSent + i;
+                        unsigned short value = sampleValue(s / mScanChannelCount, mScanLowChan + (int)(s % mScanChannelCount));
+                        data[2*i] = (unsigned char)(value & 0xFF);
+                        data[2*i + 1] = (unsigned char)(value >> 8);
+                    }
+                    mSamplesSent += samples;
+                    return length;
+                }
+            }
+            else
+            {
+                due = now + std::chrono::milliseconds(SIM_POLL_MS);
+            }
+        }
+
+        if (now >= deadline)
+            return 0;
+        std::this_thread::sleep_until(std::min(std::min(due, deadline), now + std::chrono::milliseconds(SIM_POLL_MS)));
+    }
+}
+
+int MCCSimTransport::bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+                                  int* transferred, unsigned int timeout)
+{
+    *transferred = 0;
+    if (endpoint != SIM_ENDPOINT_IN)
+        return LIBUSB_ERROR_PIPE;
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    *transferred = produce(data, length, deadline);
+    return *transferred > 0 ? 0 : LIBUSB_ERROR_TIMEOUT;
+}
+
+MCCBulkStream* MCCSimTransport::createBulkStream(unsigned char endpoint, int transferSize, int numTransfers, bool pinned)
+{
+    if (endpoint != SIM_ENDPOINT_IN)
+        throw MCC_ERR_PIPE;
+    return new MCCSimBulkStream(this, transferSize, numTransfers);
+}
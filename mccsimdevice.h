@@ -0,0 +1,80 @@
+//
+//  mccsimdevice.h
+//  An in-process simulated DAQFlex device.
+//  MCCSimTransport answers the string messages MCCDevice sends (?AISCAN:LOWCHAN, ?AI{n}:SLOPE, ...),
+//  keeps the values set with "NAME=VALUE" messages, implements the DIO registers and, between
+//  AISCAN:START and AISCAN:STOP, emits scan data on the bulk endpoint at AISCAN:RATE.
+//  When paced, scans are acquired in real time into an AISCAN:BUFSIZE byte buffer whether or not
+//  they are read: a host that falls that far behind overruns it, and the scan stops with
+//  ?AISCAN:STATUS=OVERRUN (or, with AISCAN:BUFOVERWRITE=ENABLE, the oldest samples are skipped).
+//  Use it to exercise and time the whole acquisition path without hardware:
+//
+//      MCCSimTransport* sim = new MCCSimTransport(8, 64);
+//      MCCDevice dev(USB_1608_FS_PLUS, sim);
+//
+//  Sample values are a deterministic per-channel ramp (see sampleValue) so consumers can check
+//  that no data was lost or reordered.
+//
+
+#ifndef ____mccsimdevice__
+#define ____mccsimdevice__
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include "mcctransport.h"
+
+class MCCSimTransport : public MCCTransport
+{
+public:
+    //numChannels analog inputs (AI{0}..AI{numChannels-1}), bulkPacketSize bytes per bulk packet.
+    MCCSimTransport(int numChannels = 8, int bulkPacketSize = 64);
+    ~MCCSimTransport();
+
+    int controlTransfer(uint8_t requestType, uint8_t request, uint16_t wValue, uint16_t wIndex,
+                        unsigned char* data, uint16_t length, unsigned int timeout);
+    int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+                     int* transferred, unsigned int timeout);
+    MCCBulkStream* createBulkStream(unsigned char endpoint, int transferSize, int numTransfers, bool pinned);
+
+    //When paced (the default), data becomes available at AISCAN:RATE in real time, as from hardware.
+    //Unpaced, every bulk read is satisfied immediately, which measures the host side alone.
+    void setPaced(bool paced);
+    //Value read back from DPORT for pins configured as inputs.
+    void setDIOInput(uint8_t value);
+    //Set a property directly, as if "name=value" had been sent. e.g. setProperty("AI{0}:RANGE", "BIP5V").
+    void setProperty(const std::string& name, const std::string& value);
+
+    static unsigned short sampleValue(unsigned long long scan, int chanIdx);
+
+    //Fill data with the next length bytes of scan data if they are due by deadline.
+    //Returns length, or 0 if the scan is not running or the data is not due in time. Used by the bulk paths.
+    int produce(unsigned char* data, int length, std::chrono::steady_clock::time_point deadline);
+
+private:
+    int mNumChannels;
+    unsigned short mBulkPacketSize;
+    std::mutex mMutex;
+    std::map<std::string, std::string> mProperties;
+    std::string mReply;                 //Answer to the last string message.
+    uint8_t mTristate;
+    uint8_t mLatch;
+    uint8_t mInput;
+    bool mPaced;
+    //Scan state
+    bool mScanning;
+    std::chrono::steady_clock::time_point mScanStart;
+    unsigned long long mSamplesSent;    //Samples (not scans) emitted since AISCAN:START.
+    unsigned long long mOverrunAt;      //Samples acquired when the buffer overran and the scan stopped, or 0.
+    int mScanLowChan;
+    int mScanChannelCount;
+    double mScanRate;
+
+    void handleMessage(const std::string& message);
+    unsigned long long samplesAcquired(std::chrono::steady_clock::time_point now) const;
+    void updateBuffer(std::chrono::steady_clock::time_point now);
+    int getDescriptor(unsigned char* data, uint16_t length);
+};
+
+#endif /* defined(____mccsimdevice__) */
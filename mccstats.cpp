@@ -0,0 +1,97 @@
+//
+//  mccstats.cpp
+//
+
+#include "mccstats.h"
+
+void MCCHistogram::record(double usec)
+{
+    int bucket = 0;
+    if (usec >= 1)
+    {
+        uint64_t value = (uint64_t)usec;
+        while (value && bucket < MCC_HISTOGRAM_BUCKETS - 1)
+        {
+            value >>= 1;
+            bucket++;
+        }
+    }
+    mCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void MCCHistogram::reset()
+{
+    for (int i = 0; i < MCC_HISTOGRAM_BUCKETS; i++)
+        mCounts[i].store(0, std::memory_order_relaxed);
+}
+
+void MCCHistogram::snapshot(uint64_t* counts) const
+{
+    for (int i = 0; i < MCC_HISTOGRAM_BUCKETS; i++)
+        counts[i] = mCounts[i].load(std::memory_order_relaxed);
+}
+
+double MCCHistogram::bucketUpperBound(int bucket)
+{
+    return (double)((uint64_t)1 << bucket);
+}
+
+double MCCHistogram::percentile(const uint64_t* counts, double fraction)
+{
+    uint64_t total = 0, running = 0;
+    for (int i = 0; i < MCC_HISTOGRAM_BUCKETS; i++)
+        total += counts[i];
+    if (total == 0)
+        return 0;
+    for (int i = 0; i < MCC_HISTOGRAM_BUCKETS; i++)
+    {
+        running += counts[i];
+        if (running >= fraction * total)
+            return bucketUpperBound(i);
+    }
+    return bucketUpperBound(MCC_HISTOGRAM_BUCKETS - 1);
+}
+
+void MCCStats::addTransfer(int bytes, int requested, double completedAt, double latency)
+{
+    mBytes.fetch_add(bytes, std::memory_order_relaxed);
+    mTransfers.fetch_add(1, std::memory_order_relaxed);
+    if (bytes < requested)
+        mShortTransfers.fetch_add(1, std::memory_order_relaxed);
+    mLatency.record(latency * 1e6);
+
+    //Only the reading thread records transfers, so a plain load and store is enough here.
+    double last = mLastArrival.load(std::memory_order_relaxed);
+    if (last > 0)
+        mInterArrival.record((completedAt - last) * 1e6);
+    mLastArrival.store(completedAt, std::memory_order_relaxed);
+}
+
+MCCStatsSnapshot MCCStats::snapshot() const
+{
+    MCCStatsSnapshot s;
+    s.bytes = mBytes.load(std::memory_order_relaxed);
+    s.transfers = mTransfers.load(std::memory_order_relaxed);
+    s.shortTransfers = mShortTransfers.load(std::memory_order_relaxed);
+    s.timeouts = mTimeouts.load(std::memory_order_relaxed);
+    s.stalls = mStalls.load(std::memory_order_relaxed);
+    s.errors = mErrors.load(std::memory_order_relaxed);
+    s.overruns = mOverruns.load(std::memory_order_relaxed);
+    mLatency.snapshot(s.latency);
+    mInterArrival.snapshot(s.interArrival);
+    return s;
+}
+
+void MCCStats::reset()
+{
+    mBytes.store(0, std::memory_order_relaxed);
+    mTransfers.store(0, std::memory_order_relaxed);
+    mShortTransfers.store(0, std::memory_order_relaxed);
+    mTimeouts.store(0, std::memory_order_relaxed);
+    mStalls.store(0, std::memory_order_relaxed);
+    mErrors.store(0, std::memory_order_relaxed);
+    mOverruns.store(0, std::memory_order_relaxed);
+    mLastArrival.store(0, std::memory_order_relaxed);
+    mLatency.reset();
+    mInterArrival.reset();
+}
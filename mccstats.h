@@ -0,0 +1,77 @@
+//
+//  mccstats.h
+//  Counters and histograms for the acquisition hot path.
+//  Everything is a relaxed atomic, so recording costs a few uncontended increments and any
+//  thread may call snapshot() at any time while acquisition runs. A snapshot is not an atomic
+//  picture of all counters at once, but every value in it is one that was really reached.
+//
+
+#ifndef ____mccstats__
+#define ____mccstats__
+
+#include <stdint.h>
+#include <atomic>
+
+//Bucket 0 counts values below 1 us, bucket k values in [2^(k-1), 2^k) us; the last bucket takes the rest.
+#define MCC_HISTOGRAM_BUCKETS 32
+
+class MCCHistogram
+{
+public:
+    MCCHistogram() { reset(); }
+
+    void record(double usec);
+    void reset();
+    void snapshot(uint64_t* counts) const;  //Copies MCC_HISTOGRAM_BUCKETS counts.
+
+    static double bucketUpperBound(int bucket); //In us.
+    //Upper bound of the bucket holding the given fraction (0..1) of the counts, e.g. 0.99 for p99.
+    static double percentile(const uint64_t* counts, double fraction);
+
+private:
+    std::atomic<uint64_t> mCounts[MCC_HISTOGRAM_BUCKETS];
+};
+
+struct MCCStatsSnapshot
+{
+    uint64_t bytes;             //Scan data received.
+    uint64_t transfers;         //Completed bulk transfers that carried data.
+    uint64_t shortTransfers;    //Transfers that returned less than was asked for.
+    uint64_t timeouts;
+    uint64_t stalls;            //Endpoint halted (LIBUSB_ERROR_PIPE or a stalled transfer).
+    uint64_t errors;            //Any other failed transfer.
+    uint64_t overruns;          //Blocks dropped because the consumer fell behind.
+    uint64_t latency[MCC_HISTOGRAM_BUCKETS];        //us from transfer completion to the reader picking it up.
+    uint64_t interArrival[MCC_HISTOGRAM_BUCKETS];   //us between consecutive transfer completions.
+};
+
+class MCCStats
+{
+public:
+    MCCStats() { reset(); }
+
+    //A transfer of requested bytes completed at completedAt (mccHostTime()) with bytes in it and
+    //was picked up latency seconds later (for a synchronous transfer: took latency seconds).
+    void addTransfer(int bytes, int requested, double completedAt, double latency);
+    void addTimeout() { mTimeouts.fetch_add(1, std::memory_order_relaxed); }
+    void addStall() { mStalls.fetch_add(1, std::memory_order_relaxed); }
+    void addError() { mErrors.fetch_add(1, std::memory_order_relaxed); }
+    void addOverruns(uint64_t blocks) { mOverruns.fetch_add(blocks, std::memory_order_relaxed); }
+
+    MCCStatsSnapshot snapshot() const;
+    void reset();
+
+private:
+    std::atomic<uint64_t> mBytes;
+    std::atomic<uint64_t> mTransfers;
+    std::atomic<uint64_t> mShortTransfers;
+    std::atomic<uint64_t> mTimeouts;
+    std::atomic<uint64_t> mStalls;
+    std::atomic<uint64_t> mErrors;
+    std::atomic<uint64_t> mOverruns;
+    std::atomic<double> mLastArrival;   //Completion time of the previous transfer, 0 for none.
+    MCCHistogram mLatency;
+    MCCHistogram mInterArrival;
+};
+
+#endif /* defined(____mccstats__) */
@@ -0,0 +1,261 @@
+//
+//  mccstream.cpp
+//
+
+#include <stdlib.h>
+#include <chrono>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "mccdevice.h"
+#include "mccstream.h"
+#include "mccclock.h"
+
+MCCLibusbBulkStream::MCCLibusbBulkStream(libusb_context* ctx, libusb_device_handle* dev_handle, unsigned char endpoint,
+                                         int transferSize, int numTransfers, bool pinned)
+:   ctx(ctx), dev_handle(dev_handle), endpoint(endpoint),
+    mTransferSize(transferSize), mNumTransfers(numTransfers), mRunning(false), mPinned(pinned), mMemory(MCC_MEMORY_DEVICE),
+    mQueue(numTransfers), mQueueHead(0), mQueueCount(0)
+{
+    if (transferSize <= 0 || numTransfers <= 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    mSlots = new Slot[mNumTransfers];
+    for (int i = 0; i < mNumTransfers; i++)
+    {
+        mSlots[i].owner = this;
+        mSlots[i].state = SLOT_IDLE;
+        mSlots[i].buffer = allocBuffer(pinned, &mSlots[i].memory);
+        mSlots[i].transfer = libusb_alloc_transfer(0);
+        if (mSlots[i].memory < mMemory)
+            mMemory = mSlots[i].memory;
+        if (mSlots[i].buffer == NULL || mSlots[i].transfer == NULL)
+        {
+            for (int j = 0; j <= i; j++)
+            {
+                if (mSlots[j].buffer)
+                    freeBuffer(mSlots[j].buffer, mSlots[j].memory);
+                if (mSlots[j].transfer)
+                    libusb_free_transfer(mSlots[j].transfer);
+            }
+            delete [] mSlots;
+            throw MCC_ERR_USB_INIT;
+        }
+    }
+}
+
+MCCLibusbBulkStream::~MCCLibusbBulkStream()
+{
+    stop();
+    for (int i = 0; i < mNumTransfers; i++)
+    {
+        //A transfer stop() could not get back still belongs to the kernel: leak it rather than free it under the DMA.
+        if (mSlots[i].state.load(std::memory_order_acquire) == SLOT_SUBMITTED)
+            continue;
+        libusb_free_transfer(mSlots[i].transfer);
+        freeBuffer(mSlots[i].buffer, mSlots[i].memory);
+    }
+    delete [] mSlots;
+    mSlots = nullptr;
+}
+
+unsigned char* MCCLibusbBulkStream::allocBuffer(bool pinned, MCCBufferMemory* memory)
+{
+    if (!pinned)
+    {
+        *memory = MCC_MEMORY_HEAP;
+        return new unsigned char[mTransferSize];
+    }
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    //Returns NULL if the kernel cannot map usbfs memory (Linux < 4.6, other platforms) or its limit is used up.
+    unsigned char* buffer = libusb_dev_mem_alloc(dev_handle, mTransferSize);
+    if (buffer)
+    {
+        *memory = MCC_MEMORY_DEVICE;
+        return buffer;
+    }
+#endif
+
+#ifdef _WIN32
+    *memory = MCC_MEMORY_HEAP;
+    return new unsigned char[mTransferSize];
+#else
+    void* aligned = NULL;
+    *memory = MCC_MEMORY_HEAP;
+    if (posix_memalign(&aligned, (size_t)sysconf(_SC_PAGESIZE), mTransferSize) != 0)
+        return NULL;
+    //mlock fails without CAP_IPC_LOCK once RLIMIT_MEMLOCK is used up; the buffer still works, just unlocked.
+    *memory = mlock(aligned, mTransferSize) == 0 ? MCC_MEMORY_LOCKED : MCC_MEMORY_HEAP;
+    return (unsigned char*)aligned;
+#endif
+}
+
+void MCCLibusbBulkStream::freeBuffer(unsigned char* buffer, MCCBufferMemory memory)
+{
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    if (memory == MCC_MEMORY_DEVICE)
+    {
+        libusb_dev_mem_free(dev_handle, buffer, mTransferSize);
+        return;
+    }
+#endif
+#ifndef _WIN32
+    //Pinned buffers come from posix_memalign, including the ones mlock refused.
+    if (mPinned)
+    {
+        if (memory == MCC_MEMORY_LOCKED)
+            munlock(buffer, mTransferSize);
+        free(buffer);
+        return;
+    }
+#endif
+    delete [] buffer;
+}
+
+void MCCLibusbBulkStream::submit(int index)
+{
+    Slot& slot = mSlots[index];
+    //Left in flight by a stop() that gave up on it; refilling it would rewrite a transfer libusb still owns.
+    if (slot.state.load(std::memory_order_acquire) == SLOT_SUBMITTED)
+        throw libUSBError(LIBUSB_ERROR_BUSY);
+    //A timeout of 0 keeps the transfer queued until the device fills it.
+    libusb_fill_bulk_transfer(slot.transfer, dev_handle, endpoint, slot.buffer, mTransferSize,
+                              transferCallback, &slot, 0);
+    slot.state.store(SLOT_SUBMITTED, std::memory_order_release);
+    int err = libusb_submit_transfer(slot.transfer);
+    if (err < 0)
+    {
+        slot.state.store(SLOT_IDLE, std::memory_order_relaxed);
+        throw libUSBError(err);
+    }
+    mQueue[(mQueueHead + mQueueCount) % mNumTransfers] = index;
+    mQueueCount++;
+}
+
+void MCCLibusbBulkStream::start()
+{
+    if (mRunning)
+        return;
+    mQueueHead = 0;
+    mQueueCount = 0;
+    mRunning = true;
+    try
+    {
+        for (int i = 0; i < mNumTransfers; i++)
+            submit(i);
+    }
+    catch(mcc_err err)
+    {
+        stop();
+        throw err;
+    }
+}
+
+void MCCLibusbBulkStream::stop()
+{
+    int inFlight, err;
+    struct timeval tv = {0, 100000};
+
+    mRunning = false;
+    for (int i = 0; i < mNumTransfers; i++)
+    {
+        if (mSlots[i].state.load(std::memory_order_acquire) == SLOT_SUBMITTED)
+            libusb_cancel_transfer(mSlots[i].transfer);
+    }
+
+    //Cancelled transfers still complete through the callback, so keep handling events until they are all back.
+    do
+    {
+        inFlight = 0;
+        for (int i = 0; i < mNumTransfers; i++)
+        {
+            if (mSlots[i].state.load(std::memory_order_acquire) == SLOT_SUBMITTED)
+                inFlight++;
+        }
+        if (inFlight == 0)
+            break;
+        //A signal interrupts the wait but not the transfers, so just wait again.
+        err = libusb_handle_events_timeout(ctx, &tv);
+        if (err < 0 && err != LIBUSB_ERROR_INTERRUPTED)
+            break;
+    } while (inFlight > 0);
+
+    //Whatever is still submitted stays that way: the kernel may yet write into it.
+    for (int i = 0; i < mNumTransfers; i++)
+    {
+        if (mSlots[i].state.load(std::memory_order_acquire) != SLOT_SUBMITTED)
+            mSlots[i].state.store(SLOT_IDLE, std::memory_order_relaxed);
+    }
+    mQueueHead = 0;
+    mQueueCount = 0;
+}
+
+bool MCCLibusbBulkStream::pollBuffer(MCCStreamBuffer* buffer)
+{
+    if (mQueueCount == 0)
+        return false;
+
+    int index = mQueue[mQueueHead];
+    Slot& slot = mSlots[index];
+    if (slot.state.load(std::memory_order_acquire) != SLOT_COMPLETED)
+        return false;
+
+    mQueueHead = (mQueueHead + 1) % mNumTransfers;
+    mQueueCount--;
+
+    if (slot.transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        int status = slot.transfer->status;
+        slot.state.store(SLOT_IDLE, std::memory_order_relaxed);
+        //Put it back in the queue, or every failed transfer would leave one fewer until the stream stalls.
+        if (mRunning)
+            submit(index);
+        throw libUSBTransferError(status);
+    }
+
+    buffer->data = slot.buffer;
+    buffer->length = slot.transfer->actual_length;
+    buffer->index = index;
+    buffer->timestamp = slot.completedAt;
+    return true;
+}
+
+bool MCCLibusbBulkStream::waitBuffer(MCCStreamBuffer* buffer, unsigned int timeout)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    while (!pollBuffer(buffer))
+    {
+        if (mQueueCount == 0)
+            return false;   //Nothing queued, so nothing can complete.
+
+        std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero())
+            return false;
+
+        long long usec = std::chrono::duration_cast<std::chrono::microseconds>(remaining).count();
+        struct timeval tv;
+        tv.tv_sec = (long)(usec / 1000000);
+        tv.tv_usec = (long)(usec % 1000000);
+        int err = libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+        if (err < 0 && err != LIBUSB_ERROR_INTERRUPTED)
+            throw libUSBError(err);
+    }
+    return true;
+}
+
+void MCCLibusbBulkStream::releaseBuffer(const MCCStreamBuffer& buffer)
+{
+    mSlots[buffer.index].state.store(SLOT_IDLE, std::memory_order_relaxed);
+    if (mRunning)
+        submit(buffer.index);
+}
+
+void LIBUSB_CALL MCCLibusbBulkStream::transferCallback(libusb_transfer* transfer)
+{
+    Slot* slot = (Slot*)transfer->user_data;
+    slot->completedAt = mccHostTime();
+    slot->state.store(SLOT_COMPLETED, std::memory_order_release);
+}
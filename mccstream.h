@@ -0,0 +1,112 @@
+//
+//  mccstream.h
+//  Asynchronous bulk-in streaming for MCCDevice.
+//  A fixed number of transfers are kept queued on the input endpoint so that
+//  the device always has somewhere to put its next packet, even while the host is
+//  busy with the previous one. Completed buffers are handed out strictly in the
+//  order the transfers were submitted.
+//  MCCBulkStream is the interface; MCCTransport::createBulkStream returns the
+//  implementation for its transport (MCCLibusbBulkStream for real hardware).
+//
+
+#ifndef ____mccstream__
+#define ____mccstream__
+
+#include <libusb.h>
+#include <atomic>
+#include <vector>
+
+//Where a stream's transfer buffers live.
+enum MCCBufferMemory
+{
+    MCC_MEMORY_HEAP,    //Ordinary memory. usbfs copies each transfer through a kernel bounce buffer.
+    MCC_MEMORY_LOCKED,  //Page-aligned and locked into RAM (mlock), so it never faults while the kernel fills it.
+    MCC_MEMORY_DEVICE,  //Mapped from usbfs with libusb_dev_mem_alloc: the kernel DMAs straight into it, no copy at all.
+};
+
+//A completed transfer, as returned by MCCBulkStream::pollBuffer/waitBuffer.
+//The buffer belongs to the stream and must be handed back with releaseBuffer.
+struct MCCStreamBuffer
+{
+    unsigned char* data;
+    int length;     //Number of bytes actually transferred.
+    int index;      //Transfer slot. Used by releaseBuffer.
+    double timestamp;   //mccHostTime() when the transfer completed.
+};
+
+class MCCBulkStream
+{
+public:
+    virtual ~MCCBulkStream() {}
+
+    virtual void start() = 0;   //Submit every transfer.
+    virtual void stop() = 0;    //Cancel outstanding transfers and wait for them to come back.
+    virtual bool isRunning() const = 0;
+
+    //Get the oldest completed transfer. pollBuffer never blocks and never handles libusb events,
+    //so it can be used when another thread drives the event loop. waitBuffer handles events
+    //until a buffer is available or timeout (ms) expires. Both throw an mcc_err if the transfer failed;
+    //the failed transfer is resubmitted first, so the stream keeps its depth and can carry on.
+    virtual bool pollBuffer(MCCStreamBuffer* buffer) = 0;
+    virtual bool waitBuffer(MCCStreamBuffer* buffer, unsigned int timeout) = 0;
+    //Give a buffer back to the stream. Its transfer is resubmitted at the back of the queue.
+    virtual void releaseBuffer(const MCCStreamBuffer& buffer) = 0;
+
+    virtual int transferSize() const = 0;
+    virtual int numTransfers() const = 0;
+    virtual MCCBufferMemory memory() const { return MCC_MEMORY_HEAP; }
+};
+
+//MCCBulkStream on libusb's asynchronous API.
+class MCCLibusbBulkStream : public MCCBulkStream
+{
+public:
+    //pinned allocates transfer buffers as device memory where libusb and the kernel support it,
+    //otherwise as locked pages; memory() says which one it got.
+    MCCLibusbBulkStream(libusb_context* ctx, libusb_device_handle* dev_handle, unsigned char endpoint,
+                        int transferSize, int numTransfers, bool pinned = false);
+    ~MCCLibusbBulkStream();
+
+    void start();
+    void stop();
+    bool isRunning() const { return mRunning; }
+    bool pollBuffer(MCCStreamBuffer* buffer);
+    bool waitBuffer(MCCStreamBuffer* buffer, unsigned int timeout);
+    void releaseBuffer(const MCCStreamBuffer& buffer);
+    int transferSize() const { return mTransferSize; }
+    int numTransfers() const { return mNumTransfers; }
+    MCCBufferMemory memory() const { return mMemory; }
+
+private:
+    enum SlotState { SLOT_IDLE, SLOT_SUBMITTED, SLOT_COMPLETED };
+    struct Slot
+    {
+        MCCLibusbBulkStream* owner;
+        libusb_transfer* transfer;
+        unsigned char* buffer;
+        MCCBufferMemory memory;
+        double completedAt;     //Written by the callback before state becomes SLOT_COMPLETED.
+        std::atomic<int> state;
+    };
+
+    libusb_context* ctx;
+    libusb_device_handle* dev_handle;
+    unsigned char endpoint;
+    int mTransferSize;
+    int mNumTransfers;
+    bool mRunning;
+    bool mPinned;
+    MCCBufferMemory mMemory;    //The least capable memory any slot got.
+    Slot* mSlots;
+    //Slot indices in submission order. libusb completes transfers on one endpoint in this order.
+    std::vector<int> mQueue;
+    int mQueueHead;
+    int mQueueCount;
+
+    void submit(int index);
+    unsigned char* allocBuffer(bool pinned, MCCBufferMemory* memory);
+    void freeBuffer(unsigned char* buffer, MCCBufferMemory memory);
+    static void LIBUSB_CALL transferCallback(libusb_transfer* transfer);
+};
+
+#endif /* defined(____mccstream__) */
@@ -0,0 +1,57 @@
+//
+//  mcctransfer.cpp
+//
+
+#include <math.h>
+#include <algorithm>
+#include "mcctransfer.h"
+#include "mccdevice.h"
+
+MCCTransferPolicy::MCCTransferPolicy(double targetLatency, double queueTime, int maxTransferSize)
+:   mTargetLatency(targetLatency), mQueueTime(queueTime), mMaxTransferSize(maxTransferSize)
+{
+    if (targetLatency < 0 || queueTime < 0 || maxTransferSize <= 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+}
+
+MCCTransferPlan MCCTransferPolicy::plan(double sampRate, int channelCount, int bulkPacketSize) const
+{
+    MCCTransferPlan plan;
+    int scanBytes = channelCount * 2;
+    double bytesPerSecond = sampRate * scanBytes;
+
+    if (channelCount <= 0 || bulkPacketSize <= 0)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    //Transfers and blocks are whole packets and whole scans.
+    int step = packetAndScanSize(bulkPacketSize, scanBytes);
+    if (step > mMaxTransferSize)
+        throw MCC_ERR_INVALID_BUFFER_SIZE;
+
+    long long steps = 1;
+    if (bytesPerSecond > 0)
+        steps = std::max(1LL, llround(mTargetLatency * bytesPerSecond / step));
+    steps = std::min(steps, (long long)(mMaxTransferSize / step));
+
+    plan.transferSize = (int)(steps * step);
+    plan.samplesPerBlock = plan.transferSize / scanBytes;
+    plan.latency = bytesPerSecond > 0 ? plan.transferSize / bytesPerSecond : 0;
+    plan.transfersPerSecond = plan.latency > 0 ? 1 / plan.latency : 0;
+    plan.numTransfers = maxTransfers;
+    if (plan.latency > 0)
+        plan.numTransfers = (int)std::min((double)maxTransfers, ceil(mQueueTime / plan.latency));
+    plan.numTransfers = std::max(plan.numTransfers, (int)minTransfers);
+    return plan;
+}
+
+int MCCTransferPolicy::packetAndScanSize(int bulkPacketSize, int scanBytes)
+{
+    int a = bulkPacketSize, b = scanBytes, t;
+    while (b != 0)
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return bulkPacketSize / a * scanBytes;
+}
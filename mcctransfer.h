@@ -0,0 +1,56 @@
+//
+//  mcctransfer.h
+//  Sizing bulk transfers from a latency target.
+//  Every bulk transfer costs a syscall, a completion and a wakeup however much it carries, and its
+//  first scan waits until the last one has arrived. Small transfers give low latency at a high CPU
+//  cost; large ones the opposite. MCCTransferPolicy makes that trade explicit: it is given the
+//  latency one transfer may add and works out the transfer size, the block size and how many
+//  transfers to keep queued for the current rate and channel count:
+//
+//      dev.setTransferPolicy(MCCTransferPolicy(0.005));   //5 ms per transfer
+//      dev.startStream();                                  //Sized from the plan.
+//      dev.getTransferPlan().transfersPerSecond;           //What it costs.
+//
+
+#ifndef ____mcctransfer__
+#define ____mcctransfer__
+
+struct MCCTransferPlan
+{
+    int transferSize;           //Bytes, a multiple of bulkPacketSize and of the scan size.
+    int samplesPerBlock;        //Scans in one transfer, for MCCDevice::mSamplesPerBlock.
+    int numTransfers;           //Transfers to keep queued while streaming.
+    double latency;             //Seconds to fill one transfer at the nominal rate.
+    double transfersPerSecond;
+};
+
+class MCCTransferPolicy
+{
+public:
+    //targetLatency is the seconds of scans one transfer should hold; the plan rounds it to whole
+    //packets and scans, so it is met to within one packet. queueTime is the seconds of data the
+    //queued transfers cover, i.e. how long the host may stall before the device FIFO takes over.
+    //Transfers never exceed maxTransferSize bytes, however slow the latency target allows.
+    explicit MCCTransferPolicy(double targetLatency = 0.01, double queueTime = 0.25, int maxTransferSize = 262144);
+
+    //Throws MCC_ERR_INVALID_BUFFER_SIZE if a single packetAndScanSize is over maxTransferSize.
+    MCCTransferPlan plan(double sampRate, int channelCount, int bulkPacketSize) const;
+
+    //Smallest size in bytes that holds whole packets, so the device never overflows a transfer,
+    //and whole scans, so every transfer starts at the first channel: lcm(bulkPacketSize, scanBytes).
+    static int packetAndScanSize(int bulkPacketSize, int scanBytes);
+
+    double targetLatency() const { return mTargetLatency; }
+    double queueTime() const { return mQueueTime; }
+    int maxTransferSize() const { return mMaxTransferSize; }
+
+    static const int minTransfers = 2;      //One filling while the last is handled.
+    static const int maxTransfers = 64;
+
+private:
+    double mTargetLatency;
+    double mQueueTime;
+    int mMaxTransferSize;
+};
+
+#endif /* defined(____mcctransfer__) */
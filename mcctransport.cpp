@@ -0,0 +1,50 @@
+//
+//  mcctransport.cpp
+//
+
+#include "mccdevice.h"
+#include "mcctransport.h"
+
+MCCControlQueue* MCCTransport::createControlQueue()
+{
+    return new MCCThreadControlQueue(this);
+}
+
+MCCLibusbTransport::MCCLibusbTransport(libusb_context* ctx, libusb_device_handle* dev_handle)
+:   ctx(ctx), dev_handle(dev_handle)
+{
+    int err = libusb_claim_interface(dev_handle, 0);
+    if (err < 0)
+    {
+        libusb_close(dev_handle);
+        throw libUSBError(err);
+    }
+}
+
+MCCLibusbTransport::~MCCLibusbTransport()
+{
+    libusb_release_interface(dev_handle, 0);
+    libusb_close(dev_handle);
+}
+
+int MCCLibusbTransport::controlTransfer(uint8_t requestType, uint8_t request, uint16_t wValue, uint16_t wIndex,
+                                        unsigned char* data, uint16_t length, unsigned int timeout)
+{
+    return libusb_control_transfer(dev_handle, requestType, request, wValue, wIndex, data, length, timeout);
+}
+
+int MCCLibusbTransport::bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+                                     int* transferred, unsigned int timeout)
+{
+    return libusb_bulk_transfer(dev_handle, endpoint, data, length, transferred, timeout);
+}
+
+MCCBulkStream* MCCLibusbTransport::createBulkStream(unsigned char endpoint, int transferSize, int numTransfers, bool pinned)
+{
+    return new MCCLibusbBulkStream(ctx, dev_handle, endpoint, transferSize, numTransfers, pinned);
+}
+
+MCCControlQueue* MCCLibusbTransport::createControlQueue()
+{
+    return new MCCLibusbControlQueue(ctx, dev_handle);
+}
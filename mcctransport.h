@@ -0,0 +1,56 @@
+//
+//  mcctransport.h
+//  The USB transport MCCDevice talks through.
+//  MCCLibusbTransport carries control and bulk transfers to real hardware through libusb.
+//  Other implementations (e.g. MCCSimTransport in mccsimdevice.h) let the whole driver run
+//  without a device attached.
+//  Return values follow libusb: bytes transferred, or a negative LIBUSB_ERROR code.
+//
+
+#ifndef ____mcctransport__
+#define ____mcctransport__
+
+#include <libusb.h>
+#include "mccstream.h"
+#include "mcccontrol.h"
+
+class MCCTransport
+{
+public:
+    virtual ~MCCTransport() {}
+
+    virtual int controlTransfer(uint8_t requestType, uint8_t request, uint16_t wValue, uint16_t wIndex,
+                                unsigned char* data, uint16_t length, unsigned int timeout) = 0;
+    virtual int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+                             int* transferred, unsigned int timeout) = 0;
+    //Caller owns the returned stream and must delete it before the transport.
+    //pinned asks for transfer buffers the kernel can fill without a copy (see MCCBufferMemory); it is a hint.
+    virtual MCCBulkStream* createBulkStream(unsigned char endpoint, int transferSize, int numTransfers, bool pinned) = 0;
+    //Caller owns the returned queue and must delete it before the transport. The default runs
+    //controlTransfer on a worker thread.
+    virtual MCCControlQueue* createControlQueue();
+};
+
+//Transport over an opened libusb device. Takes ownership of dev_handle and claims interface 0 on construction;
+//releases it and closes the handle on destruction.
+class MCCLibusbTransport : public MCCTransport
+{
+public:
+    MCCLibusbTransport(libusb_context* ctx, libusb_device_handle* dev_handle);
+    ~MCCLibusbTransport();
+
+    int controlTransfer(uint8_t requestType, uint8_t request, uint16_t wValue, uint16_t wIndex,
+                        unsigned char* data, uint16_t length, unsigned int timeout);
+    int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+                     int* transferred, unsigned int timeout);
+    MCCBulkStream* createBulkStream(unsigned char endpoint, int transferSize, int numTransfers, bool pinned);
+    MCCControlQueue* createControlQueue();
+
+    libusb_device_handle* handle() const { return dev_handle; }
+
+private:
+    libusb_context* ctx;
+    libusb_device_handle* dev_handle;
+};
+
+#endif /* defined(____mcctransport__) */
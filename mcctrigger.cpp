@@ -0,0 +1,274 @@
+//
+//  mcctrigger.cpp
+//
+
+#include <math.h>
+#include <algorithm>
+#include "mccerror.h"
+#include "mcctrigger.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MCC_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if MCC_HAVE_SSE2 && defined(__GNUC__)
+#define MCC_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define PATTERN_SCANS 16 //Scans in the lane pattern: one AVX2 vector of samples always lines up with it.
+#define NEVER_ABOVE 32767
+#define NEVER_BELOW (-32768)
+
+//Both kernels return how many samples from the start hold no tripped lane, in whole vectors.
+//p is the pattern lane of data[0], a multiple of the vector width.
+#if MCC_HAVE_SSE2
+static int findTripSSE2(const unsigned short* data, int length, const int16_t* above, const int16_t* below,
+                        int patternLength, int p)
+{
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    int i;
+    for (i = 0; i + 8 <= length; i += 8)
+    {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&data[i]), bias);
+        __m128i trip = _mm_or_si128(_mm_cmpgt_epi16(x, _mm_loadu_si128((const __m128i*)&above[p])),
+                                    _mm_cmpgt_epi16(_mm_loadu_si128((const __m128i*)&below[p]), x));
+        if (_mm_movemask_epi8(trip))
+            break;
+        p += 8;
+        if (p == patternLength)
+            p = 0;
+    }
+    return i;
+}
+#endif
+
+#if MCC_HAVE_AVX2
+__attribute__((target("avx2")))
+static int findTripAVX2(const unsigned short* data, int length, const int16_t* above, const int16_t* below,
+                        int patternLength, int p)
+{
+    const __m256i bias = _mm256_set1_epi16((short)0x8000);
+    int i;
+    for (i = 0; i + 16 <= length; i += 16)
+    {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&data[i]), bias);
+        __m256i trip = _mm256_or_si256(_mm256_cmpgt_epi16(x, _mm256_loadu_si256((const __m256i*)&above[p])),
+                                       _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i*)&below[p]), x));
+        if (!_mm256_testz_si256(trip, trip))
+            break;
+        p += 16;
+        if (p == patternLength)
+            p = 0;
+    }
+    return i;
+}
+
+static bool cpuHasAVX2()
+{
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+#endif
+
+MCCTriggerEngine::MCCTriggerEngine(const MCCConverter& converter, size_t capacity)
+:   mChannelCount(0), mEvents(capacity), mCount(0), mDropped(0)
+{
+    setCalibration(converter);
+}
+
+void MCCTriggerEngine::setCalibration(const MCCConverter& converter)
+{
+    mChannelCount = converter.channelCount();
+    mChannels.resize(mChannelCount);
+    mAbove.assign(PATTERN_SCANS * mChannelCount, NEVER_ABOVE);
+    mBelow.assign(PATTERN_SCANS * mChannelCount, NEVER_BELOW);
+    for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+    {
+        mChannels[chanIdx].gain = converter.gain(chanIdx);
+        mChannels[chanIdx].offset = converter.offset(chanIdx);
+        convertThresholds(chanIdx);
+        mChannels[chanIdx].level = LEVEL_UNKNOWN;
+        updatePattern(chanIdx);
+    }
+}
+
+void MCCTriggerEngine::setTrigger(int chanIdx, double threshold, double hysteresis, MCCTriggerEdge edge)
+{
+    if (chanIdx < 0 || chanIdx >= mChannelCount)
+        throw MCC_ERR_INVALID_ID;
+    Channel& ch = mChannels[chanIdx];
+    ch.edge = edge;
+    ch.threshold = threshold;
+    ch.hysteresis = fabs(hysteresis);
+    ch.level = LEVEL_UNKNOWN;
+    convertThresholds(chanIdx);
+    updatePattern(chanIdx);
+}
+
+void MCCTriggerEngine::clearTrigger(int chanIdx)
+{
+    setTrigger(chanIdx, 0, 0, MCC_EDGE_NONE);
+}
+
+void MCCTriggerEngine::rearm()
+{
+    for (int chanIdx = 0; chanIdx < mChannelCount; chanIdx++)
+    {
+        mChannels[chanIdx].level = LEVEL_UNKNOWN;
+        updatePattern(chanIdx);
+    }
+}
+
+//Turn the band in volts into the counts that switch the level. The calibration's gain is positive,
+//so counts grow with volts.
+void MCCTriggerEngine::convertThresholds(int chanIdx)
+{
+    Channel& ch = mChannels[chanIdx];
+    double high, low;
+
+    if (ch.edge == MCC_EDGE_NONE)
+    {
+        ch.upper = 65536;
+        ch.lower = -1;
+        return;
+    }
+    switch (ch.edge)
+    {
+        case MCC_EDGE_RISING:
+            high = ch.threshold;
+            low = ch.threshold - ch.hysteresis;
+            break;
+        case MCC_EDGE_FALLING:
+            high = ch.threshold + ch.hysteresis;
+            low = ch.threshold;
+            break;
+        default:
+            high = ch.threshold + ch.hysteresis / 2;
+            low = ch.threshold - ch.hysteresis / 2;
+            break;
+    }
+    high = ceil((high - ch.offset) / ch.gain);
+    low = floor((low - ch.offset) / ch.gain);
+    ch.upper = (int)std::min(std::max(high, 0.0), 65536.0);
+    ch.lower = (int)std::min(std::max(low, -1.0), 65535.0);
+    //Without hysteresis a sample exactly at the threshold would count as both high and low.
+    if (ch.lower >= ch.upper)
+        ch.lower = ch.upper - 1;
+}
+
+void MCCTriggerEngine::updatePattern(int chanIdx)
+{
+    const Channel& ch = mChannels[chanIdx];
+    int16_t above = NEVER_ABOVE, below = NEVER_BELOW;
+
+    if (ch.edge != MCC_EDGE_NONE)
+    {
+        //Trip on anything that could change the level; step() decides exactly.
+        if (ch.level != LEVEL_HIGH)
+            above = (int16_t)std::max(ch.upper - 1 - 32768, NEVER_BELOW);
+        if (ch.level != LEVEL_LOW)
+            below = (int16_t)std::min(ch.lower + 1 - 32768, NEVER_ABOVE);
+    }
+    for (size_t k = chanIdx; k < mAbove.size(); k += mChannelCount)
+    {
+        mAbove[k] = above;
+        mBelow[k] = below;
+    }
+}
+
+int MCCTriggerEngine::step(int chanIdx, unsigned short counts, unsigned long long sample)
+{
+    Channel& ch = mChannels[chanIdx];
+    Level level = ch.level;
+
+    if (ch.edge == MCC_EDGE_NONE)
+        return 0;
+    if (counts >= ch.upper)
+        level = LEVEL_HIGH;
+    else if (counts <= ch.lower)
+        level = LEVEL_LOW;
+    if (level == ch.level)
+        return 0;
+
+    Level before = ch.level;
+    ch.level = level;
+    updatePattern(chanIdx);
+    if (before == LEVEL_UNKNOWN)
+        return 0;
+    bool rising = level == LEVEL_HIGH;
+    if (!(ch.edge & (rising ? MCC_EDGE_RISING : MCC_EDGE_FALLING)))
+        return 0;
+
+    MCCTriggerEvent event;
+    event.scan = sample / mChannelCount;
+    event.chanIdx = chanIdx;
+    event.rising = rising;
+    event.counts = counts;
+    event.volts = (float)counts*ch.gain + ch.offset;
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    if (mCallback)
+        mCallback(event);
+    else if (!mEvents.push(event))
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+    return 1;
+}
+
+int MCCTriggerEngine::process(const unsigned short* data, int length, unsigned long long firstSample)
+{
+    int patternLength = (int)mAbove.size();
+    int events = 0, i = 0, n, stop;
+
+    if (mChannelCount <= 0)
+        return 0;
+    int p = (int)(firstSample % patternLength);
+    int chanIdx = (int)(firstSample % mChannelCount);
+    while (i < length)
+    {
+        //Skip whole vectors with nothing near a threshold, then look at the one that tripped.
+        stop = i + 1;
+        if (p % PATTERN_SCANS == 0 && length - i >= PATTERN_SCANS)
+        {
+            n = 0;
+#if MCC_HAVE_AVX2
+            if (cpuHasAVX2())
+                n = findTripAVX2(&data[i], length - i, mAbove.data(), mBelow.data(), patternLength, p);
+            else
+#endif
+#if MCC_HAVE_SSE2
+            n = findTripSSE2(&data[i], length - i, mAbove.data(), mBelow.data(), patternLength, p);
+#endif
+            if (n > 0)
+            {
+                i += n;
+                p = (p + n) % patternLength;
+                chanIdx = (chanIdx + n) % mChannelCount;
+                continue;
+            }
+            stop = i + PATTERN_SCANS;
+        }
+        for (; i < stop; i++)
+        {
+            events += step(chanIdx, data[i], firstSample + i);
+            if (++p == patternLength)
+                p = 0;
+            if (++chanIdx == mChannelCount)
+                chanIdx = 0;
+        }
+    }
+    return events;
+}
+
+const char* MCCTriggerEngine::kernelName()
+{
+#if MCC_HAVE_AVX2
+    if (cpuHasAVX2())
+        return "avx2";
+#endif
+#if MCC_HAVE_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,122 @@
+//
+//  mcctrigger.h
+//  Threshold crossings on the live stream.
+//  MCCTriggerEngine watches selected channels for a level crossing with hysteresis (a Schmitt
+//  trigger) and reports each one as an event tagged with its scan index. Thresholds are given in
+//  volts and turned into raw counts once, with the device's calibration (MCCConverter's gain and
+//  offset), so the stream is compared in counts without converting it. The compares are SSE2 or
+//  AVX2, 8 or 16 samples at a time; only the rare vector holding a crossing is looked at sample by
+//  sample.
+//
+//  Attached to a device with MCCDevice::setTriggerEngine, every transfer is scanned as soon as it
+//  arrives, before it is copied into the caller's block, so an event is at most one transfer late.
+//  It can also be run by hand on any interleaved samples with process().
+//
+//      MCCTriggerEngine trig(dev.getConverter());
+//      trig.setTrigger(3, 2.5, 0.1, MCC_EDGE_RISING);     //Channel 3 rises through 2.5 V; re-armed below 2.4 V
+//      dev.setTriggerEngine(&trig);
+//      ...
+//      MCCTriggerEvent event;
+//      while (trig.pop(&event))
+//          printf("channel %d at scan %llu\n", event.chanIdx, event.scan);
+//
+
+#ifndef ____mcctrigger__
+#define ____mcctrigger__
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "mccconvert.h"
+#include "mccring.h"
+
+enum MCCTriggerEdge
+{
+    MCC_EDGE_NONE = 0,
+    MCC_EDGE_RISING = 1,
+    MCC_EDGE_FALLING = 2,
+    MCC_EDGE_BOTH = 3,
+};
+
+struct MCCTriggerEvent
+{
+    unsigned long long scan;    //Scan of the first sample past the threshold, counted like MCCDevice::getScanCount().
+    int chanIdx;                //Within the scan's channel range.
+    bool rising;
+    unsigned short counts;      //That sample, raw and in volts.
+    float volts;
+};
+
+typedef std::function<void(const MCCTriggerEvent&)> MCCTriggerCallback;
+
+class MCCTriggerEngine
+{
+public:
+    //Takes the channel count and calibration from converter. capacity events can wait in the queue.
+    MCCTriggerEngine(const MCCConverter& converter, size_t capacity = 4096);
+
+    //Report crossings of threshold volts on chanIdx in the given direction. hysteresis volts is the
+    //band the signal has to cross back through before the channel can fire again: a rising trigger
+    //re-arms below threshold - hysteresis, a falling one above threshold + hysteresis, and
+    //MCC_EDGE_BOTH switches at threshold +/- hysteresis/2. Configure before the stream runs.
+    void setTrigger(int chanIdx, double threshold, double hysteresis, MCCTriggerEdge edge);
+    void clearTrigger(int chanIdx);
+    //Convert the thresholds again for new calibration or a new channel count (MCCDevice::reconfigure
+    //does this for an attached engine). Channels beyond the new count are cleared.
+    void setCalibration(const MCCConverter& converter);
+    //Forget every channel's level. Each one fires only after it has been seen on the far side of
+    //its band, so the first samples of a scan never fire on their own.
+    void rearm();
+
+    //Called for each event from the thread running process(), instead of queueing it. Set before
+    //the stream runs; an empty function goes back to the queue.
+    void setCallback(MCCTriggerCallback callback) { mCallback = callback; }
+
+    //Scan length interleaved samples. firstSample is the index of data[0] in the stream (scans times
+    //channels plus channel), so data may start anywhere in a scan. Returns the number of events.
+    int process(const unsigned short* data, int length, unsigned long long firstSample);
+
+    //Take the oldest queued event. Never blocks. Call from one thread only.
+    bool pop(MCCTriggerEvent* event) { return mEvents.pop(*event); }
+    unsigned long long events() const { return mCount.load(std::memory_order_relaxed); }
+    unsigned long long dropped() const { return mDropped.load(std::memory_order_relaxed); }   //Lost to a full queue.
+
+    int channelCount() const { return mChannelCount; }
+
+    //Which kernel process() dispatches to: "avx2", "sse2" or "scalar".
+    static const char* kernelName();
+
+private:
+    enum Level { LEVEL_UNKNOWN, LEVEL_LOW, LEVEL_HIGH };
+
+    struct Channel
+    {
+        MCCTriggerEdge edge;
+        double threshold;       //Volts, as set.
+        double hysteresis;
+        int upper;              //Counts at or above which the channel is high; 65536 for never.
+        int lower;              //Counts at or below which it is low; -1 for never.
+        Level level;
+        float gain;
+        float offset;
+    };
+
+    int mChannelCount;
+    std::vector<Channel> mChannels;
+    //Per lane of a 16-scan pattern (lane k belongs to channel k % mChannelCount): counts biased by
+    //-32768 so a signed 16-bit compare works. A sample trips its lane if it is above mAbove or
+    //below mBelow, which is the case whenever its channel could change level.
+    std::vector<int16_t> mAbove;
+    std::vector<int16_t> mBelow;
+    MCCTriggerCallback mCallback;
+    MCCSpscQueue<MCCTriggerEvent> mEvents;
+    std::atomic<unsigned long long> mCount;
+    std::atomic<unsigned long long> mDropped;
+
+    void convertThresholds(int chanIdx);
+    void updatePattern(int chanIdx);
+    int step(int chanIdx, unsigned short counts, unsigned long long sample);
+};
+
+#endif /* defined(____mcctrigger__) */